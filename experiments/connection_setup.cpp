@@ -0,0 +1,101 @@
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../verbs.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+static const int ROW_SIZE = 64;
+static const int MIN_MEMBERS = 8;
+static const int MAX_MEMBERS = 128;
+
+/*
+ * Measures the time to connect an SST table as the group grows from
+ * MIN_MEMBERS to MAX_MEMBERS, connecting one queue pair at a time as SST
+ * used to, and all at once with verbs_make_connections() as SST does now.
+ * Larger groups are simulated by opening several connections to each remote
+ * node, so 2 nodes are enough to reach any group size.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the rdma resources
+    verbs_initialize(ip_addrs, node_rank);
+
+    ofstream fout;
+    if(node_rank == 0) {
+        fout.open("connection_setup.csv", ofstream::app);
+    }
+    for(int num_members = MIN_MEMBERS; num_members <= MAX_MEMBERS;
+        num_members *= 2) {
+        const int per_node = (num_members + num_nodes - 3) / (num_nodes - 1);
+        vector<char> table(ROW_SIZE * per_node * num_nodes);
+        verbs_register_memory(table.data(), table.size());
+        vector<connection_request> requests;
+        for(int k = 0; k < per_node; ++k) {
+            for(int r = num_nodes - 1; r >= 0; --r) {
+                if((uint32_t)r == node_rank) {
+                    continue;
+                }
+                char *write_addr =
+                    table.data() + ROW_SIZE * (k * num_nodes + r);
+                char *read_addr = table.data() + ROW_SIZE * node_rank;
+                requests.push_back(
+                    {r, write_addr, read_addr, ROW_SIZE, ROW_SIZE});
+            }
+        }
+
+        double setup_ms[2];
+        for(int batched = 0; batched < 2; ++batched) {
+            long long int start_time = experiments::get_realtime_clock();
+            vector<unique_ptr<connection>> connections;
+            if(batched) {
+                connections = verbs_make_connections(requests);
+            } else {
+                for(const auto &request : requests) {
+                    connections.push_back(std::make_unique<resources>(
+                        request.r_index, request.write_addr,
+                        request.read_addr, request.size_w, request.size_r));
+                }
+            }
+            long long int end_time = experiments::get_realtime_clock();
+            setup_ms[batched] = (end_time - start_time) / 1000000.0;
+
+            for(uint32_t r = 0; r < num_nodes; ++r) {
+                if(r != node_rank) {
+                    sync(r);
+                }
+            }
+        }
+        if(node_rank == 0) {
+            cout << requests.size() + 1 << " members: one at a time "
+                 << setup_ms[0] << " ms, all at once " << setup_ms[1] << " ms"
+                 << endl;
+            fout << requests.size() + 1 << "," << setup_ms[0] << ","
+                 << setup_ms[1] << endl;
+        }
+        verbs_deregister_memory(table.data());
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../sst.h"
+#include "statistics.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+static const int NUM_TRIALS = 1000;
+
+/** A wide row of `Width` counters, of which each trial changes a few. */
+template <int Width>
+struct WideRow {
+    volatile int64_t data[Width];
+};
+
+/*
+ * Runs the trials for one row width: for each number of changed fields,
+ * node 0 changes that many fields at random and puts the whole row, then
+ * changes them again, marks them with mark_dirty() and puts the dirty
+ * ranges. Reports the mean latency of a put and the bytes it writes to each
+ * receiver.
+ */
+template <int Width>
+static void run(uint32_t node_rank, const vector<uint32_t> &members,
+                ofstream &fout) {
+    typedef SST<WideRow<Width>> wide_sst;
+    SST_Options options;
+    options.track_dirty_ranges = true;
+    wide_sst sst(members, node_rank, nullptr, {}, true, options);
+    const uint32_t local = sst.get_local_index();
+    sst.put();
+    sst.sync_with_members();
+
+    const int num_receivers = members.size() - 1;
+    const vector<string> methods = {"whole row", "dirty ranges"};
+    std::mt19937 engine(Width);
+    std::uniform_int_distribution<int> field_rand(0, Width - 1);
+    for(int num_changed : {1, 4, 16}) {
+        for(unsigned int method = 0; method < methods.size(); ++method) {
+            if(node_rank == 0) {
+                vector<long long int> start_times(NUM_TRIALS),
+                    end_times(NUM_TRIALS);
+                uint64_t bytes_before = sst.get_put_bytes();
+                for(int i = 0; i < NUM_TRIALS; ++i) {
+                    start_times[i] = experiments::get_realtime_clock();
+                    for(int j = 0; j < num_changed; ++j) {
+                        int field = field_rand(engine);
+                        sst[local].data[field] = i;
+                        if(method == 1) {
+                            sst.mark_dirty(&sst[local].data[field],
+                                           sizeof(int64_t));
+                        }
+                    }
+                    if(method == 0) {
+                        sst.put(0, sizeof(WideRow<Width>));
+                    } else {
+                        sst.put();
+                    }
+                    end_times[i] = experiments::get_realtime_clock();
+                }
+                double bytes_per_put =
+                    (double)(sst.get_put_bytes() - bytes_before) /
+                    NUM_TRIALS / num_receivers;
+                double mean, stdev;
+                std::tie(mean, stdev) =
+                    experiments::compute_statistics(start_times, end_times);
+                cout << sizeof(WideRow<Width>) << "-byte row, " << num_changed
+                     << " fields changed, " << methods[method]
+                     << ": put latency (us) mean " << mean << " stdev "
+                     << stdev << ", " << bytes_per_put
+                     << " bytes per receiver" << endl;
+                fout << sizeof(WideRow<Width>) << "," << num_changed << ","
+                     << methods[method] << "," << members.size() << ","
+                     << mean << "," << stdev << "," << bytes_per_put << endl;
+            }
+            sst.sync_with_members();
+        }
+    }
+}
+
+/*
+ * Compares a plain put() of wide rows, which writes the whole row, with the
+ * put() of an SST that tracks dirty ranges, which writes only the fields
+ * that changed, merged into at most MAX_PUT_RANGES ranges.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the transport named by SST_TRANSPORT
+    transport_initialize(ip_addrs, node_rank);
+
+    vector<uint32_t> members(num_nodes);
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        members[i] = i;
+    }
+    ofstream fout;
+    if(node_rank == 0) {
+        fout.open("dirty_range_put.csv", ofstream::app);
+    }
+    run<64>(node_rank, members, fout);
+    run<1024>(node_rank, members, fout);
+    run<8192>(node_rank, members, fout);
+    return 0;
+}
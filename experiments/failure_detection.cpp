@@ -0,0 +1,115 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../sst.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+struct FailureRow {
+    /** Set by the failing node just before it fails. */
+    volatile uint64_t failing;
+};
+
+typedef SST<FailureRow> failure_sst;
+
+/** When the failing node's row froze, or 0 until it has. */
+static std::atomic<long long int> freeze_time{0};
+
+/*
+ * Measures how long it takes the surviving nodes to freeze the row of a
+ * node that fails, under a given heartbeat policy. The node with the highest
+ * rank announces that it is about to fail and then either crashes, which
+ * tears down its connections, or stalls, which leaves its connections up so
+ * that only the missed heartbeats give it away. Each survivor reports the
+ * time from the announcement to the failure upcall.
+ *
+ * Usage: failure_detection [interval_ms [timeout_ms [crash|stall]]], with
+ * the node rank, number of nodes and ip addresses on standard input. A
+ * stalled node must be killed once the survivors are done.
+ */
+int main(int argc, char *argv[]) {
+    const int interval_ms = argc > 1 ? atoi(argv[1]) : 10;
+    const int timeout_ms = argc > 2 ? atoi(argv[2]) : 100;
+    const string failure = argc > 3 ? argv[3] : "stall";
+
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the transport named by SST_TRANSPORT
+    transport_initialize(ip_addrs, node_rank);
+
+    vector<uint32_t> members(num_nodes);
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        members[i] = i;
+    }
+    const uint32_t victim = num_nodes - 1;
+
+    SST_Options options;
+    options.heartbeats.interval_ms = interval_ms;
+    options.heartbeats.timeout_ms = timeout_ms;
+    failure_sst sst(members, node_rank,
+                    [victim](uint32_t failed_node_rank) {
+                        if(failed_node_rank == victim) {
+                            freeze_time = experiments::get_realtime_clock();
+                        }
+                    },
+                    {}, true, options);
+    const uint32_t local = sst.get_local_index();
+    sst[local].failing = 0;
+    sst.put();
+    sst.sync_with_members();
+
+    if(node_rank == victim) {
+        // let every survivor see some heartbeats first
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        sst[local].failing = 1;
+        sst.put();
+        if(failure == "crash") {
+            _exit(0);
+        }
+        raise(SIGSTOP);
+        return 0;
+    }
+
+    while(sst[victim].failing == 0) {
+    }
+    long long int failed_at = experiments::get_realtime_clock();
+    while(freeze_time == 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double detection_ms = (double)(freeze_time - failed_at) / MILLIS_TO_NS;
+    cout << failure << " with heartbeats every " << interval_ms
+         << " ms and a timeout of " << timeout_ms << " ms: frozen after "
+         << detection_ms << " ms" << endl;
+    if(node_rank == 0) {
+        ofstream fout("failure_detection.csv", ofstream::app);
+        fout << failure << "," << interval_ms << "," << timeout_ms << ","
+             << detection_ms << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "../sst.h"
+#include "statistics.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+struct EchoRow {
+    volatile uint64_t seq;
+    /** CPU use of the echoing node during the last round, in cores * 1000. */
+    volatile uint64_t millicores;
+    volatile uint64_t num_reports;
+};
+
+typedef SST<EchoRow> echo_sst;
+
+static const int NUM_PINGS = 1000;
+/** Pause before each ping, so that the echoing node goes idle. */
+static const int IDLE_GAP_US = 2000;
+
+static long long int process_cpu_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return time.tv_sec * SECONDS_TO_NS + time.tv_nsec;
+}
+
+/*
+ * Measures the latency/CPU tradeoff of the idle_wait policies. Node 0 pings
+ * node 1 after a pause long enough for node 1 to go idle, and node 1 echoes
+ * each ping from a predicate trigger; node 0 records the one-way latency and
+ * node 1 reports how many cores it burned during the round, which is almost
+ * all spent in its SST threads.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the transport named by SST_TRANSPORT
+    transport_initialize(ip_addrs, node_rank);
+
+    vector<uint32_t> members(num_nodes);
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        members[i] = i;
+    }
+
+    // (spin_us, max_sleep_us) of each round; the first one always spins
+    const vector<std::pair<int, int>> policies = {
+        {-1, 0}, {100, 50}, {100, 1000}, {0, 10000}};
+    ofstream fout;
+    if(node_rank == 0) {
+        fout.open("idle_wait_tradeoff.csv", ofstream::app);
+    }
+    const long long int seq_offset = offsetof(EchoRow, seq);
+    for(auto policy : policies) {
+        SST_Options options;
+        options.idle_wait.spin_us = policy.first;
+        options.idle_wait.max_sleep_us = policy.second;
+        echo_sst sst(members, node_rank, nullptr, {}, true, options);
+        const uint32_t local = sst.get_local_index();
+        sst[local].seq = 0;
+        sst[local].millicores = 0;
+        sst[local].num_reports = 0;
+        sst.put();
+        sst.sync_with_members();
+
+        if(node_rank == 1) {
+            sst.predicates.insert(
+                [](const echo_sst &sst) {
+                    return sst[0].seq != sst[sst.get_local_index()].seq;
+                },
+                [seq_offset](echo_sst &sst) {
+                    sst[sst.get_local_index()].seq = sst[0].seq;
+                    sst.put({0}, seq_offset, sizeof(uint64_t));
+                },
+                PredicateType::RECURRENT);
+        }
+        sst.sync_with_members();
+
+        vector<long long int> start_times(NUM_PINGS), end_times(NUM_PINGS);
+        long long int wall_start = experiments::get_realtime_clock();
+        long long int cpu_start = process_cpu_time();
+        if(node_rank == 0) {
+            for(int i = 1; i <= NUM_PINGS; ++i) {
+                std::this_thread::sleep_for(
+                    std::chrono::microseconds(IDLE_GAP_US));
+                start_times[i - 1] = experiments::get_realtime_clock();
+                sst[local].seq = i;
+                sst.put({1}, seq_offset, sizeof(uint64_t));
+                while(sst[1].seq != (uint64_t)i) {
+                }
+                end_times[i - 1] = experiments::get_realtime_clock();
+            }
+        } else if(node_rank == 1) {
+            // stay off the CPU, so that only the SST threads are measured
+            while(sst[0].seq != (uint64_t)NUM_PINGS) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            double cores = (double)(process_cpu_time() - cpu_start) /
+                           (experiments::get_realtime_clock() - wall_start);
+            sst[local].millicores = cores * 1000;
+            sst[local].num_reports = 1;
+            sst.put({0});
+        }
+
+        if(node_rank == 0) {
+            while(sst[1].num_reports == 0) {
+            }
+            double mean, stdev;
+            std::tie(mean, stdev) =
+                experiments::compute_statistics(start_times, end_times, 2);
+            double cores = sst[1].millicores / 1000.0;
+            cout << "spin " << policy.first << " us, max sleep "
+                 << policy.second << " us: one-way latency (us) mean "
+                 << mean << " stdev " << stdev << ", " << cores
+                 << " cores at the echoing node" << endl;
+            fout << policy.first << "," << policy.second << "," << mean << ","
+                 << stdev << "," << cores << endl;
+        }
+        sst.sync_with_members();
+    }
+    return 0;
+}
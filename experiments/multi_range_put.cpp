@@ -0,0 +1,103 @@
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../sst.h"
+#include "statistics.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+static const int NUM_SLOTS = 64;
+static const int SLOT_SIZE = 64;
+static const int NUM_TRIALS = 10000;
+
+/** A multicast-style row: a ring of message slots, and the counter that
+ * says how many have been filled, far from most of them. */
+struct SlotRow {
+    volatile char slots[NUM_SLOTS][SLOT_SIZE];
+    volatile uint64_t next_seq;
+};
+
+typedef SST<SlotRow> slot_sst;
+
+/*
+ * Measures the latency of publishing one slot along with the counter, with
+ * node 0 writing to every other node: as a put of the whole row, as one put
+ * per field, and as a single put of both ranges.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the transport named by SST_TRANSPORT
+    transport_initialize(ip_addrs, node_rank);
+
+    vector<uint32_t> members(num_nodes);
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        members[i] = i;
+    }
+    slot_sst sst(members, node_rank);
+    const uint32_t local = sst.get_local_index();
+    sst[local].next_seq = 0;
+    sst.put();
+    sst.sync_with_members();
+
+    const vector<string> methods = {"whole row", "per field", "ranges"};
+    ofstream fout;
+    if(node_rank == 0) {
+        fout.open("multi_range_put.csv", ofstream::app);
+    }
+    const long long int seq_offset = offsetof(SlotRow, next_seq);
+    for(unsigned int method = 0; method < methods.size(); ++method) {
+        vector<long long int> start_times(NUM_TRIALS), end_times(NUM_TRIALS);
+        if(node_rank == 0) {
+            for(int i = 0; i < NUM_TRIALS; ++i) {
+                const int slot = i % NUM_SLOTS;
+                const long long int slot_offset =
+                    offsetof(SlotRow, slots) + slot * SLOT_SIZE;
+                start_times[i] = experiments::get_realtime_clock();
+                sst[local].slots[slot][0] = (char)i;
+                sst[local].next_seq = i + 1;
+                if(method == 0) {
+                    sst.put();
+                } else if(method == 1) {
+                    sst.put(slot_offset, SLOT_SIZE);
+                    sst.put(seq_offset, sizeof(uint64_t));
+                } else {
+                    sst.put(vector<byte_range>{{slot_offset, SLOT_SIZE},
+                                               {seq_offset,
+                                                sizeof(uint64_t)}});
+                }
+                end_times[i] = experiments::get_realtime_clock();
+            }
+            double mean, stdev;
+            std::tie(mean, stdev) = experiments::compute_statistics(
+                start_times, end_times);
+            cout << methods[method] << ": put latency (us) mean " << mean
+                 << " stdev " << stdev << endl;
+            fout << methods[method] << "," << num_nodes << "," << mean << ","
+                 << stdev << endl;
+        }
+        sst.sync_with_members();
+    }
+    return 0;
+}
@@ -88,7 +88,8 @@ class group {
 
 public:
     group(std::vector<uint> members, uint32_t my_id,
-          receiver_callback_t receiver_callback)
+          receiver_callback_t receiver_callback,
+          const sst::SST_Options& options = sst::SST_Options())
         : receiver_callback(receiver_callback) {
         num_members = members.size();
         assert(num_members <= max_members);
@@ -98,7 +99,8 @@ public:
                 break;
             }
         }
-        multicastSST = std::make_unique<SST_type>(members, my_rank);
+        multicastSST = std::make_unique<SST_type>(
+            members, my_rank, nullptr, std::vector<char>{}, true, options);
         initialize();
         register_predicates();
     }
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../sst.h"
+#include "statistics.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+static const int NUM_SAMPLES = 10000;
+static const int SAMPLE_INTERVAL_NS = 100000;
+
+/** A row with a counter that its owner keeps changing. */
+struct CounterRow {
+    volatile int64_t counter;
+    volatile char payload[1016];
+};
+
+typedef SST<CounterRow, Mode::Reads> counter_sst;
+
+/*
+ * Runs one reader configuration: every node other than node 0 keeps
+ * incrementing its counter while node 0 samples, every
+ * SAMPLE_INTERVAL_NS, how stale each remote row is by its refresh time.
+ * Reports the refreshes per second that node 0's reader thread completed
+ * and the mean and largest staleness it saw.
+ */
+static void run(uint32_t node_rank, const vector<uint32_t> &members,
+                unsigned int reads_in_flight, ofstream &fout) {
+    using std::chrono::steady_clock;
+    SST_Options options;
+    options.reads_in_flight = reads_in_flight;
+    counter_sst sst(members, node_rank, nullptr, {}, true, options);
+    const uint32_t local = sst.get_local_index();
+    sst[local].counter = 0;
+    sst.sync_with_members();
+
+    if(node_rank == 0) {
+        // sample only once every remote row has been refreshed
+        const auto synced = steady_clock::now();
+        for(uint32_t index = 0; index < members.size(); ++index) {
+            while(index != local && sst.get_refresh_time(index) < synced) {
+            }
+        }
+    }
+    const long long int duration_ns =
+        (long long int)NUM_SAMPLES * SAMPLE_INTERVAL_NS;
+    const long long int start = experiments::get_realtime_clock();
+    if(node_rank == 0) {
+        const uint64_t bytes_before = sst.get_read_bytes();
+        vector<long long int> refresh_times, sample_times;
+        long long int max_staleness = 0;
+        for(int i = 0; i < NUM_SAMPLES; ++i) {
+            const auto now = steady_clock::now();
+            for(uint32_t index = 0; index < members.size(); ++index) {
+                if(index == local) {
+                    continue;
+                }
+                const long long int refreshed =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        sst.get_refresh_time(index).time_since_epoch())
+                        .count();
+                const long long int sampled =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        now.time_since_epoch())
+                        .count();
+                refresh_times.push_back(refreshed);
+                sample_times.push_back(sampled);
+                max_staleness = std::max(max_staleness, sampled - refreshed);
+            }
+            experiments::busy_wait_for(SAMPLE_INTERVAL_NS);
+        }
+        const double seconds =
+            (experiments::get_realtime_clock() - start) / 1e9;
+        const double refreshes_per_second =
+            (sst.get_read_bytes() - bytes_before) / sizeof(CounterRow) /
+            seconds;
+        double mean, stdev;
+        std::tie(mean, stdev) =
+            experiments::compute_statistics(refresh_times, sample_times);
+        const string method = reads_in_flight == 0
+                                  ? "barrier"
+                                  : "pipelined " +
+                                        std::to_string(reads_in_flight);
+        cout << method << ": " << refreshes_per_second
+             << " refreshes per second, staleness (us) mean " << mean
+             << " stdev " << stdev << " max " << max_staleness / 1000.0
+             << endl;
+        fout << method << "," << members.size() << ","
+             << refreshes_per_second << "," << mean << "," << stdev << ","
+             << max_staleness / 1000.0 << endl;
+    } else {
+        while(experiments::get_realtime_clock() - start < duration_ns) {
+            sst[local].counter = sst[local].counter + 1;
+        }
+    }
+    sst.sync_with_members();
+}
+
+/*
+ * Compares the reader thread of a Reads-mode SST that reads the table in
+ * rounds, waiting for the slowest read of each round, with one that keeps
+ * several refreshes of each row in flight and reposts a row as soon as a
+ * refresh of it completes.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the transport named by SST_TRANSPORT
+    transport_initialize(ip_addrs, node_rank);
+
+    vector<uint32_t> members(num_nodes);
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        members[i] = i;
+    }
+    ofstream fout;
+    if(node_rank == 0) {
+        fout.open("pipelined_reads.csv", ofstream::app);
+    }
+    for(unsigned int reads_in_flight : {0, 1, 2, 4}) {
+        run(node_rank, members, reads_in_flight, fout);
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../verbs.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+static const int ROW_SIZE = 64;
+static const int MAX_FANOUT = 64;
+static const int NUM_TRIALS = 10000;
+
+static long long int thread_cpu_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+/*
+ * The put() loop as it was before work request templates: one freshly built
+ * work request and one ibv_post_send per receiver.
+ */
+static void legacy_put(const vector<resources *> &targets, int fanout) {
+    for(int i = 0; i < fanout; ++i) {
+        resources *res = targets[i];
+        struct ibv_send_wr sr;
+        struct ibv_sge sge;
+        struct ibv_send_wr *bad_wr = NULL;
+        memset(&sge, 0, sizeof(sge));
+        sge.addr = (uintptr_t)res->read_buf;
+        sge.length = ROW_SIZE;
+        sge.lkey = res->read_mr->lkey;
+        memset(&sr, 0, sizeof(sr));
+        sr.sg_list = &sge;
+        sr.num_sge = 1;
+        sr.opcode = IBV_WR_RDMA_WRITE;
+        sr.send_flags = IBV_SEND_SIGNALED;
+        sr.wr.rdma.remote_addr = res->remote_props.addr;
+        sr.wr.rdma.rkey = res->remote_props.rkey;
+        ibv_post_send(res->qp, &sr, &bad_wr);
+    }
+}
+
+static void batched_put(const vector<connection *> &targets, int fanout) {
+    const long long int offset = 0;
+    verbs_post_remote_writes(targets.data(), fanout, offset, ROW_SIZE);
+}
+
+/*
+ * Measures the CPU time node 0 spends per put as the fan-out grows, for the
+ * legacy one-request-at-a-time loop and for the batched path used by
+ * SST::put(). Larger groups are simulated by opening several connections to
+ * each remote node, so 2 nodes are enough to reach a fan-out of 64.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the rdma resources
+    verbs_initialize(ip_addrs, node_rank);
+
+    // connect to every remote node, in descending order of rank as SST does
+    const int per_node = (MAX_FANOUT + num_nodes - 2) / (num_nodes - 1);
+    vector<char> local_row(ROW_SIZE), remote_rows(ROW_SIZE * per_node *
+                                                  num_nodes);
+    vector<unique_ptr<resources>> connections;
+    vector<resources *> targets;
+    for(int k = 0; k < per_node; ++k) {
+        for(int r = num_nodes - 1; r >= 0; --r) {
+            if((uint32_t)r == node_rank) {
+                continue;
+            }
+            char *write_addr =
+                remote_rows.data() + ROW_SIZE * (k * num_nodes + r);
+            connections.push_back(std::make_unique<resources>(
+                r, write_addr, local_row.data(), ROW_SIZE, ROW_SIZE));
+            targets.push_back(connections.back().get());
+        }
+    }
+
+    vector<connection *> batch_targets(targets.begin(), targets.end());
+
+    if(node_rank == 0) {
+        ofstream fout("put_fanout_cost.csv", ofstream::app);
+        for(int fanout = 1; fanout <= (int)targets.size(); fanout *= 2) {
+            double cost[2];
+            for(int batched = 0; batched < 2; ++batched) {
+                long long int post_time = 0;
+                for(int trial = 0; trial < NUM_TRIALS; ++trial) {
+                    long long int start = thread_cpu_time();
+                    if(batched) {
+                        batched_put(batch_targets, fanout);
+                    } else {
+                        legacy_put(targets, fanout);
+                    }
+                    post_time += thread_cpu_time() - start;
+                    for(int i = 0; i < fanout; ++i) {
+                        verbs_poll_completion();
+                    }
+                }
+                cost[batched] = (double)post_time / NUM_TRIALS;
+            }
+            cout << "fanout " << fanout << ": legacy " << cost[0]
+                 << " ns/put, batched " << cost[1] << " ns/put" << endl;
+            fout << fanout << "," << cost[0] << "," << cost[1] << endl;
+        }
+    }
+
+    for(uint32_t r = 0; r < num_nodes; ++r) {
+        if(r != node_rank) {
+            sync(r);
+        }
+    }
+    return 0;
+}
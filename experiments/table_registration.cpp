@@ -0,0 +1,101 @@
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../verbs.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+static const int ROW_SIZE = 64;
+static const int NUM_ROWS = 64;
+
+/*
+ * Measures the time to connect a table of NUM_ROWS rows and the number of
+ * memory regions it costs, with and without registering the table once up
+ * front as SST does. Without it, each connection registers its own buffers,
+ * as every connection did before tables were registered whole; giving each
+ * connection a separate local row keeps any of them from sharing. Larger
+ * groups are simulated by opening several connections to each remote node,
+ * so 2 nodes are enough to reach any number of rows.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the rdma resources
+    verbs_initialize(ip_addrs, node_rank);
+
+    const int per_node = (NUM_ROWS + num_nodes - 3) / (num_nodes - 1);
+    ofstream fout;
+    if(node_rank == 0) {
+        fout.open("table_registration.csv", ofstream::app);
+    }
+    for(int shared = 0; shared < 2; ++shared) {
+        vector<char> table(ROW_SIZE * per_node * num_nodes);
+        vector<vector<char>> local_rows;
+        if(shared) {
+            verbs_register_memory(table.data(), table.size());
+        }
+
+        long long int start_time = experiments::get_realtime_clock();
+        vector<unique_ptr<resources>> connections;
+        for(int k = 0; k < per_node; ++k) {
+            for(int r = num_nodes - 1; r >= 0; --r) {
+                if((uint32_t)r == node_rank) {
+                    continue;
+                }
+                char *write_addr =
+                    table.data() + ROW_SIZE * (k * num_nodes + r);
+                char *read_addr = table.data() + ROW_SIZE * node_rank;
+                if(!shared) {
+                    local_rows.emplace_back(ROW_SIZE);
+                    read_addr = local_rows.back().data();
+                }
+                connections.push_back(std::make_unique<resources>(
+                    r, write_addr, read_addr, ROW_SIZE, ROW_SIZE));
+            }
+        }
+        long long int end_time = experiments::get_realtime_clock();
+
+        double setup_ms = (end_time - start_time) / 1000000.0;
+        std::size_t num_regions = verbs_num_memory_regions();
+        if(node_rank == 0) {
+            cout << (shared ? "shared" : "per-connection") << " registration: "
+                 << connections.size() + 1 << " rows connected in "
+                 << setup_ms << " ms using " << num_regions
+                 << " memory regions" << endl;
+            fout << shared << "," << connections.size() + 1 << "," << setup_ms
+                 << "," << num_regions << endl;
+        }
+
+        for(uint32_t r = 0; r < num_nodes; ++r) {
+            if(r != node_rank) {
+                sync(r);
+            }
+        }
+        connections.clear();
+        if(shared) {
+            verbs_deregister_memory(table.data());
+        }
+    }
+    return 0;
+}
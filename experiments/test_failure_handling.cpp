@@ -6,7 +6,6 @@
 #include <chrono>
 
 #include "../sst.h"
-#include "../tcp.h"
 //Since all SST instances are named sst, we can use this convenient hack
 #define LOCAL sst.get_local_index()
 
@@ -29,11 +28,8 @@ int main () {
     cin >> ip_addrs[i];
   }
   
-  // initialize tcp connections
-  sst::tcp::tcp_initialize(node_rank, ip_addrs);
-  
-  // initialize the rdma resources
-  verbs_initialize();
+  // initialize the transport named by SST_TRANSPORT
+  transport_initialize(ip_addrs, node_rank);
   
   // form a group with a subset of all the nodes
   vector <uint32_t> members (num_nodes);
@@ -41,21 +37,13 @@ int main () {
     members[i] = i;
   }
 
-  // create a new shared state table with all the members
-  SST<TestRow, Mode::Writes> *sst = new SST<TestRow, Mode::Writes> (members, node_rank, [] (uint32_t failed_node_rank) {std::cout << "Node " << failed_node_rank << " failed" << endl;});
-
-  // the predicate - as simple as it can be
-  auto f = [] (const SST<TestRow, Mode::Writes> & sst) {
-    return true;
-  };
+  // heartbeats detect failures without any puts from the application
+  SST_Options options;
+  options.heartbeats.interval_ms = 10;
+  options.heartbeats.timeout_ms = 100;
 
-  // the trigger - calls put - required to detect failures
-  auto g = [] (SST<TestRow, Mode::Writes> & sst) {
-    sst.put();
-  };
-
-  // insert the predicate and trigger
-  sst->predicates.insert (f, g, PredicateType::RECURRENT);
+  // create a new shared state table with all the members
+  SST<TestRow, Mode::Writes> *sst = new SST<TestRow, Mode::Writes> (members, node_rank, [] (uint32_t failed_node_rank) {std::cout << "Node " << failed_node_rank << " failed" << endl;}, {}, true, options);
   
   // exit after node_rank+1 seconds
   std::this_thread::sleep_for(std::chrono::seconds(10*(node_rank+1)));
@@ -0,0 +1,114 @@
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../sst.h"
+#include "statistics.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+struct PingRow {
+    volatile uint64_t seq;
+    char payload[1024];
+};
+
+static const int NUM_PINGS = 10000;
+static const int NUM_PUTS = 100000;
+
+static const char *transport_name(Transport type) {
+    switch(type) {
+        case Transport::SharedMemory:
+            return "shm";
+        case Transport::TCP:
+            return "tcp";
+        default:
+            return "rdma";
+    }
+}
+
+/*
+ * Measures put latency (as half of a ping-pong between nodes 0 and 1) and
+ * back-to-back put throughput from node 0, over the transport selected by the
+ * SST_TRANSPORT environment variable. Run it once per transport to compare
+ * them on the same hardware.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the transport named by SST_TRANSPORT
+    transport_initialize(ip_addrs, node_rank);
+
+    vector<uint32_t> members(num_nodes);
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        members[i] = i;
+    }
+    SST<PingRow> sst(members, node_rank);
+    const uint32_t local = sst.get_local_index();
+    sst[local].seq = 0;
+    sst.put();
+    sst.sync_with_members();
+
+    // ping-pong: node 0 bumps its seq, node 1 echoes it back
+    vector<long long int> start_times(NUM_PINGS), end_times(NUM_PINGS);
+    const long long int seq_offset = offsetof(PingRow, seq);
+    for(int i = 1; i <= NUM_PINGS; ++i) {
+        if(node_rank == 0) {
+            start_times[i - 1] = experiments::get_realtime_clock();
+            sst[local].seq = i;
+            sst.put({1}, seq_offset, sizeof(uint64_t));
+            while(sst[1].seq != (uint64_t)i) {
+            }
+            end_times[i - 1] = experiments::get_realtime_clock();
+        } else if(node_rank == 1) {
+            while(sst[0].seq != (uint64_t)i) {
+            }
+            sst[local].seq = i;
+            sst.put({0}, seq_offset, sizeof(uint64_t));
+        }
+    }
+    sst.sync_with_members();
+
+    // throughput: node 0 puts its whole row to everyone back to back
+    long long int throughput_start = experiments::get_realtime_clock();
+    if(node_rank == 0) {
+        for(int i = 0; i < NUM_PUTS; ++i) {
+            sst.put();
+        }
+    }
+    long long int throughput_end = experiments::get_realtime_clock();
+    sst.sync_with_members();
+
+    if(node_rank == 0) {
+        double mean, stdev;
+        std::tie(mean, stdev) =
+            experiments::compute_statistics(start_times, end_times, 2);
+        double puts_per_sec =
+            NUM_PUTS * 1e9 / (throughput_end - throughput_start);
+        cout << transport_name(get_transport())
+             << ": one-way latency (us) mean " << mean << " stdev " << stdev
+             << ", " << puts_per_sec << " puts/s" << endl;
+        ofstream fout("transport_baseline.csv", ofstream::app);
+        fout << transport_name(get_transport()) << "," << num_nodes << ","
+             << mean << "," << stdev << "," << puts_per_sec << endl;
+    }
+    return 0;
+}
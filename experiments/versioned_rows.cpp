@@ -0,0 +1,116 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../sst.h"
+#include "statistics.h"
+#include "timing.h"
+
+using namespace sst;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+static const int NUM_TRIALS = 1000;
+
+/** A row of `Width` counters, all of which each trial changes. */
+template <int Width>
+struct WideRow {
+    volatile int64_t data[Width];
+};
+
+/*
+ * Runs the trials for one row width, with or without versioned rows: node 0
+ * changes every field of its row and puts it, then takes a snapshot of the
+ * table. Reports the mean latency of the change and put, and of the
+ * snapshot.
+ */
+template <int Width>
+static void run(uint32_t node_rank, const vector<uint32_t> &members,
+                bool versioned, ofstream &fout) {
+    typedef SST<WideRow<Width>> wide_sst;
+    SST_Options options;
+    options.versioned_rows = versioned;
+    wide_sst sst(members, node_rank, nullptr, {}, true, options);
+    sst.put();
+    sst.sync_with_members();
+
+    if(node_rank == 0) {
+        vector<long long int> start_times(NUM_TRIALS), end_times(NUM_TRIALS);
+        for(int i = 0; i < NUM_TRIALS; ++i) {
+            start_times[i] = experiments::get_realtime_clock();
+            sst.update([i](volatile WideRow<Width> &row) {
+                for(int j = 0; j < Width; ++j) {
+                    row.data[j] = i;
+                }
+            });
+            sst.put();
+            end_times[i] = experiments::get_realtime_clock();
+        }
+        double put_mean, put_stdev;
+        std::tie(put_mean, put_stdev) =
+            experiments::compute_statistics(start_times, end_times);
+        for(int i = 0; i < NUM_TRIALS; ++i) {
+            start_times[i] = experiments::get_realtime_clock();
+            auto snapshot = sst.get_snapshot();
+            end_times[i] = experiments::get_realtime_clock();
+        }
+        double snapshot_mean, snapshot_stdev;
+        std::tie(snapshot_mean, snapshot_stdev) =
+            experiments::compute_statistics(start_times, end_times);
+        const string method = versioned ? "versioned" : "plain";
+        cout << sizeof(WideRow<Width>) << "-byte row, " << method
+             << ": update and put latency (us) mean " << put_mean << " stdev "
+             << put_stdev << ", snapshot latency (us) mean " << snapshot_mean
+             << " stdev " << snapshot_stdev << endl;
+        fout << sizeof(WideRow<Width>) << "," << method << ","
+             << members.size() << "," << put_mean << "," << put_stdev << ","
+             << snapshot_mean << "," << snapshot_stdev << endl;
+    }
+    sst.sync_with_members();
+}
+
+/*
+ * Measures what versioned rows cost as rows grow: the versions add two
+ * writes to every put and a check around the copy of every row in a
+ * snapshot, against rows that readers may see half written.
+ */
+int main() {
+    // input the local node id and number of nodes
+    uint32_t node_rank, num_nodes;
+    cin >> node_rank >> num_nodes;
+
+    // input the ip addresses
+    map<uint32_t, string> ip_addrs;
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        cin >> ip_addrs[i];
+    }
+
+    // initialize the transport named by SST_TRANSPORT
+    transport_initialize(ip_addrs, node_rank);
+
+    vector<uint32_t> members(num_nodes);
+    for(uint32_t i = 0; i < num_nodes; ++i) {
+        members[i] = i;
+    }
+    ofstream fout;
+    if(node_rank == 0) {
+        fout.open("versioned_rows.csv", ofstream::app);
+    }
+    for(bool versioned : {false, true}) {
+        run<1>(node_rank, members, versioned, fout);
+        run<8>(node_rank, members, versioned, fout);
+        run<64>(node_rank, members, versioned, fout);
+        run<512>(node_rank, members, versioned, fout);
+        run<4096>(node_rank, members, versioned, fout);
+    }
+    return 0;
+}
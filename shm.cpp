@@ -0,0 +1,369 @@
+/**
+ * @file shm.cpp
+ * Contains the implementation of the shared memory adapter layer of %SST.
+ */
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm.h"
+#include "../connection_manager.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::map;
+using std::string;
+
+namespace sst {
+
+/** A shared memory segment that backs a local table. */
+struct shm_segment {
+    /** Name the segment was created under. */
+    string name;
+    /** Size of the segment, in bytes. */
+    std::size_t size;
+};
+
+/** Local segments, keyed by their base address. */
+static map<char *, shm_segment> local_segments;
+/** Protects `local_segments` and `segment_counter`. */
+static std::mutex segments_mutex;
+/** Used to give each segment created by this process a unique name. */
+static uint32_t segment_counter = 0;
+/** Used to give each connection a unique id. */
+static std::atomic<uint32_t> connection_counter{0};
+
+/**
+ * Completions of operations, keyed by the owner part of their tags, so that
+ * any thread may poll for the completions of an owner, not only the thread
+ * that posted them.
+ */
+static std::unordered_map<uint32_t, std::deque<completion>> completions;
+/** Protects `completions`. */
+static std::mutex completions_mutex;
+
+/** Records the completion of an operation for its owner's next poll. */
+static void complete(uint64_t tag, int result) {
+    std::lock_guard<std::mutex> lock(completions_mutex);
+    completions[tag_owner(tag)].push_back({tag, result});
+}
+
+/**
+ * Finds the local segment containing an address.
+ *
+ * @param addr An address inside a table returned by shm_allocate().
+ * @return An iterator to the segment, or `local_segments.end()`.
+ */
+static map<char *, shm_segment>::iterator find_segment(char *addr) {
+    auto it = local_segments.upper_bound(addr);
+    if(it == local_segments.begin()) {
+        return local_segments.end();
+    }
+    --it;
+    if(addr >= it->first + it->second.size) {
+        return local_segments.end();
+    }
+    return it;
+}
+
+/**
+ * Exchanges the segment name and offset of `write_addr` with the remote node
+ * and maps the remote node's segment. Both `write_addr` and `read_addr` must
+ * lie in a table returned by shm_allocate().
+ *
+ * @param r_index The node rank of the remote node to connect to.
+ * @param write_addr A pointer to the memory the remote node will write into
+ * and read from.
+ * @param read_addr A pointer to the memory that local writes are copied from
+ * and remote reads are copied into.
+ * @param size_w The size of the write buffer (in bytes).
+ * @param size_r The size of the read buffer (in bytes).
+ */
+shm_resources::shm_resources(int r_index, char *write_addr, char *read_addr,
+                             int size_w, int size_r)
+    : id(connection_counter++),
+      write_buf(write_addr),
+      read_buf(read_addr),
+      remote_base(nullptr),
+      remote_size(0),
+      remote_buf(nullptr) {
+    remote_index = r_index;
+    connect_segment();
+    cout << "Established shared memory connection with node " << r_index
+         << endl;
+}
+
+shm_resources::~shm_resources() {
+    if(remote_base) {
+        munmap(remote_base, remote_size);
+    }
+}
+
+void shm_resources::connect_segment() {
+    struct shm_con_data_t local_con_data;
+    struct shm_con_data_t remote_con_data;
+    memset(&local_con_data, 0, sizeof(local_con_data));
+    {
+        std::lock_guard<std::mutex> lock(segments_mutex);
+        auto it = find_segment(write_buf);
+        if(it == local_segments.end()) {
+            cerr << "Write address is not in a shared memory segment" << endl;
+            return;
+        }
+        strncpy(local_con_data.segment_name, it->second.name.c_str(),
+                sizeof(local_con_data.segment_name) - 1);
+        local_con_data.segment_size = it->second.size;
+        local_con_data.offset = write_buf - it->first;
+    }
+    // both ends are on the same host, so no byte order conversion is needed
+    bool success = sst_connections->exchange(remote_index, local_con_data,
+                                             remote_con_data);
+    if(!success) {
+        cerr << "Could not exchange segment data in connect_segment" << endl;
+        return;
+    }
+
+    int fd = shm_open(remote_con_data.segment_name, O_RDWR, 0);
+    if(fd < 0) {
+        cerr << "Could not open shared memory segment "
+             << remote_con_data.segment_name << ", error code is " << errno
+             << endl;
+        return;
+    }
+    void *base = mmap(NULL, remote_con_data.segment_size,
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        cerr << "Could not map shared memory segment, error code is " << errno
+             << endl;
+        return;
+    }
+    remote_base = (char *)base;
+    remote_size = remote_con_data.segment_size;
+    remote_buf = remote_base + remote_con_data.offset;
+
+    // the remote node may unlink its segment once it has been mapped here
+    success = sync(remote_index);
+    if(!success) {
+        cerr << "Could not sync in connect_segment" << endl;
+    }
+}
+
+/**
+ * @param offset The offset, in bytes, of the remote buffer at which to start
+ * reading.
+ * @param size The number of bytes to read.
+ */
+void shm_resources::post_remote_read(long long int offset,
+                                     long long int size) {
+    if(!remote_buf) {
+        complete(tag, -1);
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    memcpy(read_buf + offset, remote_buf + offset, size);
+    complete(tag, 1);
+}
+
+/**
+ * @param offset The offset, in bytes, of the remote buffer at which to start
+ * writing.
+ * @param size The number of bytes to write.
+ */
+void shm_resources::post_remote_write(long long int offset,
+                                      long long int size) {
+    if(!remote_buf) {
+        complete(tag, -1);
+        return;
+    }
+    memcpy(remote_buf + offset, read_buf + offset, size);
+    std::atomic_thread_fence(std::memory_order_release);
+    complete(tag, 1);
+}
+
+/**
+ * Shared memory cannot notify the remote node, so `imm` is ignored.
+ *
+ * @param ranges The ranges of the remote buffer to write, in order.
+ * @param num_ranges The number of ranges in `ranges`.
+ * @param imm Ignored.
+ */
+void shm_resources::post_remote_write_ranges(const byte_range *ranges,
+                                             std::size_t num_ranges,
+                                             const uint32_t *imm) {
+    if(!remote_buf) {
+        complete(tag, -1);
+        return;
+    }
+    // each range lands before the next, as over RDMA
+    for(std::size_t i = 0; i < num_ranges; ++i) {
+        memcpy(remote_buf + ranges[i].offset, read_buf + ranges[i].offset,
+               ranges[i].size);
+        std::atomic_thread_fence(std::memory_order_acq_rel);
+    }
+    complete(tag, 1);
+}
+
+/**
+ * @details
+ * The whole remote segment is mapped, so the target may lie outside the
+ * remote buffer, in another row of the remote table.
+ *
+ * @param offset The offset, in bytes, of the remote buffer at which the
+ * 8-byte target lies.
+ * @param op The operation to perform.
+ * @param compare_add The value to add, or the value to compare with.
+ * @param swap The value to store if the comparison succeeds.
+ * @param atomic_tag The tag to report the completion with.
+ * @return False if the target is not 8-byte aligned.
+ */
+bool shm_resources::post_remote_atomic(long long int offset, atomic_op op,
+                                       uint64_t compare_add, uint64_t swap,
+                                       uint64_t atomic_tag) {
+    if(!remote_buf) {
+        complete(atomic_tag, -1);
+        return true;
+    }
+    char *target = remote_buf + offset;
+    if((uintptr_t)target % sizeof(uint64_t) != 0) {
+        return false;
+    }
+    if(target < remote_base ||
+       target + sizeof(uint64_t) > remote_base + remote_size) {
+        complete(atomic_tag, -1);
+        return true;
+    }
+    uint64_t *word = reinterpret_cast<uint64_t *>(target);
+    if(op == atomic_op::fetch_add) {
+        atomic_result = __atomic_fetch_add(word, compare_add, __ATOMIC_SEQ_CST);
+    } else {
+        uint64_t expected = compare_add;
+        __atomic_compare_exchange_n(word, &expected, swap, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        atomic_result = expected;
+    }
+    complete(atomic_tag, 1);
+    return true;
+}
+
+/**
+ * @details
+ * Operations on shared memory finish before they are posted, so this never
+ * blocks.
+ * @param owner The owner part of the tags of the connections to poll.
+ * @param entries The array to store the completions in.
+ * @param max_entries The maximum number of completions to return.
+ * @param block Whether the caller expected a completion to be pending.
+ * @return The number of completions stored in `entries`, or 0 if none was
+ * pending.
+ */
+int shm_poll_completions(uint32_t owner, completion *entries, int max_entries,
+                         bool block) {
+    int num_polled = 0;
+    {
+        std::lock_guard<std::mutex> lock(completions_mutex);
+        auto owner_completions = completions.find(owner);
+        if(owner_completions != completions.end()) {
+            num_polled = take_completions(owner_completions->second, owner,
+                                          entries, max_entries);
+            if(owner_completions->second.empty()) {
+                completions.erase(owner_completions);
+            }
+        }
+    }
+    if(num_polled == 0 && block) {
+        cerr << "No shared memory operation is pending" << endl;
+    }
+    return num_polled;
+}
+
+/**
+ * @details
+ * The segment is named after this process, so that tables of different SST
+ * instances do not collide. It stays linked until shm_free() is called, so
+ * that remote nodes can map it while connecting.
+ *
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the zeroed memory, or NULL on failure.
+ */
+void *shm_allocate(std::size_t size) {
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    string name = "/sst_" + std::to_string(getpid()) + "_" +
+                  std::to_string(segment_counter++);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0) {
+        cerr << "Could not create shared memory segment " << name
+             << ", error code is " << errno << endl;
+        return NULL;
+    }
+    if(ftruncate(fd, size) != 0) {
+        cerr << "Could not size shared memory segment " << name
+             << ", error code is " << errno << endl;
+        close(fd);
+        shm_unlink(name.c_str());
+        return NULL;
+    }
+    void *base =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        cerr << "Could not map shared memory segment " << name
+             << ", error code is " << errno << endl;
+        shm_unlink(name.c_str());
+        return NULL;
+    }
+    local_segments[(char *)base] = {name, size};
+    return base;
+}
+
+/**
+ * @param addr A pointer returned by shm_allocate().
+ */
+void shm_free(void *addr) {
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    auto it = local_segments.find((char *)addr);
+    if(it == local_segments.end()) {
+        return;
+    }
+    munmap(it->first, it->second.size);
+    shm_unlink(it->second.name.c_str());
+    local_segments.erase(it);
+}
+
+/**
+ * @details
+ * This must be called before creating or using any SST instance that
+ * connects over shared memory. Every node in `ip_addrs` must run on this
+ * host.
+ */
+void shm_initialize(const map<uint32_t, string> &ip_addrs,
+                    uint32_t node_rank) {
+    connections_initialize(ip_addrs, node_rank, Transport::SharedMemory);
+    cout << "Initialized shared memory transport" << endl;
+}
+
+/**
+ * @details
+ * Unlinks any segments that are still allocated, so they do not outlive the
+ * process.
+ */
+void shm_destroy() {
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    for(auto &segment : local_segments) {
+        munmap(segment.first, segment.second.size);
+        shm_unlink(segment.second.name.c_str());
+    }
+    local_segments.clear();
+}
+
+}  // namespace sst
@@ -0,0 +1,87 @@
+#ifndef SHM_H
+#define SHM_H
+
+/**
+ * @file shm.h
+ * Contains declarations needed for connecting %SST members that run on the
+ * same host through POSIX shared memory.
+ */
+
+#include <map>
+#include <string>
+
+#include "transport.h"
+
+namespace sst {
+
+/** Structure to exchange the data needed to map a remote table. */
+struct shm_con_data_t {
+    /** Name of the shared memory segment holding the buffer. */
+    char segment_name[64];
+    /** Size of the segment, in bytes. */
+    uint64_t segment_size;
+    /** Offset of the buffer within the segment. */
+    uint64_t offset;
+} __attribute__((packed));
+
+/**
+ * Represents a connection to a remote node on the same host. The remote
+ * node's table is mapped into this process, so writes and reads are plain
+ * memory copies that complete as soon as they are posted.
+ */
+class shm_resources : public connection {
+private:
+    /** Maps the remote node's segment and fills in `remote_buf`. */
+    void connect_segment();
+
+public:
+    /** Process-unique id of this connection. */
+    uint32_t id;
+    /** Pointer to the memory buffer used for local writes. */
+    char *write_buf;
+    /** Pointer to the memory buffer used for the results of remote reads. */
+    char *read_buf;
+    /** Base of the remote node's segment, as mapped into this process. */
+    char *remote_base;
+    /** Size of the mapping at `remote_base`. */
+    std::size_t remote_size;
+    /** The remote node's buffer, as mapped into this process. */
+    char *remote_buf;
+
+    /** Constructor; maps the remote node's table. */
+    shm_resources(int r_index, char *write_addr, char *read_addr, int size_w,
+                  int size_r);
+    /** Unmaps the remote node's table. */
+    virtual ~shm_resources();
+    uint32_t get_id() const { return id; }
+    /** Copies from the remote buffer into the local read buffer. */
+    void post_remote_read(long long int offset, long long int size);
+    /** Copies from the local read buffer into the remote buffer. */
+    void post_remote_write(long long int offset, long long int size);
+    /** Copies several ranges from the local read buffer into the remote
+     * buffer. */
+    void post_remote_write_ranges(const byte_range *ranges,
+                                  std::size_t num_ranges,
+                                  const uint32_t *imm);
+    /** Applies an atomic operation to the remote buffer. */
+    bool post_remote_atomic(long long int offset, atomic_op op,
+                            uint64_t compare_add, uint64_t swap,
+                            uint64_t atomic_tag);
+};
+
+/** Initializes the shared memory transport. */
+void shm_initialize(const std::map<uint32_t, std::string> &ip_addrs,
+                    uint32_t node_rank);
+/** Returns the completions of the operations of an owner. */
+int shm_poll_completions(uint32_t owner, completion *entries,
+                         int max_entries, bool block = true);
+/** Allocates a table in a new shared memory segment. */
+void *shm_allocate(std::size_t size);
+/** Unmaps and unlinks a segment returned by shm_allocate(). */
+void shm_free(void *addr);
+/** Destroys the shared memory transport. */
+void shm_destroy();
+
+}  // namespace sst
+
+#endif  // SHM_H
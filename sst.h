@@ -6,16 +6,21 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <limits>
 
 #include "util.h"
+#include "transport.h"
 #include "verbs.h"
 #include "NamedRowPredicates.h"
 #include "combinators.h"
@@ -52,6 +57,131 @@ enum class Mode {
 
 typedef function<void(uint32_t)> failure_upcall_t;
 
+/** Stands for the node rank of a row that has no member, in the members
+ * passed to the SST constructor and those returned by SST::get_members(). */
+const uint32_t VACANT_MEMBER = std::numeric_limits<uint32_t>::max();
+
+/** The most ranges that a put of several ranges writes separately; beyond
+ * this, the closest ranges are written as one along with the gap between
+ * them. */
+const std::size_t MAX_PUT_RANGES = 8;
+
+/** How many times a reader of versioned rows reads a row again after a
+ * change overlapped its read, before it gives up on the row for now. */
+const int MAX_VERSION_RETRIES = 16;
+
+/** The most copies of the table that an SST keeps for later snapshots to
+ * reuse once no snapshot refers to them. */
+const std::size_t MAX_POOLED_SNAPSHOTS = 4;
+
+/**
+ * How members watch each other for failures. Each member bumps a counter in
+ * its row every `interval_ms` and, in Writes mode, puts it; a member whose
+ * counter stays the same for `timeout_ms` is presumed failed and its row is
+ * frozen. This catches a member that has crashed or stalled without waiting
+ * for one of its operations to time out, and even when none is posted. By
+ * default there are no heartbeats, and failures are only found through
+ * operations that fail or time out after COMPLETION_TIMEOUT_MS.
+ */
+struct heartbeat_policy {
+    /** Milliseconds between heartbeats; 0 disables them. */
+    int interval_ms = 0;
+    /** Milliseconds without a heartbeat after which a member is presumed
+     * failed. It should span several intervals, so that a late heartbeat
+     * is not taken for a failure; detection takes up to one interval
+     * longer. */
+    int timeout_ms = 1000;
+};
+
+/**
+ * How the reader thread of a Reads-mode SST refreshes a remote row. A row
+ * can be read in part, at a fixed rate, and less and less often while it
+ * does not change: after a refresh that finds nothing new in the ranges
+ * read, the interval doubles, from at least 1 microsecond up to
+ * `max_interval_us`, and any change sets it back to `interval_us`. By
+ * default a row is read whole on every pass, as often as the reader thread
+ * can. With heartbeats, every row is also read at least once per heartbeat
+ * interval, along with its heartbeat counter.
+ */
+struct refresh_plan {
+    /** The ranges of the row to read; if empty, the whole row is read. */
+    std::vector<byte_range> ranges;
+    /** Microseconds between refreshes of the row; 0 for every pass. */
+    int interval_us = 0;
+    /** The longest interval that a row that does not change backs off to;
+     * backoff is disabled unless this is more than `interval_us`. */
+    int max_interval_us = 0;
+};
+
+/**
+ * Tuning options for a single SST instance. A default-constructed
+ * SST_Options gives the same behavior as constructing the SST without one.
+ */
+struct SST_Options {
+    /** Which of the writes posted by put() generate completions; put() only
+     * waits for those. Signaling fewer writes cuts completion queue traffic,
+     * at the cost of put() returning before the unsignaled writes are known
+     * to have landed. */
+    signal_policy put_signaling;
+    /** The most puts that may have writes outstanding to any one row. A put
+     * to a row that has run out waits for earlier writes to complete. Over
+     * RDMA this is capped by the send queue depth. */
+    unsigned int max_outstanding_puts = 16;
+    /** How the detect and reader threads, and callers waiting for
+     * completions, wait when there is nothing to do. */
+    wait_policy idle_wait;
+    /** Where the table and its snapshots are placed in memory. */
+    memory_policy table_memory;
+    /** Where the reader thread of a Reads-mode SST runs. */
+    thread_placement reader_thread;
+    /** How the reader thread of a Reads-mode SST refreshes the rows that
+     * have no plan of their own; see SST::set_refresh_plan(). */
+    refresh_plan refresh;
+    /** How many refreshes of each row the reader thread of a Reads-mode SST
+     * keeps in flight. With 0, it reads the rows that are due in rounds,
+     * and waits for every read of a round before it starts the next; with
+     * more, it reposts each row as soon as a refresh of it completes, so a
+     * slow member only holds up its own row. Over RDMA, the reads in flight
+     * to a row are capped by the send queue depth. */
+    unsigned int reads_in_flight = 0;
+    /** Where the predicate detection thread runs. */
+    thread_placement detector_thread;
+    /** Whether, over RDMA, to share one queue pair per remote node with the
+     * other SSTs that share theirs, instead of giving this SST its own. This
+     * saves queue pairs when many SSTs span the same nodes; their
+     * completions then go through one completion queue. */
+    bool share_connections = false;
+    /** The number of rows to allocate, so that members can later join
+     * with SST::add_member() without rebuilding the SST. If it is less than
+     * the number of members the SST is constructed with, there is no spare
+     * room. Every member must use the same value. */
+    unsigned int max_members = 0;
+    /** Whether, in Writes mode, each put also notifies its receivers of the
+     * row and range it changed, which SST::row_changed() reports to
+     * predicates. With an idle_wait policy that sleeps, a notification also
+     * wakes the detect thread over RDMA. Notifications are sent as RDMA
+     * writes with immediate and need connections of their own, so they are
+     * not used with share_connections, nor over shared memory. Every member
+     * must use the same value. */
+    bool change_notifications = false;
+    /** Whether and how quickly members detect each other's failures with
+     * heartbeats. Every member must use the same interval. */
+    heartbeat_policy heartbeats;
+    /** Where the heartbeat thread runs, if heartbeats are enabled. */
+    thread_placement heartbeat_thread;
+    /** Whether put() and put_async() without arguments write only the parts
+     * of the local row marked with SST::set() or SST::mark_dirty() since
+     * the last such put, instead of the whole row. Writes through
+     * operator[] are then only sent once they are marked. */
+    bool track_dirty_ranges = false;
+    /** Whether each row carries a pair of versions, which SST::update()
+     * bumps around every change to the local row, so that predicates and
+     * snapshots only see rows that no change was landing in, without
+     * taking locks. Changes made through operator[] are not covered, and
+     * snapshots may miss them. Every member must use the same value. */
+    bool versioned_rows = false;
+};
+
 /**
  * The SST object, representing a single shared state table.
  *
@@ -81,9 +211,23 @@ class SST {
     // row!");
 
 public:
+    /** A row as it lies in the table. The fields after those of Row and of
+     * the named row predicates are always there, so that every SST of a Row
+     * type has the same layout whatever its options, but puts and reads of
+     * the whole row leave out the ones that its options do not use. */
     struct InternalRow : public Row,
                          public util::extend_tuple_members<
-                             typename NamedRowPredicatesTypePack::row_types> {};
+                             typename NamedRowPredicatesTypePack::row_types> {
+        /** Counts the heartbeats of the row's member; see
+         * heartbeat_policy. */
+        uint64_t sst_heartbeat;
+        /** Set to a new version before a change to the row, with the
+         * versioned_rows option. */
+        uint64_t sst_version_begin;
+        /** Set to the same version as `sst_version_begin` once the change
+         * is done. */
+        uint64_t sst_version_end;
+    };
 
 private:
     using named_functions_t =
@@ -103,26 +247,37 @@ public:
      * An object containing a read-only snapshot of an SST. It can be used
      * like an SST for reading row values and the states of named functions,
      * but it is disconnected from the actual SST and will not get updated.
+     * Snapshots, and their copies, may share their rows, which never change
+     * while any of them refers to them.
      */
     class SST_Snapshot {
     private:
         /** Number of members, which is the number of rows in `table`. */
         int num_members;
         /** The structure containing shared state data. */
-        unique_ptr<const InternalRow[]> table;
+        std::shared_ptr<const InternalRow> table;
+
+        friend class SST;
+        /** Creates a view of rows copied by SST::get_snapshot(). */
+        SST_Snapshot(std::shared_ptr<const InternalRow> rows,
+                     int _num_members);
 
     public:
         /** Creates an SST snapshot given the current state internals of the
          * SST. */
-        SST_Snapshot(const unique_ptr<volatile InternalRow[]> &_table,
-                     int _num_members);
-        /** Copy constructor. */
+        SST_Snapshot(
+            const unique_ptr<volatile InternalRow[], table_deleter> &_table,
+            int _num_members, const memory_policy &_policy = memory_policy(),
+            bool versioned = false, int local_index = -1);
+        /** Copy constructor; the copy shares the rows. */
         SST_Snapshot(const SST_Snapshot &to_copy);
 
         /** Accesses a row of the snapshot. */
         const InternalRow &get(int index) const;
         /** Accesses a row of the snapshot using the [] operator. */
         const InternalRow &operator[](int index) const;
+        /** Checks whether a row was copied with no change landing in it. */
+        bool is_consistent(int index) const;
     };
 
 private:
@@ -130,16 +285,69 @@ private:
     vector<uint32_t> members;
     /** List of node ranks mapped to member index. */
     map<uint32_t, int, std::greater<uint32_t>> members_by_rank;
-    /** Number of members; equal to `members.size()`. */
+    /** Number of rows in use, including vacant rows below the last member. */
     unsigned int num_members;
+    /** Number of rows allocated, which bounds `num_members`; equal to
+     * `members.size()`. */
+    const unsigned int capacity;
+    /** The indices of all the rows, which put() writes to by default. */
+    vector<uint32_t> all_indices;
+    /** The options this SST was constructed with. */
+    const SST_Options options;
     /** Index of this node in the table. */
     unsigned int member_index;
-    /** The actual structure containing shared state data. */
-    unique_ptr<volatile InternalRow[]> table;
-    /** Map of queue pair number to row. Useful for detecting failures. */
-    std::map<int, int> qp_num_to_index;
+    /** The actual structure containing shared state data, allocated by the
+     * transport in use. */
+    unique_ptr<volatile InternalRow[], table_deleter> table;
+    /** Process-unique id of this SST. Each connection is tagged with it and
+     * the index of its row, so every completion names the row it came from.
+     * Useful for detecting failures. */
+    const uint32_t instance_id;
+    /** Tag owner of this SST's atomic operations, so that their completions
+     * are never taken for those of puts or reads. */
+    const uint32_t atomic_owner;
+    /** Tag owner of the notifications this SST receives. */
+    const uint32_t notify_owner;
+    /** Whether puts notify their receivers, and the detect thread takes the
+     * notifications sent to this node. */
+    bool notifications_enabled{false};
+    /** For each row, the range of bytes, as [first, last), that
+     * notifications reported changed since the detect thread's last pass. */
+    vector<pair<uint32_t, uint32_t>> changed_ranges;
+    /** The rows with a non-empty range in `changed_ranges`. */
+    vector<uint32_t> changed_rows;
     /** A parallel array tracking whether the row has been marked frozen. */
     std::vector<bool> row_is_frozen;
+    /** A parallel array tracking whether the row has no member, because it
+     * is spare or its member left; vacant rows are also frozen. */
+    std::vector<bool> row_is_vacant;
+    /** Incremented on each change of membership. */
+    std::atomic<uint64_t> membership_epoch{0};
+    /** Held by the reader thread while it refreshes the table, and while the
+     * membership changes. */
+    std::mutex membership_mutex;
+    /** Set while a change of membership, or of a refresh plan, waits for
+     * `membership_mutex`, so that the reader thread lets it in between
+     * refreshes. */
+    std::atomic<bool> membership_change_pending{false};
+    /** How the reader thread refreshes each row in Reads mode. */
+    vector<refresh_plan> refresh_plans;
+    /** When the reader thread is next to refresh a row, and how long it
+     * waits after that. */
+    struct refresh_state {
+        std::chrono::steady_clock::time_point next_refresh;
+        int interval_us = 0;
+    };
+    /** The refresh state of each row in Reads mode. */
+    vector<refresh_state> refresh_states;
+    /** For each row, when the latest refresh of it that completed was
+     * posted, as a count of steady_clock ticks. */
+    vector<std::atomic<std::chrono::steady_clock::rep>> refresh_times;
+    /** The remote rows as of their previous refresh, to tell whether they
+     * changed; only kept in Reads mode. */
+    vector<char> refreshed_rows;
+    /** The bytes read from remote rows by the reader thread so far. */
+    std::atomic<uint64_t> read_bytes{0};
     /** The number of rows that have been frozen. */
     int num_frozen{0};
     /** The function to call when a remote node appears to have failed. */
@@ -149,11 +357,17 @@ private:
     const std::vector<row_predicate_updater_t>
         row_predicate_updater_functions;  // should be of size
     // NamedPredicatesTypePack::num_updater_functions:::value
-    /** RDMA resources vector, one for each member. */
-    vector<unique_ptr<resources>> res_vec;
+    /** The completion queue of this SST's connections, so that SSTs do not
+     * contend for or drain each other's completions, unless they share
+     * connections. It must outlive `res_vec`. */
+    std::shared_ptr<completion_queue> cq;
+    /** Transport connections vector, one for each member. */
+    vector<unique_ptr<connection>> res_vec;
     /** Holds references to background threads, so that we can shut them down
      * during destruction. */
     vector<thread> background_threads;
+    /** The name of each thread in `background_threads`, for diagnostics. */
+    vector<std::string> background_thread_names;
     /** A flag to signal background threads to shut down; set to true during
      * destructor calls. */
     std::atomic<bool> thread_shutdown;
@@ -169,6 +383,81 @@ private:
     // mutex for put
     std::mutex freeze_mutex;
 
+    /** Held while posting a put and recording its writes, so that the puts
+     * recorded for each row are in the order the row's connection completes
+     * them; also protects the rest of the put bookkeeping. */
+    std::mutex put_mutex;
+    /** The most puts that may have writes outstanding to any one row. */
+    const unsigned int put_credits;
+    /** The most writes that the puts outstanding to any one row may have
+     * posted, since a put of several ranges posts one write per range. */
+    const unsigned int write_credits;
+    /** The token of the next put. */
+    uint64_t next_put_token{0};
+    /** The token of the oldest put in `put_writes_remaining`. */
+    uint64_t first_pending_put{0};
+    /** The number of signaled writes that have yet to complete for each put,
+     * starting from `first_pending_put`. */
+    std::deque<uint32_t> put_writes_remaining;
+    /** The number of ranges of each put, starting from
+     * `first_pending_put`. */
+    std::deque<uint32_t> put_num_ranges;
+    /** For each row, the tokens of the puts with a signaled write to it that
+     * has yet to complete, oldest first. */
+    vector<std::deque<uint64_t>> row_pending_puts;
+    /** For each row, the total number of ranges of the puts in
+     * `row_pending_puts`. */
+    vector<unsigned int> row_pending_ranges;
+    /** The number of signaled writes of puts that have yet to complete, so
+     * that the detect thread can skip reaping when there are none. */
+    std::atomic<uint64_t> num_pending_put_writes{0};
+    /** The rows whose connections failed over since the whole local row was
+     * last put to them; see fail_over(). */
+    vector<uint32_t> rows_to_resend;
+    /** Whether `rows_to_resend` has any rows, so that puts can skip the lock
+     * when it has none. */
+    std::atomic<bool> resend_pending{false};
+    /** Held while an atomic operation is outstanding. Each connection has a
+     * single result buffer, and only one poller can wait on `atomic_owner`
+     * at a time. */
+    std::mutex atomic_mutex;
+    /** The ranges of the local row marked since the last put of them, if
+     * `options.track_dirty_ranges` is set. */
+    vector<byte_range> dirty_ranges;
+    /** Protects `dirty_ranges`. */
+    std::mutex dirty_mutex;
+    /** Held while the local row is changed by update(), and while a put of
+     * a versioned row is posted. */
+    std::mutex update_mutex;
+
+    /** A copy of the table made for snapshots. */
+    struct snapshot_buffer {
+        /** Room for a copy of every row. */
+        unique_ptr<InternalRow[], local_memory_deleter> rows;
+        /** The number of rows copied, or 0 if none has been. */
+        unsigned int num_rows = 0;
+        /** The membership epoch in which the rows were copied. */
+        uint64_t epoch = 0;
+    };
+    /** The copies of the table that no snapshot refers to any more. It is
+     * shared with the snapshots, which may outlive the SST. */
+    struct snapshot_pool {
+        std::mutex mutex;
+        vector<unique_ptr<snapshot_buffer>> free_buffers;
+        /** Keeps a buffer for reuse, or frees it if enough are kept. */
+        void release(snapshot_buffer *buffer);
+    };
+    /** The copies of the table for get_snapshot() to reuse. */
+    const std::shared_ptr<snapshot_pool> snapshot_buffers;
+    /** The copy of the table in the latest snapshot, which the next one
+     * shares if no row has changed since. */
+    mutable std::shared_ptr<snapshot_buffer> latest_snapshot;
+    /** Held while a snapshot is taken. */
+    mutable std::mutex snapshot_mutex;
+    /** The bytes written to receivers by puts so far, counted once per
+     * receiver. */
+    std::atomic<uint64_t> put_bytes{0};
+
     /** Base case for the recursive constructor_helper with no template
      * parameters. */
     template <int index>
@@ -217,14 +506,114 @@ private:
     }
 
     // Functions for background threads to run
-    /** Reads all the remote rows once by RDMA, if this SST is in Reads mode. */
-    void refresh_table();
+    /** Reads the remote rows that are due by RDMA, if this SST is in Reads
+     * mode. */
+    bool refresh_table();
+    /** Keeps several refreshes of each remote row in flight, if this SST is
+     * in Reads mode. */
+    void read_pipelined();
+    /** Records what a refresh of a row read, and tells whether it
+     * changed. */
+    bool take_refresh(unsigned int index, const byte_range *reads,
+                      std::size_t num_reads);
+    /** Adds the reads that refresh a row to a list. */
+    void add_refresh_reads(unsigned int index,
+                           vector<byte_range> &reads) const;
+    /** Sets when a row is next refreshed, given whether it just changed. */
+    void schedule_refresh(unsigned int index, bool changed,
+                          std::chrono::steady_clock::time_point now);
     /** Continuously refreshes all the remote rows, if this SST is in Reads
      * mode.
      */
     void read();
     /** Continuously evaluates predicates to detect when they become true. */
     void detect();
+    /** Sends heartbeats and freezes the rows whose heartbeats stop. */
+    void heartbeat();
+
+    /** How long a background thread has gone without finding work. */
+    struct idle_state {
+        /** When the thread last found work. */
+        std::chrono::steady_clock::time_point idle_since =
+            std::chrono::steady_clock::now();
+        /** The length of the last sleep, in microseconds. */
+        int sleep_us = 0;
+    };
+    /** Sleeps if a background thread has been idle for long enough. */
+    void back_off(bool found_work, idle_state &state) const;
+    /** Waits for completions of this SST's operations under the idle_wait
+     * policy. */
+    int await_completions(uint32_t owner, completion *entries,
+                          int max_entries);
+    /** Performs an atomic operation on 8 bytes of a remote row and waits for
+     * it to complete. */
+    bool post_atomic(uint32_t index, long long int field_offset,
+                     atomic_op op, uint64_t compare_add, uint64_t swap,
+                     uint64_t &previous);
+    /** Gets the offset of a field within a row. */
+    template <typename Field>
+    long long int field_offset(Field Row::*field) const;
+    /** Gets the offset within a row of a field of the first row. */
+    long long int row_offset(const volatile void *field) const;
+    /** Gets how many bytes of a row a put or read of the whole row
+     * covers. */
+    long long int row_extent() const;
+    /** Reads the version of a row that is checked before, or after, reading
+     * the rest of it. */
+    static uint64_t read_version(const volatile InternalRow &row,
+                                 bool local_row, bool before);
+    /** Copies a row, again if a change lands in it while it is copied. */
+    static void copy_row(const volatile InternalRow &source,
+                         InternalRow &copy, bool versioned, bool local_row);
+    /** Checks whether a row still holds what a copy of the table has. */
+    bool row_unchanged(const snapshot_buffer &buffer,
+                       unsigned int index) const;
+    /** Adds ranges of a versioned row, between its versions, to a list. */
+    void add_versioned_ranges(const byte_range *ranges,
+                              std::size_t num_ranges,
+                              vector<byte_range> &chain) const;
+    /** Evaluates a predicate while no change lands in the rows it reads. */
+    bool evaluate_stable(const function<bool(const SST &)> &pred,
+                         bool &value) const;
+
+    /** Posts a put once every receiver has a credit and records its
+     * writes. */
+    uint64_t post_put(const vector<uint32_t> &receiver_ranks,
+                      const byte_range *ranges, std::size_t num_ranges,
+                      const signal_policy &policy, bool with_versions = true);
+    /** Posts a put of the dirty ranges of the local row to all the
+     * members. */
+    uint64_t post_dirty_put(const signal_policy &policy);
+    /** Records that a range of the local row has changed. */
+    void add_dirty_range(long long int offset, long long int size);
+    /** Sorts the ranges of a put and merges them into as few as
+     * needed. */
+    static void merge_ranges(const vector<byte_range> &ranges,
+                             vector<byte_range> &merged);
+    /** Records that the oldest outstanding put write to a row completed. */
+    void complete_put_write(uint32_t index);
+    /** Drops the outstanding put writes to a row. */
+    void abandon_put_writes(uint32_t index);
+    /** Moves the connection to a row on which an operation failed to its
+     * standby path, and tells whether the row can stay up. */
+    bool fail_over(uint32_t index, bool *moved = nullptr);
+    /** Puts the whole local row to the rows whose connections failed
+     * over. */
+    void resend_failed_over_rows();
+    /** Checks whether a row can take another put; put_mutex must be
+     * held. */
+    bool has_put_credit(uint32_t index, std::size_t num_ranges) const;
+    /** Checks whether a put has completed; put_mutex must be held. */
+    bool put_done(uint64_t token) const;
+    /** Describes the connection to the member in a row. */
+    connection_request row_connection_request(unsigned int index);
+    /** Starts taking notifications on the connection to a row. */
+    bool enable_row_notifications(unsigned int index);
+    /** Packs the local row index and a changed range into a notification. */
+    uint32_t encode_notification(long long int offset,
+                                 long long int size) const;
+    /** Records the notifications that have arrived in `changed_ranges`. */
+    bool take_notifications();
 
 public:
     /**
@@ -239,10 +628,12 @@ public:
      */
     SST(const vector<uint32_t> &_members, uint32_t my_node_id,
         failure_upcall_t failure_upcall = nullptr, std::vector<char> already_failed = {},
-        bool start_predicate_thread = true)
+        bool start_predicate_thread = true,
+        const SST_Options &options = SST_Options())
         : SST(_members, my_node_id,
               std::pair<std::tuple<>, std::vector<row_predicate_updater_t>>{},
-              failure_upcall, already_failed, start_predicate_thread) {}
+              failure_upcall, already_failed, start_predicate_thread,
+              options) {}
 
     template <typename ExtensionList, typename... RestFunctions>
     SST(const vector<uint32_t> &_members, uint32_t my_node_id,
@@ -253,6 +644,16 @@ public:
         : SST(_members, my_node_id, constructor_helper<0>(pb, named_funs...),
               failure_upcall, already_failed, start_predicate_thread) {}
 
+    template <typename ExtensionList, typename... RestFunctions>
+    SST(const vector<uint32_t> &_members, uint32_t my_node_id,
+        failure_upcall_t failure_upcall, bool start_predicate_thread,
+        std::vector<char> already_failed, const SST_Options &options,
+        const PredicateBuilder<Row, ExtensionList> &pb,
+        RestFunctions... named_funs)
+        : SST(_members, my_node_id, constructor_helper<0>(pb, named_funs...),
+              failure_upcall, already_failed, start_predicate_thread,
+              options) {}
+
     template <typename ExtensionList, typename... RestFunctions>
     SST(const vector<uint32_t> &_members, uint32_t my_node_id,
         const PredicateBuilder<Row, ExtensionList> &pb,
@@ -274,7 +675,8 @@ public:
                   std::vector<row_predicate_updater_t>>,
         failure_upcall_t _failure_upcall = nullptr,
         std::vector<char> already_failed = {},
-        bool start_predicate_thread = true);
+        bool start_predicate_thread = true,
+        const SST_Options &_options = SST_Options());
     SST(const SST &) = delete;
     virtual ~SST();
     /** Starts the predicate evaluation loop. */
@@ -291,20 +693,109 @@ public:
     int get_num_rows() const;
     /** Gets the index of the local row in the table. */
     int get_local_index() const;
+    /** Gets the largest put, in bytes, that is sent inline to every row. */
+    uint32_t get_inline_threshold() const;
+    /** Gets the placement in effect for each background thread, by name. */
+    std::map<std::string, thread_placement> get_thread_placements();
+    /** Checks whether a row may have changed since the detect thread's
+     * previous pass. */
+    bool row_changed(unsigned int index) const;
+    /** Checks whether part of a row may have changed since the detect
+     * thread's previous pass. */
+    bool row_changed(unsigned int index, long long int offset,
+                     long long int size) const;
     /** Gets a snapshot of the table. */
     std::unique_ptr<SST_Snapshot> get_snapshot() const;
     /** Writes the local row to all remote nodes. */
     void put();
     /** Writes the local row to some of the remote nodes. */
-    void put(vector<uint32_t> receiver_ranks);
+    void put(const vector<uint32_t> &receiver_ranks);
     /** Writes a contiguous subset of the local row to all remote nodes. */
     void put(long long int offset, long long int size);
     /** Writes a contiguous subset of the local row to some of the remote nodes.
      */
-    void put(vector<uint32_t> receiver_ranks, long long int offset,
+    void put(const vector<uint32_t> &receiver_ranks, long long int offset,
              long long int size);
+    /** Writes several ranges of the local row to all remote nodes. The
+     * element type is deduced only so that a braced list of row indices
+     * still means the receivers. */
+    template <typename Range>
+    void put(const vector<Range> &ranges);
+    /** Writes several ranges of the local row to some of the remote
+     * nodes. */
+    void put(const vector<uint32_t> &receiver_ranks,
+             const vector<byte_range> &ranges);
+    /** Identifies a put_async() whose writes may still be outstanding. */
+    typedef uint64_t put_token;
+    /** Starts writing the local row to all remote nodes. */
+    put_token put_async();
+    /** Starts writing the local row to some of the remote nodes. */
+    put_token put_async(const vector<uint32_t> &receiver_ranks);
+    /** Starts writing a contiguous subset of the local row to all remote
+     * nodes. */
+    put_token put_async(long long int offset, long long int size);
+    /** Starts writing a contiguous subset of the local row to some of the
+     * remote nodes. */
+    put_token put_async(const vector<uint32_t> &receiver_ranks,
+                        long long int offset, long long int size);
+    /** Starts writing several ranges of the local row to all remote
+     * nodes. */
+    template <typename Range>
+    put_token put_async(const vector<Range> &ranges);
+    /** Starts writing several ranges of the local row to some of the remote
+     * nodes. */
+    put_token put_async(const vector<uint32_t> &receiver_ranks,
+                        const vector<byte_range> &ranges);
+    /** Checks, without blocking, whether an asynchronous put has completed. */
+    bool is_put_complete(put_token token);
+    /** Blocks until an asynchronous put has completed. */
+    void wait_for_put(put_token token);
+    /** Processes the completions of asynchronous puts that are ready. */
+    bool reap_puts();
+    /** Changes the local row so that no reader sees the change half
+     * done. */
+    template <typename Writer>
+    void update(Writer &&writer);
+    /** Sets a field of the local row and marks it dirty. */
+    template <typename Field>
+    void set(Field Row::*field, std::remove_cv_t<Field> value);
+    /** Marks a field of the local row dirty. */
+    template <typename Field>
+    void mark_dirty(Field Row::*field);
+    /** Marks part of the local row dirty, given its address. */
+    void mark_dirty(const volatile void *addr, std::size_t size);
+    /** Gets the number of bytes that puts have written to other members. */
+    uint64_t get_put_bytes() const;
+    /** Sets how a Reads-mode SST refreshes a row. */
+    void set_refresh_plan(unsigned int index, const refresh_plan &plan);
+    /** Gets the number of bytes that the reader thread has read. */
+    uint64_t get_read_bytes() const;
+    /** Gets how fresh a row is, as the time the latest completed refresh of
+     * it was posted. */
+    std::chrono::steady_clock::time_point get_refresh_time(
+        unsigned int index) const;
+    /** Atomically adds to a field of a remote row, at the row's owner. */
+    template <typename Field>
+    bool fetch_add(uint32_t index, Field Row::*field,
+                   std::remove_cv_t<Field> delta,
+                   std::remove_cv_t<Field> *previous = nullptr);
+    /** Atomically replaces a field of a remote row, at the row's owner, if
+     * it holds an expected value. */
+    template <typename Field>
+    bool compare_swap(uint32_t index, Field Row::*field,
+                      std::remove_cv_t<Field> expected,
+                      std::remove_cv_t<Field> desired,
+                      std::remove_cv_t<Field> *previous = nullptr);
     /** Does a TCP sync with each member of the SST. */
     void sync_with_members() const;
+    /** Gets the node rank of the member in each row. */
+    vector<uint32_t> get_members() const;
+    /** Gets the number of changes of membership so far. */
+    uint64_t get_membership_epoch() const;
+    /** Adds a member in a vacant row, connecting only to it. */
+    int add_member(uint32_t node_rank);
+    /** Removes a member, leaving its row vacant. */
+    void remove_member(unsigned int index);
     /** Marks a row as frozen, so it will no longer update, and its
      * corresponding
      * node will not receive writes. */
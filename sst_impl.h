@@ -3,10 +3,13 @@
 
 // This will be included at the bottom of sst.h
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <memory>
 #include <utility>
 #include <cstring>
+#include <limits>
 #include <mutex>
 #include <numeric>
 
@@ -21,18 +24,39 @@ SST<Row, ImplMode, NameEnum, RowExtras>::SST(
     std::pair<decltype(named_functions), std::vector<row_predicate_updater_t>>
         row_preds,
     failure_upcall_t _failure_upcall, std::vector<char> already_failed,
-    bool start_predicate_thread)
+    bool start_predicate_thread, const SST_Options &_options)
     : named_functions(row_preds.first),
       members(_members.size()),
       num_members(_members.size()),
-      table(new InternalRow[_members.size()]),
+      capacity(std::max<std::size_t>(_members.size(), _options.max_members)),
+      all_indices(_members.size()),
+      options(_options),
+      table(static_cast<volatile InternalRow *>(allocate_table_memory(
+          capacity * sizeof(InternalRow), _options.table_memory))),
+      instance_id(new_tag_owner()),
+      atomic_owner(new_tag_owner()),
+      notify_owner(new_tag_owner()),
+      changed_ranges(capacity),
       failure_upcall(_failure_upcall),
       row_predicate_updater_functions(row_preds.second),
-      res_vec(num_members),
+      cq(_options.share_connections
+             ? shared_completion_queue()
+             : std::shared_ptr<completion_queue>(make_completion_queue(
+                   capacity - 1, _options.idle_wait,
+                   _options.change_notifications &&
+                       ImplMode == Mode::Writes))),
+      res_vec(capacity),
       background_threads(),
       thread_shutdown(false),
       thread_start(start_predicate_thread),
+      put_credits(std::max(1u, std::min(_options.max_outstanding_puts,
+                                        max_outstanding_writes()))),
+      write_credits(max_outstanding_writes()),
+      row_pending_puts(capacity),
+      row_pending_ranges(capacity),
+      snapshot_buffers(std::make_shared<snapshot_pool>()),
       predicates(*(new Predicates())) {
+    std::iota(all_indices.begin(), all_indices.end(), 0);
     // copy members and figure out the member_index
     for(uint32_t i = 0; i < num_members; ++i) {
         members[i] = _members[i];
@@ -40,6 +64,11 @@ SST<Row, ImplMode, NameEnum, RowExtras>::SST(
             member_index = i;
         }
     }
+    // the spare rows are vacant
+    members.resize(capacity, VACANT_MEMBER);
+    for(uint32_t i = 0; i < capacity; ++i) {
+        row_is_vacant.push_back(members[i] == VACANT_MEMBER);
+    }
 
     if(already_failed.size()) {
         assert(already_failed.size() == num_members);
@@ -53,46 +82,84 @@ SST<Row, ImplMode, NameEnum, RowExtras>::SST(
     } else {
         row_is_frozen.resize(num_members, false);
     }
+    row_is_frozen.resize(capacity, true);
+    for(uint32_t i = 0; i < num_members; ++i) {
+        if(row_is_vacant[i]) {
+            row_is_frozen[i] = true;
+        }
+    }
+    refresh_plans.assign(capacity, options.refresh);
+    refresh_states.resize(capacity);
+    refresh_times =
+        vector<std::atomic<std::chrono::steady_clock::rep>>(capacity);
+    if(ImplMode == Mode::Reads) {
+        refreshed_rows.resize(capacity * sizeof(InternalRow));
+    }
+    // the first put of a tracked row sends all of it
+    if(options.track_dirty_ranges) {
+        dirty_ranges.push_back({0, row_extent()});
+    }
 
     // sort members descending by node rank, while keeping track of their
     // specified index in the SST
     for(unsigned int sst_index = 0; sst_index < num_members; ++sst_index) {
-        members_by_rank[members[sst_index]] = sst_index;
+        if(!row_is_vacant[sst_index]) {
+            members_by_rank[members[sst_index]] = sst_index;
+        }
     }
 
-    // initialize each element of res_vec
+    // initialize each element of res_vec, connecting to all the members at
+    // once
+    vector<connection_request> requests;
+    vector<unsigned int> request_indices;
     unsigned int node_rank, sst_index;
     for(auto const &rank_index : members_by_rank) {
         std::tie(node_rank, sst_index) = rank_index;
-        char *write_addr, *read_addr;
-        if(ImplMode == Mode::Reads) {
-            write_addr = (char *)&(table[member_index]);
-            read_addr = (char *)&(table[sst_index]);
-        } else {
-            write_addr = (char *)&(table[sst_index]);
-            read_addr = (char *)&(table[member_index]);
-        }
-        int size = sizeof(table[0]);
         if(sst_index != member_index) {
             if(row_is_frozen[sst_index]) {
                 continue;
             }
             // exchange lkey and addr of the table via tcp for enabling rdma
             // reads
-            res_vec[sst_index] = std::make_unique<resources>(
-                node_rank, write_addr, read_addr, size, size);
-            // update qp_num_to_index
-            qp_num_to_index[res_vec[sst_index].get()->qp->qp_num] = sst_index;
+            requests.push_back(row_connection_request(sst_index));
+            request_indices.push_back(sst_index);
+        }
+    }
+    auto connections =
+        make_connections(requests, cq.get(), options.share_connections);
+    for(unsigned int i = 0; i < connections.size(); ++i) {
+        sst_index = request_indices[i];
+        res_vec[sst_index] = std::move(connections[i]);
+        res_vec[sst_index]->tag = make_tag(instance_id, sst_index);
+    }
+    // notifications carry a 16-bit row index
+    if(options.change_notifications && ImplMode == Mode::Writes &&
+       capacity <= (1u << 16)) {
+        notifications_enabled = true;
+        for(unsigned int index = 0; index < capacity; ++index) {
+            if(res_vec[index] && !enable_row_notifications(index)) {
+                notifications_enabled = false;
+            }
         }
     }
 
     if(ImplMode == Mode::Reads) {
         // create the reader and the detector thread
         thread reader(&SST::read, this);
+        place_thread(reader.native_handle(), options.reader_thread);
         background_threads.push_back(std::move(reader));
+        background_thread_names.push_back("reader");
     }
     thread detector(&SST::detect, this);
+    place_thread(detector.native_handle(), options.detector_thread);
     background_threads.push_back(std::move(detector));
+    background_thread_names.push_back("detector");
+    if(options.heartbeats.interval_ms > 0) {
+        thread heartbeats(&SST::heartbeat, this);
+        place_thread(heartbeats.native_handle(), options.heartbeat_thread);
+        background_threads.push_back(std::move(heartbeats));
+        background_thread_names.push_back("heartbeat");
+    }
 
     cout << "Initialized SST and Started Threads" << endl;
 }
@@ -112,6 +179,40 @@ SST<Row, ImplMode, NameEnum, RowExtras>::~SST() {
     delete &predicates;
 }
 
+/**
+ * In Reads mode the local node reads the member's row from the member's
+ * table; in Writes mode the member writes its row into the local table.
+ *
+ * @param index The index of a remote member's row.
+ * @return The request for a connection to the member.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+connection_request
+SST<Row, ImplMode, NameEnum, RowExtras>::row_connection_request(
+    unsigned int index) {
+    char *write_addr, *read_addr;
+    if(ImplMode == Mode::Reads) {
+        write_addr = (char *)&(table[member_index]);
+        read_addr = (char *)&(table[index]);
+    } else {
+        write_addr = (char *)&(table[index]);
+        read_addr = (char *)&(table[member_index]);
+    }
+    int size = sizeof(table[0]);
+    return {(int)members[index], write_addr, read_addr, size, size};
+}
+
+/**
+ * @param index The index of a remote member's row.
+ * @return False if the transport cannot deliver notifications on the
+ * connection.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::enable_row_notifications(
+    unsigned int index) {
+    return res_vec[index]->enable_notifications(make_tag(notify_owner, index));
+}
+
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 void SST<Row, ImplMode, NameEnum, RowExtras>::delete_all_predicates() {
     predicates.clear();
@@ -202,15 +303,312 @@ int SST<Row, ImplMode, NameEnum, RowExtras>::get_local_index() const {
 }
 
 /**
- * This is a deep copy of the table that can be used for predicate evaluation,
+ * Over RDMA, a put() of at most this many bytes is copied into the work
+ * request when it is posted, which saves the device a DMA read of the local
+ * row. The threshold is negotiated with the device when each queue pair is
+ * created, so this is the smallest one among the connections to live rows.
+ *
+ * @return The inline threshold in bytes, or 0 if puts are never sent inline.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+uint32_t SST<Row, ImplMode, NameEnum, RowExtras>::get_inline_threshold()
+    const {
+    uint32_t threshold = 0;
+    bool first = true;
+    for(unsigned int index = 0; index < num_members; ++index) {
+        if(index == member_index || row_is_frozen[index] || !res_vec[index]) {
+            continue;
+        }
+        uint32_t max_inline_data = res_vec[index]->get_max_inline_data();
+        if(first || max_inline_data < threshold) {
+            threshold = max_inline_data;
+            first = false;
+        }
+    }
+    return threshold;
+}
+
+/**
+ * This is meant for diagnostics: it reports the CPUs and scheduling policy
+ * that each thread actually has, which may differ from the ones in the
+ * options if placing the thread failed.
+ *
+ * @return The placement of each background thread, keyed by "reader",
+ * "detector" or "heartbeat".
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+std::map<std::string, thread_placement>
+SST<Row, ImplMode, NameEnum, RowExtras>::get_thread_placements() {
+    std::map<std::string, thread_placement> placements;
+    for(unsigned int i = 0; i < background_threads.size(); ++i) {
+        placements[background_thread_names[i]] =
+            get_thread_placement(background_threads[i].native_handle());
+    }
+    return placements;
+}
+
+/**
+ * This is meant for predicates, which the detect thread evaluates in
+ * passes: a predicate that depends only on some rows can return early when
+ * none of them changed. Every change to a remote row is reported in the pass
+ * it becomes visible in or a later one, so a predicate that skips unchanged
+ * rows may fire a pass late, but never misses a change. Without
+ * notifications, and for the local row, this is always true.
+ *
+ * @param index The index of the row to check.
+ * @return False if the row is known not to have changed.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::row_changed(
+    unsigned int index) const {
+    return row_changed(index, 0, sizeof(InternalRow));
+}
+
+/**
+ * Notifications carry the changed range rounded out to 1/256th of a row, so
+ * a range next to the one a put wrote may also be reported changed.
+ *
+ * @param index The index of the row to check.
+ * @param offset The offset, within the Row structure, of the range to check.
+ * @param size The number of bytes in the range.
+ * @return False if no byte of the range is known to have changed.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::row_changed(
+    unsigned int index, long long int offset, long long int size) const {
+    if(!notifications_enabled || index == member_index) {
+        return true;
+    }
+    const auto &range = changed_ranges[index];
+    return range.first < range.second && offset < range.second &&
+           range.first < offset + size;
+}
+
+/**
+ * The index takes the low 16 bits, and the first and last of the 256 chunks
+ * of the row that the range touches take 8 bits each.
+ *
+ * @param offset The offset, within the Row structure, of the range written.
+ * @param size The number of bytes written.
+ * @return The value of the notification.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+uint32_t SST<Row, ImplMode, NameEnum, RowExtras>::encode_notification(
+    long long int offset, long long int size) const {
+    const long long int chunk_size = (sizeof(InternalRow) + 255) / 256;
+    uint32_t first_chunk = offset / chunk_size;
+    uint32_t last_chunk = (offset + std::max(size, 1LL) - 1) / chunk_size;
+    return member_index | first_chunk << 16 | last_chunk << 24;
+}
+
+/**
+ * Each notification taken frees its receive, so that the sender can send
+ * another. A failed notification fails the row's connection over, or else
+ * freezes the row, as a failed put does.
+ *
+ * @return True if any notification was taken.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::take_notifications() {
+    const int max_entries = 16;
+    completion entries[max_entries];
+    int num_completions = poll_completions(notify_owner, entries, max_entries,
+                                           cq.get(), false);
+    if(num_completions == 0) {
+        return false;
+    }
+    const uint32_t chunk_size = (sizeof(InternalRow) + 255) / 256;
+    int num_failed = 0;
+    uint32_t failed[max_entries];
+    {
+        // connections are only destroyed with put_mutex held
+        std::lock_guard<std::mutex> lock(put_mutex);
+        for(int i = 0; i < num_completions; ++i) {
+            uint32_t from = tag_index(entries[i].tag);
+            if(entries[i].result != 1) {
+                failed[num_failed++] = from;
+                continue;
+            }
+            if(res_vec[from]) {
+                res_vec[from]->notification_consumed();
+            }
+            uint32_t index = entries[i].imm & 0xffff;
+            if(index >= num_members) {
+                continue;
+            }
+            uint32_t first = ((entries[i].imm >> 16) & 0xff) * chunk_size;
+            uint32_t last =
+                std::min<uint32_t>((((entries[i].imm >> 24) & 0xff) + 1) *
+                                       chunk_size,
+                                   sizeof(InternalRow));
+            auto &range = changed_ranges[index];
+            if(range.first >= range.second) {
+                range = {first, last};
+                changed_rows.push_back(index);
+            } else {
+                range = {std::min(range.first, first),
+                         std::max(range.second, last)};
+            }
+        }
+    }
+    for(int i = 0; i < num_failed; ++i) {
+        std::unique_lock<std::mutex> lock(freeze_mutex);
+        if(row_is_frozen[failed[i]] || fail_over(failed[i])) {
+            continue;
+        }
+        cout << "Notification error in QP " << res_vec[failed[i]]->get_id()
+             << ". Freezing row " << failed[i] << endl;
+        lock.unlock();
+        freeze(failed[i]);
+    }
+    return true;
+}
+
+/**
+ * This is a copy of the table that can be used for predicate evaluation,
  * which will no longer be affected by remote nodes updating their rows.
+ * With the versioned_rows option, each row is copied again if a change
+ * landed in it while it was copied; SST_Snapshot::is_consistent() tells
+ * whether a row that kept changing was copied whole in the end.
+ *
+ * Copies of the table are pooled rather than allocated for each snapshot.
+ * If no row has changed since the latest snapshot, the new one shares its
+ * copy. Otherwise the snapshot takes a copy that no snapshot refers to any
+ * more, and copies into it only the rows that differ from what it holds:
+ * those whose versions changed, with the versioned_rows option, or whose
+ * bytes differ. The local row is always compared byte by byte, since it may
+ * change through operator[] without its versions changing. Without
+ * versions, telling whether a row changed still reads the whole row, so
+ * what is saved is the allocation and the writes of the copy.
  *
  * @return A copy of all the SST's rows in their current state.
  */
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 std::unique_ptr<typename SST<Row, ImplMode, NameEnum, RowExtras>::SST_Snapshot>
 SST<Row, ImplMode, NameEnum, RowExtras>::get_snapshot() const {
-    return std::make_unique<SST_Snapshot>(table, num_members);
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    const uint64_t epoch = membership_epoch;
+    const unsigned int num_rows = num_members;
+    if(latest_snapshot && latest_snapshot->epoch == epoch &&
+       latest_snapshot->num_rows == num_rows) {
+        bool changed = false;
+        for(unsigned int index = 0; index < num_rows && !changed; ++index) {
+            changed = !row_unchanged(*latest_snapshot, index);
+        }
+        if(!changed) {
+            return std::unique_ptr<SST_Snapshot>(new SST_Snapshot(
+                std::shared_ptr<const InternalRow>(
+                    latest_snapshot, latest_snapshot->rows.get()),
+                num_rows));
+        }
+    }
+    unique_ptr<snapshot_buffer> buffer;
+    {
+        std::lock_guard<std::mutex> pool_lock(snapshot_buffers->mutex);
+        if(!snapshot_buffers->free_buffers.empty()) {
+            buffer = std::move(snapshot_buffers->free_buffers.back());
+            snapshot_buffers->free_buffers.pop_back();
+        }
+    }
+    if(!buffer) {
+        buffer.reset(new snapshot_buffer);
+        buffer->rows.reset(static_cast<InternalRow *>(allocate_local_memory(
+            capacity * sizeof(InternalRow), options.table_memory)));
+    }
+    // rows copied before the membership changed may belong to other members
+    if(buffer->epoch != epoch) {
+        buffer->num_rows = 0;
+    }
+    for(unsigned int index = 0; index < num_rows; ++index) {
+        if(!row_unchanged(*buffer, index)) {
+            copy_row(table[index], buffer->rows[index], options.versioned_rows,
+                     index == member_index);
+        }
+    }
+    buffer->num_rows = num_rows;
+    buffer->epoch = epoch;
+    // the copy goes back to the pool once no snapshot refers to it
+    std::shared_ptr<snapshot_pool> pool = snapshot_buffers;
+    latest_snapshot.reset(buffer.release(), [pool](snapshot_buffer *unused) {
+        pool->release(unused);
+    });
+    return std::unique_ptr<SST_Snapshot>(
+        new SST_Snapshot(std::shared_ptr<const InternalRow>(
+                             latest_snapshot, latest_snapshot->rows.get()),
+                         num_rows));
+}
+
+/**
+ * @param buffer A copy of the table.
+ * @param index The index of a row.
+ * @return True if the copy holds the row as it is now.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::row_unchanged(
+    const snapshot_buffer &buffer, unsigned int index) const {
+    if(index >= buffer.num_rows) {
+        return false;
+    }
+    const InternalRow &copy = buffer.rows[index];
+    const volatile InternalRow &row = table[index];
+    if(options.versioned_rows && index != member_index) {
+        return copy.sst_version_begin == copy.sst_version_end &&
+               row.sst_version_end == copy.sst_version_end &&
+               row.sst_version_begin == copy.sst_version_begin;
+    }
+    return memcmp(&copy, const_cast<const InternalRow *>(&row),
+                  sizeof(InternalRow)) == 0;
+}
+
+/**
+ * Without versions this is a plain copy, which may catch a change half
+ * landed.
+ *
+ * @param source The row to copy.
+ * @param copy Set to the row; with versions, its versions are the ones that
+ * were checked, which differ if the row kept changing for
+ * MAX_VERSION_RETRIES tries.
+ * @param versioned Whether the row carries versions.
+ * @param local_row Whether the row is the local one, whose versions change
+ * in the opposite order to the others.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::copy_row(
+    const volatile InternalRow &source, InternalRow &copy, bool versioned,
+    bool local_row) {
+    if(!versioned) {
+        std::memcpy(&copy, const_cast<const InternalRow *>(&source),
+                    sizeof(InternalRow));
+        return;
+    }
+    for(int attempt = 0; attempt < MAX_VERSION_RETRIES; ++attempt) {
+        uint64_t before = read_version(source, local_row, true);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        std::memcpy(&copy, const_cast<const InternalRow *>(&source),
+                    sizeof(InternalRow));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = read_version(source, local_row, false);
+        // the copy keeps the versions as they were checked
+        copy.sst_version_begin = before;
+        copy.sst_version_end = after;
+        if(before == after) {
+            return;
+        }
+    }
+}
+
+/**
+ * @param buffer A copy of the table that no snapshot refers to.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::snapshot_pool::release(
+    snapshot_buffer *buffer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(free_buffers.size() < MAX_POOLED_SNAPSHOTS) {
+        free_buffers.emplace_back(buffer);
+    } else {
+        delete buffer;
+    }
 }
 
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
@@ -223,12 +621,75 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::freeze(int index) {
         row_is_frozen[index] = true;
     }
     num_frozen++;
-    res_vec[index].reset();
+    {
+        // nothing can be posted to the row while its connection is destroyed
+        std::lock_guard<std::mutex> lock(put_mutex);
+        abandon_put_writes(index);
+        res_vec[index].reset();
+    }
     if(failure_upcall) {
         failure_upcall(members[index]);
     }
 }
 
+/**
+ * Over RDMA, a connection may have a standby queue pair on a second rail,
+ * which it moves to when an operation on its own queue pair fails, so that
+ * the row stays up. The writes outstanding on the failed queue pair may not
+ * have landed, so in Writes mode they are dropped and the next put first
+ * puts the whole local row to the row again. A failure reported by a queue
+ * pair the connection already moved away from leaves it as it is.
+ *
+ * @param index The row on whose connection an operation failed.
+ * @param moved If not null, set to whether the connection moved now, so
+ * that the operations outstanding on it were lost, rather than the failure
+ * being a late one from a queue pair it already left.
+ * @return False if the row has no working connection left and must be
+ * frozen.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::fail_over(uint32_t index,
+                                                         bool *moved) {
+    std::lock_guard<std::mutex> lock(put_mutex);
+    bool connection_moved = false;
+    if(moved) {
+        *moved = false;
+    }
+    if(row_is_frozen[index] || !res_vec[index]) {
+        return false;
+    }
+    if(!res_vec[index]->fail_over(connection_moved)) {
+        return false;
+    }
+    if(moved) {
+        *moved = connection_moved;
+    }
+    if(connection_moved && ImplMode == Mode::Writes) {
+        abandon_put_writes(index);
+        rows_to_resend.push_back(index);
+        resend_pending = true;
+    }
+    return true;
+}
+
+/**
+ * This is called by post_put() before it posts anything, rather than by
+ * fail_over(), since connections fail over while puts are being posted.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::resend_failed_over_rows() {
+    vector<uint32_t> rows;
+    {
+        std::lock_guard<std::mutex> lock(put_mutex);
+        rows.swap(rows_to_resend);
+        resend_pending = false;
+    }
+    if(!rows.empty()) {
+        const byte_range whole_row{0, row_extent()};
+        post_put(rows, &whole_row, 1, options.put_signaling);
+    }
+}
+
 /**
  * Exchanges a single byte of data with each member of the SST group over the
  * TCP (not RDMA) connection, in descending order of the members' node ranks.
@@ -248,93 +709,653 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::sync_with_members() const {
 }
 
 /**
- * If this SST is in Writes mode, this function does nothing.
+ * A node joining an SST that has members already passes this, with its own
+ * rank in the row it was given, to the SST constructor, along with the same
+ * max_members option as the other members.
+ *
+ * @return The node rank of the member in each row in use, or VACANT_MEMBER
+ * for a vacant row.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+vector<uint32_t> SST<Row, ImplMode, NameEnum, RowExtras>::get_members() const {
+    return vector<uint32_t>(members.begin(), members.begin() + num_members);
+}
+
+/**
+ * The epoch changes under the predicate lock, together with the membership,
+ * so every predicate evaluated in one pass of the detect thread sees the same
+ * members as the others, and a predicate can compare the epoch with the one
+ * it last saw to notice a change.
+ *
+ * @return The number of calls to add_member() and remove_member() that
+ * changed the membership.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+uint64_t SST<Row, ImplMode, NameEnum, RowExtras>::get_membership_epoch()
+    const {
+    return membership_epoch;
+}
+
+/**
+ * Every current member calls this for the same node, in the same order with
+ * respect to other changes of membership, so that they all place it in the
+ * same row; the new node constructs its SST with get_members() and the row
+ * it was given, and must be reachable with add_node() beforehand. The new
+ * member takes the first vacant row, or else the next spare one. Only the
+ * connection to the new member is made, so the cost of the change does not
+ * grow with the size of the group.
+ *
+ * @param node_rank The node rank of the new member.
+ * @return The index of the new member's row, or -1 if the node is already a
+ * member or there is no room left for it.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+int SST<Row, ImplMode, NameEnum, RowExtras>::add_member(uint32_t node_rank) {
+    if(node_rank == VACANT_MEMBER || members_by_rank.count(node_rank)) {
+        std::cerr << "Node " << node_rank << " cannot join the SST" << endl;
+        return -1;
+    }
+    unsigned int index = 0;
+    while(index < num_members && !row_is_vacant[index]) {
+        ++index;
+    }
+    if(index == capacity) {
+        std::cerr << "No room for node " << node_rank
+                  << " to join the SST; raise max_members" << endl;
+        return -1;
+    }
+    // clear what the previous member left, before the new one can write it
+    memset(const_cast<InternalRow *>(&table[index]), 0, sizeof(table[0]));
+    members[index] = node_rank;
+    auto connections = make_connections({row_connection_request(index)},
+                                        cq.get(), options.share_connections);
+    connections[0]->tag = make_tag(instance_id, index);
+    if(notifications_enabled) {
+        connections[0]->enable_notifications(make_tag(notify_owner, index));
+    }
+
+    membership_change_pending = true;
+    std::lock_guard<std::mutex> membership_lock(membership_mutex);
+    membership_change_pending = false;
+    std::lock_guard<std::mutex> predicates_lock(predicates.predicate_mutex);
+    std::lock_guard<std::mutex> lock(put_mutex);
+    res_vec[index] = std::move(connections[0]);
+    members_by_rank[node_rank] = index;
+    row_is_vacant[index] = false;
+    {
+        std::lock_guard<std::mutex> freeze_lock(freeze_mutex);
+        row_is_frozen[index] = false;
+    }
+    if(index == num_members) {
+        all_indices.push_back(index);
+        ++num_members;
+    }
+    refresh_states[index] = refresh_state();
+    refresh_times[index] = 0;
+    if(ImplMode == Mode::Reads) {
+        memset(&refreshed_rows[index * sizeof(InternalRow)], 0,
+               sizeof(InternalRow));
+    }
+    ++membership_epoch;
+    // the new member has none of the local row yet
+    add_dirty_range(0, row_extent());
+    return index;
+}
+
+/**
+ * Every remaining member calls this when a node leaves, or to evict a failed
+ * one, in the same order with respect to other changes of membership. Unlike
+ * freeze(), this makes the row available to a later add_member() and does
+ * not call the failure upcall. If the row is the last one in use, the table
+ * shrinks past it and any vacant rows before it.
+ *
+ * @param index The index of the departing member's row.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::remove_member(
+    unsigned int index) {
+    assert(index < num_members && index != member_index);
+    unique_ptr<connection> departed;
+    {
+        membership_change_pending = true;
+        std::lock_guard<std::mutex> membership_lock(membership_mutex);
+        membership_change_pending = false;
+        std::lock_guard<std::mutex> predicates_lock(
+            predicates.predicate_mutex);
+        std::lock_guard<std::mutex> lock(put_mutex);
+        if(row_is_vacant[index]) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> freeze_lock(freeze_mutex);
+            row_is_frozen[index] = true;
+        }
+        row_is_vacant[index] = true;
+        abandon_put_writes(index);
+        departed = std::move(res_vec[index]);
+        members_by_rank.erase(members[index]);
+        members[index] = VACANT_MEMBER;
+        while(row_is_vacant[num_members - 1]) {
+            all_indices.pop_back();
+            --num_members;
+        }
+        ++membership_epoch;
+    }
+    // the connection is torn down without holding up the other threads
+}
+
+/**
+ * If this SST is in Writes mode, this function does nothing. Each row is
+ * read as its refresh plan says, once it is due; the rows whose plans skip
+ * them on this pass are left as they were. With the versioned_rows option,
+ * the ranges of a row are read between its end version, first, and its
+ * begin version, last, so that a row read while its owner changed it has
+ * versions that differ.
+ *
+ * @return True if any row read has changed since its previous refresh.
  */
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
-void SST<Row, ImplMode, NameEnum, RowExtras>::refresh_table() {
+bool SST<Row, ImplMode, NameEnum, RowExtras>::refresh_table() {
     assert(ImplMode == Mode::Reads);
-    for(unsigned int index = 0; index < num_members; ++index) {
-        // don't read own row or a frozen row
-        if(index == member_index || row_is_frozen[index]) {
-            continue;
+    static thread_local vector<completion> completions;
+    static thread_local vector<byte_range> reads;
+    // the rows read on this pass, and the first of each one's reads
+    static thread_local vector<uint32_t> refreshed;
+    static thread_local vector<std::size_t> first_reads;
+    // the members must not change while reads are outstanding
+    while(membership_change_pending) {
+        std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> membership_lock(membership_mutex);
+    const auto now = std::chrono::steady_clock::now();
+    reads.clear();
+    refreshed.clear();
+    first_reads.clear();
+    long long int num_bytes_read = 0;
+    {
+        // another thread may freeze a row and destroy its connection
+        std::lock_guard<std::mutex> lock(put_mutex);
+        for(unsigned int index = 0; index < num_members; ++index) {
+            // don't read own row or a frozen row
+            if(index == member_index || row_is_frozen[index] ||
+               !res_vec[index] || now < refresh_states[index].next_refresh) {
+                continue;
+            }
+            refreshed.push_back(index);
+            first_reads.push_back(reads.size());
+            add_refresh_reads(index, reads);
+            // perform a remote read on the owner of the row
+            for(std::size_t i = first_reads.back(); i < reads.size(); ++i) {
+                res_vec[index]->post_remote_read(reads[i].offset,
+                                                 reads[i].size);
+                num_bytes_read += reads[i].size;
+            }
         }
-        // perform a remote RDMA read on the owner of the row
-        res_vec[index]->post_remote_read(sizeof(table[0]));
     }
-    // track which nodes haven't failed yet
+    first_reads.push_back(reads.size());
+    read_bytes.fetch_add(num_bytes_read, std::memory_order_relaxed);
+    const unsigned int num_reads_posted = reads.size();
+    // track which nodes haven't failed yet, and which failed over
     vector<bool> polled_successfully(num_members, false);
-    // poll for one less than number of rows
-    for(unsigned int index = 0; index < num_members - num_frozen - 1; ++index) {
-        // poll for completion
-        auto p = verbs_poll_completion();
-        int qp_num = p.first;
-        int result = p.second;
-        if(result == 1) {
-            polled_successfully[qp_num_to_index[qp_num]] = true;
-        } else if(result == -1) {
-            int index = qp_num_to_index[qp_num];
-            if(!row_is_frozen[index]) {
-                freeze(index);
-                return;
-            }
-        } else if(result == 0) {
+    vector<bool> failed_over(num_members, false);
+    completions.resize(num_reads_posted);
+    // poll for every read posted, as many at a time as are ready
+    unsigned int num_polled = 0;
+    while(num_polled < num_reads_posted) {
+        int num_completions =
+            await_completions(instance_id, completions.data(),
+                              num_reads_posted - num_polled);
+        if(num_completions == 0) {
             // find some node that hasn't been polled yet and report it
-            for(unsigned int index = 0; index < num_members; ++index) {
-                if(index == member_index || row_is_frozen[index] ||
-                   polled_successfully[index] == true) {
+            for(uint32_t index : refreshed) {
+                if(row_is_frozen[index] || polled_successfully[index] == true ||
+                   failed_over[index]) {
                     continue;
                 }
+                membership_lock.unlock();
                 freeze(index);
-                return;
+                return false;
+            }
+            return false;
+        }
+        for(int i = 0; i < num_completions; ++i) {
+            int index = tag_index(completions[i].tag);
+            if(completions[i].result == 1) {
+                polled_successfully[index] = true;
+            } else if(row_is_frozen[index]) {
+                continue;
+            } else if(fail_over(index)) {
+                // the row is read again in the next round
+                failed_over[index] = true;
+            } else {
+                membership_lock.unlock();
+                freeze(index);
+                return false;
             }
         }
+        num_polled += num_completions;
+    }
+    // a row that has not changed is refreshed less and less often
+    bool changed = false;
+    for(std::size_t k = 0; k < refreshed.size(); ++k) {
+        const unsigned int index = refreshed[k];
+        if(failed_over[index]) {
+            continue;
+        }
+        bool row_changed = take_refresh(index, &reads[first_reads[k]],
+                                        first_reads[k + 1] - first_reads[k]);
+        refresh_times[index] = now.time_since_epoch().count();
+        schedule_refresh(index, row_changed, now);
+        changed = changed || row_changed;
     }
+    return changed;
 }
 
 /**
- * If this SST is in Reads mode, this function is run in a detached background
- * thread to continuously keep the local SST table updated. If this SST is in
- * Writes mode, this function does nothing.
+ * The reader thread runs this instead of refresh_table() when
+ * `reads_in_flight` is set. It posts a refresh of every row that is due, up
+ * to `reads_in_flight` of them per row, or one for a row with a refresh
+ * interval, and takes completions as they come, so the wire never idles
+ * between rounds and a slow member only delays its own row. A row whose
+ * oldest refresh has been outstanding for COMPLETION_TIMEOUT_MS, or whose
+ * read fails on a connection that cannot fail over, is frozen. Before the
+ * membership changes, the reads in flight are drained.
  */
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
-void SST<Row, ImplMode, NameEnum, RowExtras>::read() {
-    if(ImplMode == Mode::Reads) {
-        while(!thread_shutdown) {
-            refresh_table();
+void SST<Row, ImplMode, NameEnum, RowExtras>::read_pipelined() {
+    using std::chrono::steady_clock;
+    struct pending_refresh {
+        steady_clock::time_point posted;
+        uint32_t reads_left;
+    };
+    const std::size_t max_reads = max_outstanding_writes();
+    const auto timeout = std::chrono::milliseconds(COMPLETION_TIMEOUT_MS);
+    // for each row, its refreshes in flight, oldest first, and their reads
+    vector<std::deque<pending_refresh>> pending(capacity);
+    vector<vector<byte_range>> row_reads(capacity);
+    vector<std::size_t> row_reads_outstanding(capacity, 0);
+    std::size_t num_outstanding = 0;
+    vector<completion> completions(std::max(4 * capacity, 16u));
+    vector<uint32_t> failed;
+    idle_state state;
+    // drops the refreshes in flight to a row
+    auto abandon = [&](unsigned int index) {
+        num_outstanding -= row_reads_outstanding[index];
+        row_reads_outstanding[index] = 0;
+        pending[index].clear();
+    };
+    std::unique_lock<std::mutex> membership_lock(membership_mutex,
+                                                 std::defer_lock);
+    while(true) {
+        if(!membership_lock.owns_lock()) {
+            if(thread_shutdown) {
+                break;
+            }
+            // the members must not change while reads are outstanding
+            while(membership_change_pending) {
+                std::this_thread::yield();
+            }
+            membership_lock.lock();
         }
-        cout << "Reader thread shutting down" << endl;
+        const bool draining = membership_change_pending || thread_shutdown;
+        auto now = steady_clock::now();
+        long long int num_bytes_read = 0;
+        bool posted = false;
+        // another thread may freeze a row and destroy its connection
+        std::unique_lock<std::mutex> put_lock(put_mutex, std::defer_lock);
+        if(!draining) {
+            put_lock.lock();
+        }
+        for(unsigned int index = 0; index < num_members && !draining;
+            ++index) {
+            // don't read own row or a frozen row
+            if(index == member_index || row_is_frozen[index] ||
+               !res_vec[index]) {
+                continue;
+            }
+            const unsigned int limit = refresh_states[index].interval_us > 0
+                                           ? 1
+                                           : options.reads_in_flight;
+            while(pending[index].size() < limit &&
+                  now >= refresh_states[index].next_refresh) {
+                row_reads[index].clear();
+                add_refresh_reads(index, row_reads[index]);
+                const std::size_t num_reads = row_reads[index].size();
+                if(!pending[index].empty() &&
+                   row_reads_outstanding[index] + num_reads > max_reads) {
+                    break;
+                }
+                if(num_reads == 0) {
+                    schedule_refresh(index, false, now);
+                    break;
+                }
+                for(const byte_range &range : row_reads[index]) {
+                    res_vec[index]->post_remote_read(range.offset, range.size);
+                    num_bytes_read += range.size;
+                }
+                pending[index].push_back({now, (uint32_t)num_reads});
+                posted = true;
+                row_reads_outstanding[index] += num_reads;
+                num_outstanding += num_reads;
+            }
+        }
+        if(put_lock.owns_lock()) {
+            put_lock.unlock();
+        }
+        read_bytes.fetch_add(num_bytes_read, std::memory_order_relaxed);
+        // take the completions that are ready, or wait for one if there
+        // is nothing else to do
+        int num_completions = 0;
+        if(num_outstanding > 0 && posted) {
+            num_completions = poll_completions(instance_id, completions.data(),
+                                               completions.size(), cq.get(),
+                                               false);
+        } else if(num_outstanding > 0) {
+            num_completions = await_completions(
+                instance_id, completions.data(), completions.size());
+        }
+        bool changed = false;
+        failed.clear();
+        for(int i = 0; i < num_completions; ++i) {
+            unsigned int index = tag_index(completions[i].tag);
+            if(pending[index].empty()) {
+                // a late completion for a row that froze
+                continue;
+            }
+            if(completions[i].result != 1) {
+                // a late failure from a queue pair the row moved away from
+                // is dropped, since the reads on it were abandoned when it
+                // moved, and those on the new one are still in flight
+                bool moved;
+                if(!fail_over(index, &moved)) {
+                    abandon(index);
+                    failed.push_back(index);
+                } else if(moved) {
+                    abandon(index);
+                }
+                continue;
+            }
+            --row_reads_outstanding[index];
+            --num_outstanding;
+            if(--pending[index].front().reads_left > 0) {
+                continue;
+            }
+            const auto posted_at = pending[index].front().posted;
+            pending[index].pop_front();
+            bool row_changed = take_refresh(index, row_reads[index].data(),
+                                            row_reads[index].size());
+            refresh_times[index] = posted_at.time_since_epoch().count();
+            schedule_refresh(index, row_changed, steady_clock::now());
+            changed = changed || row_changed;
+        }
+        for(unsigned int index = 0; index < num_members; ++index) {
+            if(pending[index].empty()) {
+                continue;
+            }
+            if(row_is_frozen[index]) {
+                abandon(index);
+            } else if(now - pending[index].front().posted >= timeout) {
+                abandon(index);
+                failed.push_back(index);
+            }
+        }
+        if(num_outstanding == 0 || !failed.empty()) {
+            membership_lock.unlock();
+        }
+        for(uint32_t index : failed) {
+            freeze(index);
+        }
+        back_off(changed, state);
     }
 }
 
 /**
- * This function is run in a detached background thread to detect predicate
- * events. It continuously evaluates predicates one by one, and runs the
- * trigger functions for each predicate that fires. In addition, it
- * continuously evaluates named functions one by one, and updates the local
- * row's observed values of those functions.
+ * The parts of the row that were read are compared with what the previous
+ * refresh found, leaving out the heartbeat counter, which changes on its
+ * own, and the versions, which only change with the rest of the row.
+ *
+ * @param index The index of a row whose refresh completed.
+ * @param reads The reads of the refresh.
+ * @param num_reads The number of reads in `reads`.
+ * @return True if the row changed since its previous refresh.
  */
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
-void SST<Row, ImplMode, NameEnum, RowExtras>::detect() {
-    if(!thread_start) {
-        std::unique_lock<std::mutex> lock(thread_start_mutex);
-        thread_start_cv.wait(lock, [this]() { return thread_start; });
-    }
-    while(!thread_shutdown) {
-        // Take the predicate lock before reading the predicate lists
-        std::unique_lock<std::mutex> predicates_lock(
-            predicates.predicate_mutex);
-
-        // update intermediate results for Row Predicates
-        for(auto &f : row_predicate_updater_functions) {
-            f(*this);
+bool SST<Row, ImplMode, NameEnum, RowExtras>::take_refresh(
+    unsigned int index, const byte_range *reads, std::size_t num_reads) {
+    const long long int watched_end = row_offset(&table[0].sst_heartbeat);
+    char *previous = &refreshed_rows[index * sizeof(InternalRow)];
+    const char *current =
+        const_cast<const char *>((const volatile char *)&table[index]);
+    bool changed = false;
+    for(std::size_t i = 0; i < num_reads; ++i) {
+        long long int end =
+            std::min(reads[i].offset + reads[i].size, watched_end);
+        long long int size = end - reads[i].offset;
+        if(size > 0 && memcmp(previous + reads[i].offset,
+                              current + reads[i].offset, size) != 0) {
+            memcpy(previous + reads[i].offset, current + reads[i].offset,
+                   size);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * The reads of a row cover the ranges of its refresh plan, merged as for a
+ * put, and its heartbeat counter if heartbeats are enabled and the plan
+ * leaves it out.
+ *
+ * @param index The index of a remote row.
+ * @param reads The list to add the reads to, in the order to post them.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::add_refresh_reads(
+    unsigned int index, vector<byte_range> &reads) const {
+    static thread_local vector<byte_range> ranges;
+    const refresh_plan &plan = refresh_plans[index];
+    if(plan.ranges.empty()) {
+        ranges.assign(1, {0, row_extent()});
+    } else {
+        merge_ranges(plan.ranges, ranges);
+        if(options.heartbeats.interval_ms > 0) {
+            reads.push_back(
+                {row_offset(&table[0].sst_heartbeat), sizeof(uint64_t)});
+        }
+    }
+    if(options.versioned_rows) {
+        add_versioned_ranges(ranges.data(), ranges.size(), reads);
+        return;
+    }
+    for(const byte_range &range : ranges) {
+        if(range.size > 0) {
+            reads.push_back(range);
+        }
+    }
+}
+
+/**
+ * With heartbeats, no row waits longer than a heartbeat interval, so that
+ * refresh plans cannot make a member look failed.
+ *
+ * @param index The index of a row that was just refreshed.
+ * @param changed Whether the row changed since its previous refresh.
+ * @param now When the row was refreshed.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::schedule_refresh(
+    unsigned int index, bool changed,
+    std::chrono::steady_clock::time_point now) {
+    const refresh_plan &plan = refresh_plans[index];
+    refresh_state &state = refresh_states[index];
+    if(changed || state.interval_us < plan.interval_us) {
+        state.interval_us = plan.interval_us;
+    } else if(state.interval_us < plan.max_interval_us) {
+        state.interval_us = std::min(std::max(2 * state.interval_us, 1),
+                                     plan.max_interval_us);
+    }
+    int interval_us = state.interval_us;
+    if(options.heartbeats.interval_ms > 0) {
+        interval_us =
+            std::min(interval_us, options.heartbeats.interval_ms * 1000);
+    }
+    state.next_refresh = now + std::chrono::microseconds(interval_us);
+}
+
+/**
+ * With the default policy this is a blocking poll that spins. Otherwise it
+ * spins for `spin_us` and then sleeps on the completion queue, for at most
+ * `max_sleep_us` at a time, until a completion arrives or COMPLETION_TIMEOUT_MS
+ * passes.
+ *
+ * @param owner The owner part of the tags of the operations to wait for.
+ * @param entries The array to store the completions in.
+ * @param max_entries The maximum number of completions to return.
+ * @return The number of completions stored in `entries`, or 0 if none was
+ * found before the timeout.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+int SST<Row, ImplMode, NameEnum, RowExtras>::await_completions(
+    uint32_t owner, completion *entries, int max_entries) {
+    const wait_policy &policy = options.idle_wait;
+    if(policy.spin_us < 0) {
+        return poll_completions(owner, entries, max_entries, cq.get());
+    }
+    const auto start = std::chrono::steady_clock::now();
+    while(true) {
+        int num_completions = poll_completions(owner, entries, max_entries,
+                                               cq.get(), false);
+        if(num_completions > 0) {
+            return num_completions;
+        }
+        auto waited = std::chrono::steady_clock::now() - start;
+        if(waited >= std::chrono::milliseconds(COMPLETION_TIMEOUT_MS)) {
+            std::cerr << "Completion wasn't found after timeout" << endl;
+            return 0;
+        }
+        if(waited >= std::chrono::microseconds(policy.spin_us)) {
+            cq->wait(policy.max_sleep_us);
+        }
+    }
+}
+
+/**
+ * A thread that keeps finding no work first spins for `spin_us`, then sleeps
+ * for periods that double from 1 microsecond up to `max_sleep_us`, so an SST
+ * that stays idle costs little CPU and notices new work within
+ * `max_sleep_us`. With the default policy this never sleeps.
+ *
+ * @param found_work Whether the thread found work since its last call.
+ * @param state The idle state of the calling thread.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::back_off(
+    bool found_work, idle_state &state) const {
+    const wait_policy &policy = options.idle_wait;
+    if(policy.spin_us < 0) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if(found_work) {
+        state.idle_since = now;
+        state.sleep_us = 0;
+        return;
+    }
+    if(now - state.idle_since < std::chrono::microseconds(policy.spin_us)) {
+        return;
+    }
+    state.sleep_us = std::min(std::max(2 * state.sleep_us, 1),
+                              std::max(policy.max_sleep_us, 1));
+    if(notifications_enabled) {
+        // a notification ends the sleep early
+        cq->wait(state.sleep_us);
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(state.sleep_us));
+    }
+}
+
+/**
+ * If this SST is in Reads mode, this function is run in a detached background
+ * thread to continuously keep the local SST table updated. If this SST is in
+ * Writes mode, this function does nothing.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::read() {
+    if(ImplMode == Mode::Reads) {
+        if(options.reads_in_flight > 0) {
+            read_pipelined();
+        } else {
+            idle_state state;
+            while(!thread_shutdown) {
+                back_off(refresh_table(), state);
+            }
+        }
+        cout << "Reader thread shutting down" << endl;
+    }
+}
+
+/**
+ * This function is run in a detached background thread to detect predicate
+ * events. It continuously evaluates predicates one by one, and runs the
+ * trigger functions for each predicate that fires. In addition, it
+ * continuously evaluates named functions one by one, and updates the local
+ * row's observed values of those functions.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::detect() {
+    if(!thread_start) {
+        std::unique_lock<std::mutex> lock(thread_start_mutex);
+        if(notifications_enabled) {
+            // keep freeing receives, or the senders would stall
+            while(!thread_start_cv.wait_for(
+                lock, std::chrono::milliseconds(1),
+                [this]() { return thread_start; })) {
+                lock.unlock();
+                take_notifications();
+                lock.lock();
+            }
+        } else {
+            thread_start_cv.wait(lock, [this]() { return thread_start; });
+        }
+    }
+    idle_state state;
+    while(!thread_shutdown) {
+        // whether any trigger ran or any put completed in this pass
+        bool found_work = false;
+        // report the rows that changed since the previous pass
+        if(notifications_enabled) {
+            for(uint32_t index : changed_rows) {
+                changed_ranges[index] = {0, 0};
+            }
+            changed_rows.clear();
+            while(take_notifications()) {
+                found_work = true;
+            }
+        }
+        // complete asynchronous puts in the background
+        if(num_pending_put_writes > 0) {
+            found_work = reap_puts() || found_work;
+        }
+
+        // Take the predicate lock before reading the predicate lists
+        std::unique_lock<std::mutex> predicates_lock(
+            predicates.predicate_mutex);
+
+        // update intermediate results for Row Predicates
+        for(auto &f : row_predicate_updater_functions) {
+            f(*this);
         }
 
         // evolving predicates trigger, then evolve
         for(std::size_t i = 0; i < predicates.evolving_preds.size(); ++i) {
+            bool fired;
             if(predicates.evolving_preds.at(i)) {
-                if(predicates.evolving_preds.at(i)->first(*this)) {
+                if(evaluate_stable(predicates.evolving_preds.at(i)->first,
+                                   fired) &&
+                   fired) {
                     // take predicate out of list
                     auto pred_pair = std::move(predicates.evolving_preds[i]);
+                    found_work = true;
                     // evaluate triggers on predicate
                     for(auto &trig : predicates.evolving_triggers.at(i)) {
                         trig(*this, pred_pair->second);
@@ -351,7 +1372,9 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::detect() {
 
         // one time predicates need to be evaluated only until they become true
         for(auto &pred : predicates.one_time_predicates) {
-            if(pred != nullptr && (pred->first(*this) == true)) {
+            bool fired;
+            if(pred != nullptr && evaluate_stable(pred->first, fired) &&
+               fired) {
                 // Copy the trigger pointer locally, so it can continue running
                 // without
                 // segfaulting
@@ -359,6 +1382,7 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::detect() {
                 // predicates_lock
                 std::shared_ptr<typename Predicates::trig> trigger(
                     pred->second);
+                found_work = true;
                 predicates_lock.unlock();
                 (*trigger)(*this);
                 predicates_lock.lock();
@@ -370,9 +1394,12 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::detect() {
         // recurrent predicates are evaluated each time they are found to be
         // true
         for(auto &pred : predicates.recurrent_predicates) {
-            if(pred != nullptr && (pred->first(*this) == true)) {
+            bool fired;
+            if(pred != nullptr && evaluate_stable(pred->first, fired) &&
+               fired) {
                 std::shared_ptr<typename Predicates::trig> trigger(
                     pred->second);
+                found_work = true;
                 predicates_lock.unlock();
                 (*trigger)(*this);
                 predicates_lock.lock();
@@ -391,15 +1418,19 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::detect() {
             if(*pred_it != nullptr) {
                 //*pred_state_it is the previous state of the predicate at
                 //*pred_it
-                bool curr_pred_state = (*pred_it)->first(*this);
-                if(curr_pred_state == true && *pred_state_it == false) {
-                    std::shared_ptr<typename Predicates::trig> trigger(
-                        (*pred_it)->second);
-                    predicates_lock.unlock();
-                    (*trigger)(*this);
-                    predicates_lock.lock();
+                bool curr_pred_state;
+                // a predicate that could not be evaluated keeps its state
+                if(evaluate_stable((*pred_it)->first, curr_pred_state)) {
+                    if(curr_pred_state == true && *pred_state_it == false) {
+                        std::shared_ptr<typename Predicates::trig> trigger(
+                            (*pred_it)->second);
+                        found_work = true;
+                        predicates_lock.unlock();
+                        (*trigger)(*this);
+                        predicates_lock.lock();
+                    }
+                    *pred_state_it = curr_pred_state;
                 }
-                *pred_state_it = curr_pred_state;
 
                 ++pred_it;
                 ++pred_state_it;
@@ -442,35 +1473,117 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::detect() {
         //                pred_state_it++;
         //            }
         //        }
+
+        predicates_lock.unlock();
+        back_off(found_work, state);
     }
 
     cout << "Predicate detection thread shutting down" << endl;
 }
 
+/**
+ * This runs in its own thread when heartbeats are enabled, whether or not
+ * predicate evaluation has started, so a member keeps sending heartbeats
+ * while its application is still setting up. A heartbeat is a put of the
+ * 8-byte counter alone, mostly unsignaled, and it skips rows that are out of
+ * put credits, so a stalled member cannot hold up the heartbeats to the
+ * others. The counter is not covered by the row's versions. A row's timeout
+ * starts over whenever a new member takes it.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::heartbeat() {
+    using std::chrono::steady_clock;
+    const auto interval =
+        std::chrono::milliseconds(options.heartbeats.interval_ms);
+    const auto timeout =
+        std::chrono::milliseconds(options.heartbeats.timeout_ms);
+    const signal_policy heartbeat_signaling{
+        std::numeric_limits<unsigned int>::max(), false};
+    const volatile InternalRow &first_row = table[0];
+    const long long int offset =
+        (const volatile char *)&first_row.sst_heartbeat -
+        (const volatile char *)&first_row;
+    // for each row, the member and heartbeat last seen, and when it changed
+    vector<uint32_t> seen_members(capacity, VACANT_MEMBER);
+    vector<uint64_t> seen_heartbeats(capacity, 0);
+    vector<steady_clock::time_point> last_seen(capacity);
+    vector<uint32_t> receivers, expired;
+    auto next_beat = steady_clock::now();
+    while(!thread_shutdown) {
+        // other transports report completions to the posting thread only
+        if(ImplMode == Mode::Writes && num_pending_put_writes > 0) {
+            reap_puts();
+        }
+        auto now = steady_clock::now();
+        receivers.clear();
+        expired.clear();
+        {
+            // the members only change with put_mutex held
+            std::lock_guard<std::mutex> lock(put_mutex);
+            for(unsigned int index = 0; index < num_members; ++index) {
+                if(index == member_index || row_is_frozen[index]) {
+                    continue;
+                }
+                uint64_t beat = table[index].sst_heartbeat;
+                if(members[index] != seen_members[index] ||
+                   beat != seen_heartbeats[index]) {
+                    seen_members[index] = members[index];
+                    seen_heartbeats[index] = beat;
+                    last_seen[index] = now;
+                } else if(now - last_seen[index] >= timeout) {
+                    expired.push_back(index);
+                    continue;
+                }
+                if(has_put_credit(index, 1)) {
+                    receivers.push_back(index);
+                }
+            }
+        }
+        for(uint32_t index : expired) {
+            cout << "No heartbeat from row " << index << " for "
+                 << options.heartbeats.timeout_ms << " ms. Freezing row "
+                 << index << endl;
+            freeze(index);
+        }
+        table[member_index].sst_heartbeat =
+            table[member_index].sst_heartbeat + 1;
+        if(ImplMode == Mode::Writes && !receivers.empty()) {
+            const byte_range range{offset, sizeof(uint64_t)};
+            post_put(receivers, &range, 1, heartbeat_signaling, false);
+        }
+        // a late wakeup, such as a slow failure upcall, sends no burst
+        next_beat = std::max(next_beat + interval, steady_clock::now());
+        std::this_thread::sleep_until(next_beat);
+    }
+    cout << "Heartbeat thread shutting down" << endl;
+}
+
 /**
  * This writes the entire local row, using a one-sided RDMA write, to all of
- * the other members of the SST group. If this SST is in Reads mode, this
- * function does nothing.
+ * the other members of the SST group. With the track_dirty_ranges option, it
+ * writes only the ranges marked dirty since the last such put, and nothing
+ * at all if there are none. If this SST is in Reads mode, this function does
+ * nothing.
  */
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 void SST<Row, ImplMode, NameEnum, RowExtras>::put() {
-    vector<uint32_t> indices(num_members);
-    iota(indices.begin(), indices.end(), 0);
-    put(indices, 0, sizeof(table[0]));
+    if(options.track_dirty_ranges) {
+        wait_for_put(post_dirty_put(options.put_signaling));
+        return;
+    }
+    put(all_indices, 0, row_extent());
 }
 
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 void SST<Row, ImplMode, NameEnum, RowExtras>::put(
-    vector<uint32_t> receiver_ranks) {
-    put(receiver_ranks, 0, sizeof(table[0]));
+    const vector<uint32_t> &receiver_ranks) {
+    put(receiver_ranks, 0, row_extent());
 }
 
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 void SST<Row, ImplMode, NameEnum, RowExtras>::put(long long int offset,
                                                   long long int size) {
-    vector<uint32_t> indices(num_members);
-    iota(indices.begin(), indices.end(), 0);
-    put(indices, offset, size);
+    put(all_indices, offset, size);
 }
 
 /**
@@ -483,79 +1596,943 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::put(long long int offset,
 *
 * If this SST is in Reads mode, this function does nothing.
 *
+* This blocks until the writes signaled under the SST's put_signaling policy
+* have completed. It is equivalent to waiting on a put_async() that uses
+* that policy.
+*
 * @param offset The offset, within the Row structure, of the region of the
 * row to write
 * @param size The number of bytes to write, starting at the offset.
 */
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 void SST<Row, ImplMode, NameEnum, RowExtras>::put(
-    vector<uint32_t> receiver_ranks, long long int offset, long long int size) {
-    assert(ImplMode == Mode::Writes);
-    vector<bool> posted_write_to(num_members, false);
-    uint num_writes_posted = 0;
-    for(auto index : receiver_ranks) {
-        // don't write to yourself or a frozen row
-        if(index == member_index || row_is_frozen[index]) {
-            continue;
+    const vector<uint32_t> &receiver_ranks, long long int offset,
+    long long int size) {
+    const byte_range range{offset, size};
+    wait_for_put(post_put(receiver_ranks, &range, 1, options.put_signaling));
+}
+
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+template <typename Range>
+void SST<Row, ImplMode, NameEnum, RowExtras>::put(
+    const vector<Range> &ranges) {
+    static_assert(std::is_same<Range, byte_range>::value,
+                  "Error: a put of several ranges takes byte_ranges");
+    put(all_indices, ranges);
+}
+
+/**
+ * This writes fields that are not next to each other, such as a slot and the
+ * counter that says it is filled, in one operation: each receiver gets all
+ * the ranges, in order of offset, and the put completes once they have all
+ * landed. That saves writing the whole row, or waiting for one put per
+ * field. Adjacent and overlapping ranges are written as one, and so are the
+ * closest ones if there are more than MAX_PUT_RANGES; either way only bytes
+ * of the local row are written. Over RDMA the ranges to each receiver are
+ * posted as one chain of writes.
+ *
+ * @param receiver_ranks The indices of the rows to write to.
+ * @param ranges The ranges, within the Row structure, to write.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::put(
+    const vector<uint32_t> &receiver_ranks,
+    const vector<byte_range> &ranges) {
+    static thread_local vector<byte_range> merged;
+    merge_ranges(ranges, merged);
+    wait_for_put(post_put(receiver_ranks, merged.data(), merged.size(),
+                          options.put_signaling));
+}
+
+/**
+ * With the track_dirty_ranges option, this writes only the dirty ranges, as
+ * put() does.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+auto SST<Row, ImplMode, NameEnum, RowExtras>::put_async() -> put_token {
+    if(options.track_dirty_ranges) {
+        return post_dirty_put(signal_policy());
+    }
+    return put_async(all_indices, 0, row_extent());
+}
+
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+auto SST<Row, ImplMode, NameEnum, RowExtras>::put_async(
+    const vector<uint32_t> &receiver_ranks) -> put_token {
+    return put_async(receiver_ranks, 0, row_extent());
+}
+
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+auto SST<Row, ImplMode, NameEnum, RowExtras>::put_async(long long int offset,
+                                                        long long int size)
+    -> put_token {
+    return put_async(all_indices, offset, size);
+}
+
+/**
+ * This returns as soon as the writes are posted, so a caller can issue many
+ * puts back to back and reap their completions later with is_put_complete()
+ * or wait_for_put(), from any thread.
+ * Every write of an asynchronous put is signaled, so its token completes
+ * exactly when all of its writes have landed. If a receiver already has
+ * `max_outstanding_puts` puts in flight, this first waits for the oldest of
+ * them to complete. A failed write fails the row's connection over, or
+ * else freezes the row, as in put().
+ *
+ * @param receiver_ranks The indices of the rows to write to.
+ * @param offset The offset, within the Row structure, of the region of the
+ * row to write
+ * @param size The number of bytes to write, starting at the offset.
+ * @return The token of the put.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+auto SST<Row, ImplMode, NameEnum, RowExtras>::put_async(
+    const vector<uint32_t> &receiver_ranks, long long int offset,
+    long long int size) -> put_token {
+    const byte_range range{offset, size};
+    return post_put(receiver_ranks, &range, 1, signal_policy());
+}
+
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+template <typename Range>
+auto SST<Row, ImplMode, NameEnum, RowExtras>::put_async(
+    const vector<Range> &ranges) -> put_token {
+    static_assert(std::is_same<Range, byte_range>::value,
+                  "Error: a put of several ranges takes byte_ranges");
+    return put_async(all_indices, ranges);
+}
+
+/**
+ * This is the asynchronous form of put() with several ranges; the token
+ * completes once every range has landed at every receiver.
+ *
+ * @param receiver_ranks The indices of the rows to write to.
+ * @param ranges The ranges, within the Row structure, to write.
+ * @return The token of the put.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+auto SST<Row, ImplMode, NameEnum, RowExtras>::put_async(
+    const vector<uint32_t> &receiver_ranks,
+    const vector<byte_range> &ranges) -> put_token {
+    static thread_local vector<byte_range> merged;
+    merge_ranges(ranges, merged);
+    return post_put(receiver_ranks, merged.data(), merged.size(),
+                    signal_policy());
+}
+
+/**
+ * With the versioned_rows option, the row's begin version is set to a new
+ * version before `writer` runs and its end version after, so that a reader
+ * that finds the two equal around its read of the row saw none of the change
+ * or all of it. Locally the versions change begin first; puts and Reads-mode
+ * refreshes copy them end first, so a change that lands while a row is being
+ * copied also leaves the copy with versions that differ, until the next
+ * copy. Updates from several threads take turns. Without the option, this
+ * just calls `writer`.
+ *
+ * For example, to move a pair of fields that readers must see together:
+ *
+ *     sst_instance.update([&](volatile Row &row) {
+ *         row.first = a;
+ *         row.second = b;
+ *     });
+ *
+ * @param writer Called with the local row, as a `volatile Row &`, to change
+ * it.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+template <typename Writer>
+void SST<Row, ImplMode, NameEnum, RowExtras>::update(Writer &&writer) {
+    volatile InternalRow &row = table[member_index];
+    if(!options.versioned_rows) {
+        writer(static_cast<volatile Row &>(row));
+        return;
+    }
+    std::lock_guard<std::mutex> lock(update_mutex);
+    const uint64_t version = row.sst_version_begin + 1;
+    row.sst_version_begin = version;
+    std::atomic_thread_fence(std::memory_order_release);
+    writer(static_cast<volatile Row &>(row));
+    std::atomic_thread_fence(std::memory_order_release);
+    row.sst_version_end = version;
+}
+
+/**
+ * The field is written with a plain store, like an assignment through
+ * operator[], inside an update(); only scalar fields can be set this way,
+ * and the others, such as arrays, are written in place and marked with
+ * mark_dirty(). Without the track_dirty_ranges and versioned_rows options,
+ * this is just the assignment.
+ *
+ * @param field The field to set, as a pointer to a member of Row.
+ * @param value The value to store.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+template <typename Field>
+void SST<Row, ImplMode, NameEnum, RowExtras>::set(
+    Field Row::*field, std::remove_cv_t<Field> value) {
+    static_assert(std::is_scalar<Field>::value,
+                  "set() takes a scalar field; mark others with mark_dirty()");
+    update([&](volatile Row &row) { row.*field = value; });
+    mark_dirty(field);
+}
+
+/**
+ * @param field The field that changed, as a pointer to a member of Row.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+template <typename Field>
+void SST<Row, ImplMode, NameEnum, RowExtras>::mark_dirty(Field Row::*field) {
+    add_dirty_range(field_offset(field), sizeof(Field));
+}
+
+/**
+ * This suits parts of a field, such as an element of an array, which have
+ * no pointer to member: if `row` is the local row, the element `i` of its
+ * array `slots` is marked with
+ *
+ *     sst_instance.mark_dirty(&row.slots[i], sizeof(row.slots[i]));
+ *
+ * @param addr The address, within the local row, of the first byte that
+ * changed.
+ * @param size The number of bytes that changed.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::mark_dirty(
+    const volatile void *addr, std::size_t size) {
+    long long int offset = (const volatile char *)addr -
+                           (const volatile char *)&table[member_index];
+    assert(offset >= 0 &&
+           offset + (long long int)size <= (long long int)sizeof(table[0]));
+    add_dirty_range(offset, size);
+}
+
+/**
+ * The ranges are merged as they pile up, so that the list stays short
+ * however often the same fields change between puts.
+ *
+ * @param offset The offset, within the Row structure, of the range.
+ * @param size The number of bytes in the range.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::add_dirty_range(
+    long long int offset, long long int size) {
+    if(!options.track_dirty_ranges) {
+        return;
+    }
+    static thread_local vector<byte_range> merged;
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    dirty_ranges.push_back({offset, size});
+    if(dirty_ranges.size() > 2 * MAX_PUT_RANGES) {
+        merge_ranges(dirty_ranges, merged);
+        dirty_ranges.swap(merged);
+    }
+}
+
+/**
+ * The dirty ranges are taken before they are written, so a range marked
+ * while the put is being posted goes out with the next put as well.
+ *
+ * @param policy Which of the writes to signal.
+ * @return The token of the put, which is already complete if nothing was
+ * dirty.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+uint64_t SST<Row, ImplMode, NameEnum, RowExtras>::post_dirty_put(
+    const signal_policy &policy) {
+    static thread_local vector<byte_range> dirty, merged;
+    static const vector<uint32_t> no_receivers;
+    dirty.clear();
+    {
+        std::lock_guard<std::mutex> lock(dirty_mutex);
+        dirty.swap(dirty_ranges);
+    }
+    merge_ranges(dirty, merged);
+    const bool clean = merged.size() == 1 && merged[0].size == 0;
+    return post_put(clean ? no_receivers : all_indices, merged.data(),
+                    merged.size(), policy);
+}
+
+/**
+ * This includes heartbeats, and counts each byte once per receiver, so it
+ * measures the traffic that puts cause; a put of the whole row to n
+ * receivers adds n times the size of a row.
+ *
+ * @return The number of bytes written by puts so far.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+uint64_t SST<Row, ImplMode, NameEnum, RowExtras>::get_put_bytes() const {
+    return put_bytes.load(std::memory_order_relaxed);
+}
+
+/**
+ * Rows that no predicate looks at can be read rarely, or only in the parts
+ * that matter, to spare the NIC and the PCIe bus on large groups, while the
+ * rows that matter keep being read on every pass. The row is refreshed on
+ * the next pass under its new plan. A plan outlives a change of the row's
+ * member. In Writes mode this has no effect.
+ *
+ * @param index The index of a row.
+ * @param plan How to refresh the row.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::set_refresh_plan(
+    unsigned int index, const refresh_plan &plan) {
+    assert(index < capacity);
+    membership_change_pending = true;
+    std::lock_guard<std::mutex> membership_lock(membership_mutex);
+    membership_change_pending = false;
+    refresh_plans[index] = plan;
+    refresh_states[index] = refresh_state();
+}
+
+/**
+ * A row is at least as new as this time, since the refresh that read it was
+ * posted then. The local row is always fresh, so for it this is the current
+ * time; a row that has not been refreshed, such as any remote row in Writes
+ * mode, gives the epoch of steady_clock.
+ *
+ * @param index The index of a row.
+ * @return When the latest completed refresh of the row was posted.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+std::chrono::steady_clock::time_point
+SST<Row, ImplMode, NameEnum, RowExtras>::get_refresh_time(
+    unsigned int index) const {
+    using std::chrono::steady_clock;
+    if(index == member_index) {
+        return steady_clock::now();
+    }
+    return steady_clock::time_point(steady_clock::duration(
+        refresh_times[index].load(std::memory_order_relaxed)));
+}
+
+/**
+ * This counts every byte of every read posted by the reader thread, so it
+ * measures the load that refreshing the table puts on the NIC.
+ *
+ * @return The number of bytes read so far.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+uint64_t SST<Row, ImplMode, NameEnum, RowExtras>::get_read_bytes() const {
+    return read_bytes.load(std::memory_order_relaxed);
+}
+
+/**
+ * @param token The token returned by put_async().
+ * @return True if all the writes of the put have completed, or were dropped
+ * because their rows froze.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::is_put_complete(
+    put_token token) {
+    {
+        std::lock_guard<std::mutex> lock(put_mutex);
+        if(put_done(token)) {
+            return true;
         }
-        // perform a remote RDMA write on the owner of the row
-        res_vec[index]->post_remote_write(offset, size);
-        posted_write_to[index] = true;
-        num_writes_posted++;
-    }
-    // track which nodes haven't failed yet
-    vector<bool> polled_successfully_from(num_members, false);
-    // poll for surviving number of rows
-    for(unsigned int index = 0; index < num_writes_posted; ++index) {
-        // poll for completion
-        auto p = verbs_poll_completion();
-        int qp_num = p.first;
-        int result = p.second;
-        if(result == 1) {
-            int index = qp_num_to_index[qp_num];
-            // assert(posted_write_to[index]);
-            polled_successfully_from[index] = true;
-        } else if(result == -1) {
-            int index = qp_num_to_index[qp_num];
-            if(!row_is_frozen[index]) {
-                cout << "Poll completion error in QP " << qp_num
-                     << ". Freezing row " << index << endl;
-                freeze(index);
+    }
+    reap_puts();
+    std::lock_guard<std::mutex> lock(put_mutex);
+    return put_done(token);
+}
+
+/**
+ * If no write of the put completes for COMPLETION_TIMEOUT_MS, one of the rows
+ * it is still waiting for is reported as failed and frozen, and this
+ * returns.
+ *
+ * @param token The token returned by put_async().
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::wait_for_put(put_token token) {
+    const unsigned int polls_per_timeout_check = 64;
+    const bool may_sleep = options.idle_wait.spin_us >= 0;
+    auto last_progress = std::chrono::steady_clock::now();
+    for(unsigned int num_empty_polls = 1;; ++num_empty_polls) {
+        {
+            std::lock_guard<std::mutex> lock(put_mutex);
+            if(put_done(token)) {
                 return;
             }
-        } else if(result == 0) {
-            // find some node that hasn't been polled yet and report it
-            for(unsigned int index2 = 0; index2 < num_members; ++index2) {
-                if(!posted_write_to[index2] ||
-                   polled_successfully_from[index2]) {
-                    continue;
+        }
+        if(reap_puts()) {
+            last_progress = std::chrono::steady_clock::now();
+            continue;
+        }
+        if(!may_sleep && num_empty_polls % polls_per_timeout_check != 0) {
+            continue;
+        }
+        auto idle_time = std::chrono::steady_clock::now() - last_progress;
+        if(idle_time < std::chrono::milliseconds(COMPLETION_TIMEOUT_MS)) {
+            if(may_sleep && idle_time >= std::chrono::microseconds(
+                                             options.idle_wait.spin_us)) {
+                cq->wait(options.idle_wait.max_sleep_us);
+            }
+            continue;
+        }
+        // find some node that hasn't completed the put yet and report it
+        int failed_index = -1;
+        {
+            std::lock_guard<std::mutex> lock(put_mutex);
+            for(unsigned int index = 0; index < num_members; ++index) {
+                if(!row_pending_puts[index].empty() &&
+                   row_pending_puts[index].front() <= token) {
+                    failed_index = index;
+                    break;
                 }
-                // if (index2 != 0) {
-                //   cout << "Number of writes posted = " <<
-                //   remote_writes_posted << endl;
-                //   cout << "num_frozen = " << num_frozen << endl;
-
-                //   cout << "Writes posted to " << endl;
-                //   for (auto n : writes_posted_to) {
-                //     cout << n <<  " ";
-                //   }
-                //   cout << endl;
-
-                //   cout << "Polled successfully from " << endl;
-                //   for (uint i = 0; i < num_members; ++i) {
-                //     if (polled_successfully[i]) {
-                //       cout << members[i] << " ";
-                //     }
-                //   }
-                //   cout << endl;
-                // }
-                cout << "Reporting failure on row " << index2
-                     << " even though it didn't fail directly" << endl;
-                freeze(index2);
-                return;
             }
         }
+        if(failed_index >= 0) {
+            cout << "Reporting failure on row " << failed_index
+                 << " even though it didn't fail directly" << endl;
+            freeze(failed_index);
+        }
+        return;
+    }
+}
+
+/**
+ * @return True if any completion was processed.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::reap_puts() {
+    const int max_entries = 16;
+    completion entries[max_entries];
+    int num_completions = poll_completions(instance_id, entries, max_entries,
+                                           cq.get(), false);
+    if(num_completions == 0) {
+        return false;
+    }
+    int num_failed = 0;
+    uint32_t failed[max_entries];
+    {
+        std::lock_guard<std::mutex> lock(put_mutex);
+        for(int i = 0; i < num_completions; ++i) {
+            uint32_t index = tag_index(entries[i].tag);
+            if(entries[i].result == 1) {
+                complete_put_write(index);
+            } else {
+                failed[num_failed++] = index;
+            }
+        }
+    }
+    for(int i = 0; i < num_failed; ++i) {
+        std::unique_lock<std::mutex> lock(freeze_mutex);
+        if(row_is_frozen[failed[i]] || fail_over(failed[i])) {
+            continue;
+        }
+        cout << "Poll completion error in QP " << res_vec[failed[i]]->get_id()
+             << ". Freezing row " << failed[i] << endl;
+        lock.unlock();
+        freeze(failed[i]);
+    }
+    return true;
+}
+
+/**
+ * The operation works on the row's owner's copy, which is the one the owner
+ * sees as its local row; other members see the new value only once the
+ * owner puts it, or, in Reads mode, once they next refresh. The field must be
+ * an 8-byte integer at an 8-byte aligned offset within the row.
+ *
+ * @param index The index of the remote row to update.
+ * @param field The field to add to, as a pointer to a member of Row.
+ * @param delta The value to add.
+ * @param previous If not null, set to the value the field held before the
+ * addition.
+ * @return False if the operation could not be performed, because the row is
+ * local or frozen, the transport does not support atomic operations, or the
+ * row failed while it was outstanding.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+template <typename Field>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::fetch_add(
+    uint32_t index, Field Row::*field, std::remove_cv_t<Field> delta,
+    std::remove_cv_t<Field> *previous) {
+    static_assert(std::is_integral<Field>::value && sizeof(Field) == 8,
+                  "Atomic operations need an 8-byte integer field");
+    uint64_t old_value;
+    if(!post_atomic(index, field_offset(field), atomic_op::fetch_add,
+                    (uint64_t)delta, 0, old_value)) {
+        return false;
+    }
+    if(previous) {
+        *previous = (std::remove_cv_t<Field>)old_value;
+    }
+    return true;
+}
+
+/**
+ * This is the building block for locks and elections held in a row: the
+ * swap took place exactly when `*previous` equals `expected`. It has the
+ * same requirements as fetch_add().
+ *
+ * @param index The index of the remote row to update.
+ * @param field The field to update, as a pointer to a member of Row.
+ * @param expected The value the field must hold for the swap to happen.
+ * @param desired The value to store in the field.
+ * @param previous If not null, set to the value the field held before the
+ * operation.
+ * @return False if the operation could not be performed, for the same
+ * reasons as fetch_add(); a comparison that fails still returns true.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+template <typename Field>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::compare_swap(
+    uint32_t index, Field Row::*field, std::remove_cv_t<Field> expected,
+    std::remove_cv_t<Field> desired, std::remove_cv_t<Field> *previous) {
+    static_assert(std::is_integral<Field>::value && sizeof(Field) == 8,
+                  "Atomic operations need an 8-byte integer field");
+    uint64_t old_value;
+    if(!post_atomic(index, field_offset(field), atomic_op::compare_swap,
+                    (uint64_t)expected, (uint64_t)desired, old_value)) {
+        return false;
+    }
+    if(previous) {
+        *previous = (std::remove_cv_t<Field>)old_value;
+    }
+    return true;
+}
+
+/**
+ * @param field A pointer to a member of Row.
+ * @return The offset, in bytes, of the field within each row of the table.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+template <typename Field>
+long long int SST<Row, ImplMode, NameEnum, RowExtras>::field_offset(
+    Field Row::*field) const {
+    const volatile Row &row = table[0];
+    return (const volatile char *)&(row.*field) -
+           (const volatile char *)&row;
+}
+
+/**
+ * This reaches the fields of InternalRow that are not in Row, such as the
+ * versions.
+ *
+ * @param field The address of a field of the first row of the table.
+ * @return The offset, in bytes, of the field within each row of the table.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+long long int SST<Row, ImplMode, NameEnum, RowExtras>::row_offset(
+    const volatile void *field) const {
+    return (const volatile char *)field - (const volatile char *)&table[0];
+}
+
+/**
+ * The versions, which come last in a row, are never part of it: with the
+ * versioned_rows option they are written and read around the rest of the
+ * row. The heartbeat counter before them is only part of it if heartbeats
+ * are enabled.
+ *
+ * @return The size of the prefix of a row that holds what is in use.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+long long int SST<Row, ImplMode, NameEnum, RowExtras>::row_extent() const {
+    if(options.heartbeats.interval_ms > 0) {
+        return row_offset(&table[0].sst_version_begin);
+    }
+    return row_offset(&table[0].sst_heartbeat);
+}
+
+/**
+ * The local row gets its begin version first when it changes, and a copy
+ * of another member's row gets its end version first. A reader reads the
+ * version that changes last before the rest of the row and the one that
+ * changes first after it, with a fence each side; if the two match, no
+ * change landed in the row while it was read.
+ *
+ * @param row The row to read a version of.
+ * @param local_row Whether the row is the local one.
+ * @param before True for the version to read before the rest of the row,
+ * false for the one to read after it.
+ * @return The version.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+uint64_t SST<Row, ImplMode, NameEnum, RowExtras>::read_version(
+    const volatile InternalRow &row, bool local_row, bool before) {
+    if(local_row == before) {
+        return row.sst_version_end;
+    }
+    return row.sst_version_begin;
+}
+
+/**
+ * The parts of the ranges that overlap the versions are left out, and empty
+ * ranges are dropped.
+ *
+ * @param ranges The ranges of a row.
+ * @param num_ranges The number of ranges in `ranges`.
+ * @param chain The list to add the row's end version, the ranges, and its
+ * begin version to, in that order.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::add_versioned_ranges(
+    const byte_range *ranges, std::size_t num_ranges,
+    vector<byte_range> &chain) const {
+    const long long int begin_offset = row_offset(&table[0].sst_version_begin);
+    chain.push_back({row_offset(&table[0].sst_version_end), sizeof(uint64_t)});
+    for(std::size_t i = 0; i < num_ranges; ++i) {
+        // the versions come last in a row
+        long long int end =
+            std::min(ranges[i].offset + ranges[i].size, begin_offset);
+        if(end > ranges[i].offset) {
+            chain.push_back({ranges[i].offset, end - ranges[i].offset});
+        }
+    }
+    chain.push_back({begin_offset, sizeof(uint64_t)});
+}
+
+/**
+ * The versions of every row are read around the evaluation, so a change
+ * that lands in any row while the predicate runs is noticed and the
+ * predicate is evaluated again, up to MAX_VERSION_RETRIES times. Without
+ * the versioned_rows option, the predicate is evaluated once.
+ *
+ * @param pred The predicate to evaluate.
+ * @param value Set to the value of the predicate.
+ * @return False if rows kept changing and the predicate could not be
+ * evaluated; `value` is then meaningless.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::evaluate_stable(
+    const function<bool(const SST &)> &pred, bool &value) const {
+    if(!options.versioned_rows) {
+        value = pred(*this);
+        return true;
+    }
+    static thread_local vector<uint64_t> versions;
+    versions.resize(num_members);
+    for(int attempt = 0; attempt < MAX_VERSION_RETRIES; ++attempt) {
+        for(unsigned int index = 0; index < num_members; ++index) {
+            versions[index] =
+                read_version(table[index], index == member_index, true);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        value = pred(*this);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool stable = true;
+        for(unsigned int index = 0; index < num_members && stable; ++index) {
+            stable = read_version(table[index], index == member_index,
+                                  false) == versions[index];
+        }
+        if(stable) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * The remote table is registered as a whole, so the connection to a row's
+ * owner can reach any row of it. In Reads mode the connection already points
+ * at the owner's row; in Writes mode it points at the local node's row in
+ * the owner's table, and the target is found relative to that. If the
+ * operation does not complete within COMPLETION_TIMEOUT_MS, the row is
+ * frozen.
+ *
+ * @param index The index of the remote row to update.
+ * @param field_offset The offset of the 8-byte target within the row.
+ * @param op The operation to perform.
+ * @param compare_add The value to add, or the value to compare with.
+ * @param swap The value to store if the comparison succeeds.
+ * @param previous Set to the value the target held before the operation.
+ * @return False if the operation could not be performed.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::post_atomic(
+    uint32_t index, long long int field_offset, atomic_op op,
+    uint64_t compare_add, uint64_t swap, uint64_t &previous) {
+    assert(index < num_members);
+    if(index == member_index) {
+        std::cerr << "Atomic operations only apply to remote rows" << endl;
+        return false;
+    }
+    long long int offset = field_offset;
+    if(ImplMode == Mode::Writes) {
+        offset += ((long long int)index - member_index) * sizeof(table[0]);
+    }
+    std::lock_guard<std::mutex> atomic_lock(atomic_mutex);
+    {
+        std::lock_guard<std::mutex> lock(put_mutex);
+        if(row_is_frozen[index] || !res_vec[index]) {
+            return false;
+        }
+        if(!res_vec[index]->post_remote_atomic(
+               offset, op, compare_add, swap,
+               make_tag(atomic_owner, index))) {
+            std::cerr << "Could not post atomic operation on row " << index
+                 << "; the transport does not support it, or the field is "
+                    "not 8-byte aligned"
+                 << endl;
+            return false;
+        }
+    }
+    completion entry;
+    if(await_completions(atomic_owner, &entry, 1) == 0) {
+        cout << "Reporting failure on row " << index
+             << " even though it didn't fail directly" << endl;
+        freeze(index);
+        return false;
+    }
+    if(entry.result != 1) {
+        std::unique_lock<std::mutex> lock(freeze_mutex);
+        if(!row_is_frozen[index] && !fail_over(index)) {
+            cout << "Poll completion error in QP "
+                 << res_vec[index]->get_id() << ". Freezing row " << index
+                 << endl;
+            lock.unlock();
+            freeze(index);
+        }
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(put_mutex);
+    if(!res_vec[index]) {
+        return false;
+    }
+    previous = res_vec[index]->atomic_result;
+    return true;
+}
+
+/**
+ * The writes to all the receivers are handed to the transport in a single
+ * batch, and the bookkeeping buffers are reused across calls on the same
+ * thread, so a put does not allocate once the SST is warmed up.
+ *
+ * With the versioned_rows option, the ranges are written between the row's
+ * end version, first, and its begin version, last, and never include the
+ * versions otherwise; the row is not changed by update() while the writes
+ * are posted.
+ *
+ * @param receiver_ranks The indices of the rows to write to.
+ * @param ranges The ranges, within the Row structure, to write, sorted by
+ * offset and not overlapping.
+ * @param num_ranges The number of ranges in `ranges`.
+ * @param policy Which of the writes to signal; only those are waited for.
+ * @param with_versions Whether to write the versions with a versioned row.
+ * @return The token of the put.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+uint64_t SST<Row, ImplMode, NameEnum, RowExtras>::post_put(
+    const vector<uint32_t> &receiver_ranks, const byte_range *ranges,
+    std::size_t num_ranges, const signal_policy &policy,
+    bool with_versions) {
+    assert(ImplMode == Mode::Writes);
+    static thread_local vector<connection *> targets;
+    static thread_local vector<uint32_t> target_indices;
+    static thread_local vector<bool> signaled;
+    static thread_local vector<byte_range> chain;
+    // rows that failed over get the whole local row before anything else
+    if(resend_pending.load(std::memory_order_relaxed)) {
+        resend_failed_over_rows();
+    }
+    // notifications report the ranges asked for
+    const byte_range &last = ranges[num_ranges - 1];
+    uint32_t imm = encode_notification(
+        ranges[0].offset, last.offset + last.size - ranges[0].offset);
+    const bool versioned = options.versioned_rows && with_versions;
+    if(versioned) {
+        chain.clear();
+        add_versioned_ranges(ranges, num_ranges, chain);
+        ranges = chain.data();
+        num_ranges = chain.size();
+    }
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(COMPLETION_TIMEOUT_MS);
+    std::unique_lock<std::mutex> lock(put_mutex);
+    while(true) {
+        targets.clear();
+        target_indices.clear();
+        int out_of_credits = -1;
+        for(auto index : receiver_ranks) {
+            // don't write to yourself or a frozen row
+            if(index == member_index || row_is_frozen[index]) {
+                continue;
+            }
+            if(!has_put_credit(index, num_ranges)) {
+                out_of_credits = index;
+                break;
+            }
+            targets.push_back(res_vec[index].get());
+            target_indices.push_back(index);
+        }
+        if(out_of_credits < 0) {
+            break;
+        }
+        // wait for the row's oldest put to complete
+        lock.unlock();
+        if(reap_puts()) {
+            deadline = std::chrono::steady_clock::now() +
+                       std::chrono::milliseconds(COMPLETION_TIMEOUT_MS);
+        } else if(std::chrono::steady_clock::now() >= deadline) {
+            cout << "Reporting failure on row " << out_of_credits
+                 << " even though it didn't fail directly" << endl;
+            freeze(out_of_credits);
+        }
+        lock.lock();
+    }
+    // perform a remote write on the owner of each row
+    std::unique_lock<std::mutex> update_lock(update_mutex, std::defer_lock);
+    if(versioned) {
+        update_lock.lock();
+    }
+    uint32_t num_writes_posted = post_remote_writes(
+        targets.data(), targets.size(), ranges, num_ranges, policy, &signaled,
+        notifications_enabled ? &imm : nullptr);
+    if(versioned) {
+        update_lock.unlock();
+    }
+    long long int put_size = 0;
+    for(std::size_t i = 0; i < num_ranges; ++i) {
+        put_size += ranges[i].size;
+    }
+    put_bytes.fetch_add(put_size * targets.size(), std::memory_order_relaxed);
+    put_token token = next_put_token++;
+    put_writes_remaining.push_back(num_writes_posted);
+    put_num_ranges.push_back(num_ranges);
+    for(unsigned int i = 0; i < target_indices.size(); ++i) {
+        if(signaled[i]) {
+            row_pending_puts[target_indices[i]].push_back(token);
+            row_pending_ranges[target_indices[i]] += num_ranges;
+        }
     }
+    num_pending_put_writes += num_writes_posted;
+    // a put with no signaled writes is already complete
+    while(!put_writes_remaining.empty() && put_writes_remaining.front() == 0) {
+        put_writes_remaining.pop_front();
+        put_num_ranges.pop_front();
+        ++first_pending_put;
+    }
+    return token;
+}
+
+/**
+ * Ranges of no bytes are dropped; if none is left, the result is a single
+ * empty range, which still makes a put that completes.
+ *
+ * @param ranges The ranges of a put, in any order.
+ * @param merged Set to the ranges to write, sorted by offset, with no two
+ * overlapping or adjacent, and at most MAX_PUT_RANGES of them.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::merge_ranges(
+    const vector<byte_range> &ranges, vector<byte_range> &merged) {
+    merged.clear();
+    for(const auto &range : ranges) {
+        if(range.size > 0) {
+            merged.push_back(range);
+        }
+    }
+    if(merged.empty()) {
+        merged.push_back({0, 0});
+        return;
+    }
+    std::sort(merged.begin(), merged.end(),
+              [](const byte_range &a, const byte_range &b) {
+                  return a.offset < b.offset;
+              });
+    std::size_t num_merged = 1;
+    for(std::size_t i = 1; i < merged.size(); ++i) {
+        byte_range &back = merged[num_merged - 1];
+        if(merged[i].offset <= back.offset + back.size) {
+            back.size = std::max(back.offset + back.size,
+                                 merged[i].offset + merged[i].size) -
+                        back.offset;
+        } else {
+            merged[num_merged++] = merged[i];
+        }
+    }
+    merged.resize(num_merged);
+    // fill the smallest gaps until few enough ranges are left
+    while(merged.size() > MAX_PUT_RANGES) {
+        std::size_t closest = 0;
+        long long int smallest_gap = -1;
+        for(std::size_t i = 0; i + 1 < merged.size(); ++i) {
+            long long int gap =
+                merged[i + 1].offset - (merged[i].offset + merged[i].size);
+            if(smallest_gap < 0 || gap < smallest_gap) {
+                smallest_gap = gap;
+                closest = i;
+            }
+        }
+        merged[closest].size = merged[closest + 1].offset +
+                               merged[closest + 1].size -
+                               merged[closest].offset;
+        merged.erase(merged.begin() + closest + 1);
+    }
+}
+
+/**
+ * A connection completes its writes in order, so the completion belongs to
+ * the oldest put with an outstanding write to the row. This must be called
+ * with put_mutex held.
+ *
+ * @param index The row whose write completed.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::complete_put_write(
+    uint32_t index) {
+    if(row_pending_puts[index].empty()) {
+        // a late completion for a write that was already abandoned
+        return;
+    }
+    uint64_t token = row_pending_puts[index].front();
+    row_pending_puts[index].pop_front();
+    row_pending_ranges[index] -= put_num_ranges[token - first_pending_put];
+    --put_writes_remaining[token - first_pending_put];
+    --num_pending_put_writes;
+    while(!put_writes_remaining.empty() && put_writes_remaining.front() == 0) {
+        put_writes_remaining.pop_front();
+        put_num_ranges.pop_front();
+        ++first_pending_put;
+    }
+}
+
+/**
+ * This is used when a row freezes or its connection fails over, so that puts
+ * waiting on it can complete. This must be called with put_mutex held.
+ *
+ * @param index The row whose outstanding writes to drop.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+void SST<Row, ImplMode, NameEnum, RowExtras>::abandon_put_writes(
+    uint32_t index) {
+    while(!row_pending_puts[index].empty()) {
+        complete_put_write(index);
+    }
+}
+
+/**
+ * Each range of a put holds a slot in the connection's send queue until
+ * the put completes, so a row runs out of credit either when it has
+ * `put_credits` puts outstanding or when the ranges of its outstanding puts
+ * would exceed `write_credits`. A row with nothing outstanding takes any
+ * put.
+ *
+ * @param index The row to write to.
+ * @param num_ranges The number of ranges of the put.
+ * @return True if the put can be posted to the row now.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::has_put_credit(
+    uint32_t index, std::size_t num_ranges) const {
+    if(row_pending_puts[index].empty()) {
+        return true;
+    }
+    return row_pending_puts[index].size() < put_credits &&
+           row_pending_ranges[index] + num_ranges <= write_credits;
+}
+
+/**
+ * @param token The token of a put.
+ * @return True if the put has no outstanding writes.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::put_done(uint64_t token) const {
+    return token < first_pending_put ||
+           put_writes_remaining[token - first_pending_put] == 0;
 }
 
 // SST_Snapshot implementation
@@ -563,30 +2540,48 @@ void SST<Row, ImplMode, NameEnum, RowExtras>::put(
 /**
  * @param _table A reference to the SST's current internal state table
  * @param _num_members The number of members (rows) in the SST
- * @param _named_functions A reference to the SST's list of named functions
+ * @param _policy Where to place the copy of the table in memory
+ * @param versioned Whether to check the versions of each row as it is
+ * copied, and copy it again if a change landed in it, up to
+ * MAX_VERSION_RETRIES times
+ * @param local_index The index of the local row, whose versions change in
+ * the opposite order to the others
  */
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 SST<Row, ImplMode, NameEnum, RowExtras>::SST_Snapshot::SST_Snapshot(
-    const unique_ptr<volatile InternalRow[]> &_table, int _num_members)
-    : num_members(_num_members), table(new InternalRow[num_members]) {
-    std::memcpy(const_cast<InternalRow *>(table.get()),
-                const_cast<const InternalRow *>(_table.get()),
-                num_members * sizeof(InternalRow));
+    const unique_ptr<volatile InternalRow[], table_deleter> &_table,
+    int _num_members, const memory_policy &_policy, bool versioned,
+    int local_index)
+    : num_members(_num_members),
+      table(static_cast<const InternalRow *>(allocate_local_memory(
+                num_members * sizeof(InternalRow), _policy)),
+            local_memory_deleter()) {
+    InternalRow *rows = const_cast<InternalRow *>(table.get());
+    for(int index = 0; index < num_members; ++index) {
+        copy_row(_table[index], rows[index], versioned, index == local_index);
+    }
 }
 
+/**
+ * @param rows The copy of the table, which must not change while the
+ * snapshot refers to it.
+ * @param _num_members The number of rows in the copy.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+SST<Row, ImplMode, NameEnum, RowExtras>::SST_Snapshot::SST_Snapshot(
+    std::shared_ptr<const InternalRow> rows, int _num_members)
+    : num_members(_num_members), table(std::move(rows)) {}
+
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 SST<Row, ImplMode, NameEnum, RowExtras>::SST_Snapshot::SST_Snapshot(
     const SST_Snapshot &to_copy)
-    : num_members(to_copy.num_members), table(new InternalRow[num_members]) {
-    std::memcpy(table.get(), to_copy.table.get(),
-                num_members * sizeof(InternalRow));
-}
+    : num_members(to_copy.num_members), table(to_copy.table) {}
 
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
 const typename SST<Row, ImplMode, NameEnum, RowExtras>::InternalRow &
 SST<Row, ImplMode, NameEnum, RowExtras>::SST_Snapshot::get(int index) const {
     assert(index >= 0 && index < num_members);
-    return table[index];
+    return table.get()[index];
 }
 
 template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
@@ -596,6 +2591,21 @@ const typename SST<Row, ImplMode, NameEnum, RowExtras>::InternalRow &
     return get(index);
 }
 
+/**
+ * A row copied without versions checked, because the SST does not have the
+ * versioned_rows option, is reported consistent if its versions happen to
+ * match, which they do unless another member uses the option.
+ *
+ * @param index The index of a row of the snapshot.
+ * @return False if changes kept landing in the row while it was copied, so
+ * the copy may be part old and part new.
+ */
+template <class Row, Mode ImplMode, typename NameEnum, typename RowExtras>
+bool SST<Row, ImplMode, NameEnum, RowExtras>::SST_Snapshot::is_consistent(
+    int index) const {
+    return get(index).sst_version_begin == get(index).sst_version_end;
+}
+
 } /* namespace sst */
 
 #endif /* SST_H */
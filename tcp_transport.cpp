@@ -0,0 +1,789 @@
+/**
+ * @file tcp_transport.cpp
+ * Contains the implementation of the TCP socket adapter layer of %SST.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "tcp_transport.h"
+#include "../connection_manager.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::map;
+using std::string;
+
+namespace sst {
+
+/** Kinds of messages sent between tcp_resources. */
+enum : uint8_t {
+    /** A write, followed by the bytes to write. */
+    TCP_WRITE = 1,
+    /** The last write of a batch, which the receiver acknowledges once it
+     * has applied the whole batch. */
+    TCP_WRITE_SYNC,
+    /** The acknowledgement of a batch of writes. */
+    TCP_WRITE_ACK,
+    /** A request to read from the receiver's buffer. */
+    TCP_READ_REQUEST,
+    /** The answer to a read request, followed by the bytes read. */
+    TCP_READ_RESPONSE,
+    /** A request to apply an atomic operation, given in the size field, to
+     * the receiver's buffer, followed by its arguments. */
+    TCP_ATOMIC_REQUEST,
+    /** The answer to an atomic request, followed by the value it replaced. */
+    TCP_ATOMIC_RESPONSE,
+    /** A notification, with its value in the offset field, sent after the
+     * writes it reports; it is not answered. */
+    TCP_NOTIFY
+};
+
+/** Header preceding every message; fields are in network byte order. */
+struct tcp_msg_header {
+    uint8_t op;
+    uint64_t offset;
+    uint64_t size;
+} __attribute__((packed));
+
+/** Arguments of an atomic request; fields are in network byte order. */
+struct tcp_atomic_args {
+    uint64_t compare_add;
+    uint64_t swap;
+} __attribute__((packed));
+
+/** IP addresses of all the nodes, keyed by node rank. */
+static map<uint32_t, string> node_addrs;
+/** Node rank of the local node. */
+static uint32_t local_rank;
+/** Used to give each connection a unique id. */
+static std::atomic<uint32_t> connection_counter{0};
+/** Connections that have operations waiting to be sent. */
+static std::vector<tcp_resources *> dirty_connections;
+/** Protects `dirty_connections` and the pending operations of every
+ * connection. */
+static std::mutex dirty_mutex;
+/** Keeps connections alive while they are being flushed. */
+static std::mutex flush_mutex;
+/** Notifications received on every connection, which any thread may poll
+ * for, unlike the completions of operations. */
+static tcp_completion_queue notifications;
+/** The tables passed to tcp_register_memory(), by address, with their
+ * sizes. */
+static map<char *, std::size_t> tables;
+/** Protects `tables`. */
+static std::mutex tables_mutex;
+
+/** The completion queue of each owner of tags, created on first use. */
+static std::unordered_map<uint32_t, std::shared_ptr<tcp_completion_queue>>
+    owner_queues;
+/** Protects `owner_queues`. */
+static std::mutex owner_queues_mutex;
+
+/**
+ * Any thread may poll for the completions of an owner, such as the detect
+ * thread reaping the puts of an application thread, so completions are
+ * kept by owner rather than by the thread that posted the operation.
+ *
+ * @param tag The tag of an operation.
+ * @return The completion queue of the owner of the tag.
+ */
+static std::shared_ptr<tcp_completion_queue> owner_completions(uint64_t tag) {
+    std::lock_guard<std::mutex> lock(owner_queues_mutex);
+    auto &queue = owner_queues[tag_owner(tag)];
+    if(!queue) {
+        queue = std::make_shared<tcp_completion_queue>();
+    }
+    return queue;
+}
+
+/** Adds a completion to a queue and wakes its pollers. */
+static void complete(const std::shared_ptr<tcp_completion_queue> &queue,
+                     uint64_t tag, int result) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->entries.push_back({tag, result});
+    queue->cv.notify_all();
+}
+
+/**
+ * @param offset The offset of a range in a buffer, as sent by a remote node.
+ * @param size The size of the range.
+ * @param limit The size of the buffer.
+ * @return Whether the range lies within the buffer.
+ */
+static bool in_bounds(long long int offset, long long int size,
+                      std::size_t limit) {
+    return offset >= 0 && size >= 0 && (unsigned long long)offset <= limit &&
+           (unsigned long long)size <= limit - offset;
+}
+
+static bool recv_all(int sock, char *buf, std::size_t size) {
+    while(size > 0) {
+        ssize_t n = recv(sock, buf, size, 0);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+/** Sends every buffer in `iov`, in as few system calls as possible. */
+static bool send_all(int sock, std::vector<struct iovec> &iov) {
+    std::size_t first = 0;
+    while(first < iov.size()) {
+        int count = std::min<std::size_t>(iov.size() - first, IOV_MAX);
+        ssize_t n = writev(sock, &iov[first], count);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        // skip the buffers that were sent completely
+        while(first < iov.size() && (std::size_t)n >= iov[first].iov_len) {
+            n -= iov[first].iov_len;
+            ++first;
+        }
+        if(n > 0) {
+            iov[first].iov_base = (char *)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    return true;
+}
+
+/**
+ * Initializes the connection and starts its receiver thread.
+ *
+ * @param r_index The node rank of the remote node to connect to.
+ * @param write_addr A pointer to the memory the remote node writes into and
+ * reads from.
+ * @param read_addr A pointer to the memory that local writes are sent from
+ * and remote reads arrive in.
+ * @param size_w The size of the write buffer (in bytes).
+ * @param size_r The size of the read buffer (in bytes).
+ */
+tcp_resources::tcp_resources(int r_index, char *write_addr, char *read_addr,
+                             int size_w, int size_r)
+    : notify_tag(0),
+      notifications_enabled(false),
+      broken(false),
+      write_size(size_w),
+      read_size(size_r),
+      atomic_base(write_addr),
+      atomic_size(size_w),
+      id(connection_counter++),
+      sock(-1),
+      write_buf(write_addr),
+      read_buf(read_addr) {
+    remote_index = r_index;
+    {
+        // atomic requests may target any row of the table
+        std::lock_guard<std::mutex> lock(tables_mutex);
+        auto table = tables.upper_bound(write_buf);
+        if(table != tables.begin() &&
+           write_buf < (--table)->first + table->second) {
+            atomic_base = table->first;
+            atomic_size = table->second;
+        }
+    }
+    connect_socket();
+    if(sock < 0) {
+        broken = true;
+        return;
+    }
+    receiver = std::thread(&tcp_resources::receive, this);
+    replier = std::thread(&tcp_resources::send_replies, this);
+    cout << "Established TCP connection with node " << r_index << endl;
+}
+
+tcp_resources::~tcp_resources() {
+    {
+        std::lock_guard<std::mutex> flush_lock(flush_mutex);
+        std::lock_guard<std::mutex> lock(dirty_mutex);
+        dirty_connections.erase(std::remove(dirty_connections.begin(),
+                                            dirty_connections.end(), this),
+                                dirty_connections.end());
+    }
+    if(sock >= 0) {
+        shutdown(sock, SHUT_RDWR);
+    }
+    if(receiver.joinable()) {
+        receiver.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(replies_mutex);
+        stopping = true;
+    }
+    replies_cv.notify_one();
+    if(replier.joinable()) {
+        replier.join();
+    }
+    if(sock >= 0) {
+        close(sock);
+    }
+}
+
+/**
+ * Both nodes listen on an ephemeral port and exchange it over the bootstrap
+ * connection; the node with the lower rank accepts and the other connects.
+ */
+void tcp_resources::connect_socket() {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if(listener < 0 || bind(listener, (struct sockaddr *)&addr, addr_len) ||
+       listen(listener, 1) ||
+       getsockname(listener, (struct sockaddr *)&addr, &addr_len)) {
+        cerr << "Could not listen for TCP connection, error code is " << errno
+             << endl;
+    }
+
+    struct tcp_con_data_t local_con_data;
+    struct tcp_con_data_t remote_con_data;
+    local_con_data.port = addr.sin_port;
+    bool success = sst_connections->exchange(remote_index, local_con_data,
+                                             remote_con_data);
+    if(!success) {
+        cerr << "Could not exchange port in connect_socket" << endl;
+        close(listener);
+        return;
+    }
+
+    if(local_rank < (uint32_t)remote_index) {
+        sock = accept(listener, NULL, NULL);
+    } else {
+        struct addrinfo hints;
+        struct addrinfo *result = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        string port_str = std::to_string(ntohs(remote_con_data.port));
+        if(getaddrinfo(node_addrs[remote_index].c_str(), port_str.c_str(),
+                       &hints, &result) == 0) {
+            sock = socket(AF_INET, SOCK_STREAM, 0);
+            if(connect(sock, result->ai_addr, result->ai_addrlen)) {
+                close(sock);
+                sock = -1;
+            }
+            freeaddrinfo(result);
+        }
+    }
+    close(listener);
+    if(sock < 0) {
+        cerr << "Could not connect TCP socket to node " << remote_index
+             << ", error code is " << errno << endl;
+        return;
+    }
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+/**
+ * @details
+ * The offsets and sizes that the remote node sends are checked against the
+ * buffers, and a message that falls outside them fails the connection.
+ */
+void tcp_resources::receive() {
+    struct tcp_msg_header header;
+    while(recv_all(sock, (char *)&header, sizeof(header))) {
+        long long int offset = be64toh(header.offset);
+        long long int size = be64toh(header.size);
+        if(header.op == TCP_WRITE || header.op == TCP_WRITE_SYNC) {
+            if(!in_bounds(offset, size, write_size)) {
+                cerr << "Write out of bounds from node " << remote_index
+                     << endl;
+                break;
+            }
+            if(!recv_all(sock, write_buf + offset, size)) break;
+            std::atomic_thread_fence(std::memory_order_release);
+            if(header.op == TCP_WRITE_SYNC) {
+                queue_reply({TCP_WRITE_ACK, 0, 0, 0});
+            }
+        } else if(header.op == TCP_WRITE_ACK) {
+            if(!complete_outstanding()) break;
+        } else if(header.op == TCP_READ_REQUEST) {
+            if(!in_bounds(offset, size, write_size)) {
+                cerr << "Read out of bounds from node " << remote_index
+                     << endl;
+                break;
+            }
+            queue_reply({TCP_READ_RESPONSE, offset, size, 0});
+        } else if(header.op == TCP_READ_RESPONSE) {
+            if(!in_bounds(offset, size, read_size)) {
+                cerr << "Read response out of bounds from node "
+                     << remote_index << endl;
+                break;
+            }
+            if(!recv_all(sock, read_buf + offset, size)) break;
+            if(!complete_outstanding()) break;
+        } else if(header.op == TCP_ATOMIC_REQUEST) {
+            struct tcp_atomic_args args;
+            if(!recv_all(sock, (char *)&args, sizeof(args))) break;
+            const long long int table_offset =
+                offset + (write_buf - atomic_base);
+            if(!in_bounds(table_offset, sizeof(uint64_t), atomic_size) ||
+               (uintptr_t)(atomic_base + table_offset) % sizeof(uint64_t)) {
+                cerr << "Atomic request out of bounds from node "
+                     << remote_index << endl;
+                break;
+            }
+            uint64_t *word =
+                reinterpret_cast<uint64_t *>(atomic_base + table_offset);
+            uint64_t old_value = be64toh(args.compare_add);
+            if((atomic_op)size == atomic_op::fetch_add) {
+                old_value =
+                    __atomic_fetch_add(word, old_value, __ATOMIC_SEQ_CST);
+            } else {
+                __atomic_compare_exchange_n(word, &old_value,
+                                            be64toh(args.swap), false,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            }
+            queue_reply({TCP_ATOMIC_RESPONSE, 0, 0, old_value});
+        } else if(header.op == TCP_NOTIFY) {
+            if(notifications_enabled) {
+                std::lock_guard<std::mutex> lock(notifications.mutex);
+                notifications.entries.push_back(
+                    {notify_tag, 1, (uint32_t)offset});
+            }
+        } else if(header.op == TCP_ATOMIC_RESPONSE) {
+            uint64_t old_value;
+            if(!recv_all(sock, (char *)&old_value, sizeof(old_value))) break;
+            atomic_result = be64toh(old_value);
+            if(!complete_outstanding()) break;
+        } else {
+            cerr << "Unknown message type " << (int)header.op
+                 << " from node " << remote_index << endl;
+            break;
+        }
+    }
+    // the remote node sees the failure too
+    shutdown(sock, SHUT_RDWR);
+    fail();
+}
+
+/**
+ * @param answer The answer to send.
+ */
+void tcp_resources::queue_reply(const reply &answer) {
+    {
+        std::lock_guard<std::mutex> lock(replies_mutex);
+        replies.push_back(answer);
+    }
+    replies_cv.notify_one();
+}
+
+/**
+ * The answers are sent in the order they were queued, as many at a time as
+ * have been queued. Only this thread blocks on them, so `receiver` keeps
+ * draining the socket even when both nodes are sending large reads.
+ */
+void tcp_resources::send_replies() {
+    std::vector<reply> batch;
+    std::vector<struct tcp_msg_header> headers;
+    std::vector<struct iovec> iov;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(replies_mutex);
+            replies_cv.wait(lock,
+                            [&]() { return stopping || !replies.empty(); });
+            if(stopping) {
+                return;
+            }
+            batch.assign(replies.begin(), replies.end());
+            replies.clear();
+        }
+        headers.resize(batch.size());
+        iov.clear();
+        for(std::size_t i = 0; i < batch.size(); ++i) {
+            headers[i] = {batch[i].op, htobe64(batch[i].offset),
+                          htobe64(batch[i].size)};
+            iov.push_back({&headers[i], sizeof(headers[i])});
+            if(batch[i].op == TCP_READ_RESPONSE) {
+                iov.push_back(
+                    {write_buf + batch[i].offset, (size_t)batch[i].size});
+            } else if(batch[i].op == TCP_ATOMIC_RESPONSE) {
+                batch[i].old_value = htobe64(batch[i].old_value);
+                iov.push_back(
+                    {&batch[i].old_value, sizeof(batch[i].old_value)});
+            }
+        }
+        std::lock_guard<std::mutex> lock(send_mutex);
+        if(!send_all(sock, iov)) {
+            shutdown(sock, SHUT_RDWR);
+            return;
+        }
+    }
+}
+
+/**
+ * @return False if the remote node answered an operation that was never
+ * sent, which means the connection is out of step.
+ */
+bool tcp_resources::complete_outstanding() {
+    outstanding_op op;
+    {
+        std::lock_guard<std::mutex> lock(outstanding_mutex);
+        if(outstanding.empty()) {
+            return false;
+        }
+        op = outstanding.front();
+        outstanding.pop_front();
+    }
+    for(const auto &queue : op.queues) {
+        complete(queue, op.tag, 1);
+    }
+    return true;
+}
+
+void tcp_resources::fail() {
+    std::lock_guard<std::mutex> lock(outstanding_mutex);
+    broken = true;
+    for(auto &op : outstanding) {
+        for(const auto &queue : op.queues) {
+            complete(queue, op.tag, -1);
+        }
+    }
+    outstanding.clear();
+}
+
+/**
+ * @param offset The offset, in bytes, of the remote buffer at which to start
+ * reading.
+ * @param size The number of bytes to read.
+ */
+void tcp_resources::post_remote_read(long long int offset,
+                                     long long int size) {
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    if(pending_writes.empty() && pending_reads.empty() &&
+       pending_atomics.empty()) {
+        dirty_connections.push_back(this);
+    }
+    pending_reads.push_back({offset, size, owner_completions(tag)});
+}
+
+/**
+ * @param offset The offset, in bytes, of the remote buffer at which to start
+ * writing.
+ * @param size The number of bytes to write.
+ */
+void tcp_resources::post_remote_write(long long int offset,
+                                      long long int size) {
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    if(pending_writes.empty() && pending_reads.empty() &&
+       pending_atomics.empty()) {
+        dirty_connections.push_back(this);
+    }
+    pending_writes.push_back({offset, size, nullptr});
+    pending_write_queues.push_back(owner_completions(tag));
+}
+
+/**
+ * @param offset The offset, in bytes, of the remote buffer at which to start
+ * writing.
+ * @param size The number of bytes to write.
+ * @param imm The value the remote node is notified with.
+ */
+void tcp_resources::post_remote_write_with_imm(long long int offset,
+                                               long long int size,
+                                               uint32_t imm) {
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    if(pending_writes.empty() && pending_reads.empty() &&
+       pending_atomics.empty()) {
+        dirty_connections.push_back(this);
+    }
+    pending_writes.push_back({offset, size, nullptr});
+    pending_write_queues.push_back(owner_completions(tag));
+    pending_notifications.push_back(imm);
+}
+
+/**
+ * The writes go out in the same batch, so they complete together.
+ *
+ * @param ranges The ranges of the remote buffer to write.
+ * @param num_ranges The number of ranges in `ranges`.
+ * @param imm If not null, the value the remote node is notified with.
+ */
+void tcp_resources::post_remote_write_ranges(const byte_range *ranges,
+                                             std::size_t num_ranges,
+                                             const uint32_t *imm) {
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    if(pending_writes.empty() && pending_reads.empty() &&
+       pending_atomics.empty()) {
+        dirty_connections.push_back(this);
+    }
+    for(std::size_t i = 0; i < num_ranges; ++i) {
+        pending_writes.push_back({ranges[i].offset, ranges[i].size, nullptr});
+    }
+    pending_write_queues.push_back(owner_completions(tag));
+    if(imm) {
+        pending_notifications.push_back(*imm);
+    }
+}
+
+/**
+ * Notifications are sent in the same stream as writes, so the remote node
+ * receives each one after the data it reports. Nothing needs to be posted to
+ * receive them.
+ *
+ * @param _notify_tag The tag to report notifications with.
+ * @return True.
+ */
+bool tcp_resources::enable_notifications(uint64_t _notify_tag) {
+    notify_tag = _notify_tag;
+    notifications_enabled = true;
+    return true;
+}
+
+/**
+ * @details
+ * The remote node applies the operation to its own memory, so the target
+ * may lie outside the remote buffer, in another row of the remote table.
+ *
+ * @param offset The offset, in bytes, of the remote buffer at which the
+ * 8-byte target lies.
+ * @param op The operation to perform.
+ * @param compare_add The value to add, or the value to compare with.
+ * @param swap The value to store if the comparison succeeds.
+ * @param atomic_tag The tag to report the completion with.
+ * @return False if the target is not 8-byte aligned, which the remote node
+ * would find out too late.
+ */
+bool tcp_resources::post_remote_atomic(long long int offset, atomic_op op,
+                                       uint64_t compare_add, uint64_t swap,
+                                       uint64_t atomic_tag) {
+    // the remote buffer has the same alignment as the local one
+    if((uintptr_t)(write_buf + offset) % sizeof(uint64_t) != 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    if(pending_writes.empty() && pending_reads.empty() &&
+       pending_atomics.empty()) {
+        dirty_connections.push_back(this);
+    }
+    pending_atomics.push_back({offset, op, compare_add, swap, atomic_tag,
+                               owner_completions(atomic_tag)});
+    return true;
+}
+
+/**
+ * @details
+ * The contents of each write are taken from the local buffer at the time of
+ * the flush, so writes to overlapping or adjacent ranges are merged into one
+ * message. Each posted operation still produces its own completion, which
+ * goes to the queue of the owner of its tag, whichever thread flushes it.
+ * As with an RDMA write, a write only completes once the remote node has
+ * applied it.
+ */
+void tcp_resources::flush() {
+    std::vector<pending_op> writes, reads;
+    std::vector<std::shared_ptr<tcp_completion_queue>> write_queues;
+    std::vector<pending_atomic> atomics;
+    std::vector<uint32_t> notifies;
+    {
+        std::lock_guard<std::mutex> lock(dirty_mutex);
+        writes.swap(pending_writes);
+        write_queues.swap(pending_write_queues);
+        reads.swap(pending_reads);
+        atomics.swap(pending_atomics);
+        notifies.swap(pending_notifications);
+    }
+    if(writes.empty() && reads.empty() && atomics.empty()) {
+        return;
+    }
+
+    std::sort(writes.begin(), writes.end(),
+              [](const pending_op &a, const pending_op &b) {
+                  return a.offset < b.offset;
+              });
+    std::vector<pending_op> merged;
+    for(const auto &op : writes) {
+        if(!merged.empty() &&
+           op.offset <= merged.back().offset + merged.back().size) {
+            merged.back().size =
+                std::max(merged.back().size, op.offset + op.size -
+                                                 merged.back().offset);
+        } else {
+            merged.push_back(op);
+        }
+    }
+
+    std::vector<struct tcp_msg_header> headers(merged.size() + reads.size() +
+                                               atomics.size());
+    std::vector<struct tcp_msg_header> notify_headers(notifies.size());
+    std::vector<struct tcp_atomic_args> atomic_args(atomics.size());
+    std::vector<struct iovec> iov;
+    iov.reserve(2 * merged.size() + notifies.size() + reads.size() +
+                2 * atomics.size());
+    for(std::size_t i = 0; i < merged.size(); ++i) {
+        uint8_t op = i + 1 == merged.size() ? TCP_WRITE_SYNC : TCP_WRITE;
+        headers[i] = {op, htobe64(merged[i].offset), htobe64(merged[i].size)};
+        iov.push_back({&headers[i], sizeof(headers[i])});
+        iov.push_back({read_buf + merged[i].offset, (size_t)merged[i].size});
+    }
+    // notifications follow all the writes, since merging may reorder them
+    for(std::size_t i = 0; i < notifies.size(); ++i) {
+        notify_headers[i] = {TCP_NOTIFY, htobe64(notifies[i]), 0};
+        iov.push_back({&notify_headers[i], sizeof(notify_headers[i])});
+    }
+    for(std::size_t i = 0; i < reads.size(); ++i) {
+        auto &header = headers[merged.size() + i];
+        header = {TCP_READ_REQUEST, htobe64(reads[i].offset),
+                  htobe64(reads[i].size)};
+        iov.push_back({&header, sizeof(header)});
+    }
+    for(std::size_t i = 0; i < atomics.size(); ++i) {
+        auto &header = headers[merged.size() + reads.size() + i];
+        header = {TCP_ATOMIC_REQUEST, htobe64(atomics[i].offset),
+                  htobe64((uint64_t)atomics[i].op)};
+        atomic_args[i] = {htobe64(atomics[i].compare_add),
+                          htobe64(atomics[i].swap)};
+        iov.push_back({&header, sizeof(header)});
+        iov.push_back({&atomic_args[i], sizeof(atomic_args[i])});
+    }
+
+    bool success;
+    {
+        // register the waiters before the answers can arrive; the remote
+        // node answers in the order the messages are sent
+        std::lock_guard<std::mutex> lock(outstanding_mutex);
+        success = !broken;
+        if(success) {
+            if(!write_queues.empty()) {
+                outstanding.push_back({std::move(write_queues), tag});
+            }
+            for(const auto &read : reads) {
+                outstanding.push_back({{read.queue}, tag});
+            }
+            for(const auto &atomic : atomics) {
+                outstanding.push_back({{atomic.queue}, atomic.tag});
+            }
+        }
+    }
+    if(!success) {
+        for(const auto &queue : write_queues) {
+            complete(queue, tag, -1);
+        }
+        for(const auto &read : reads) {
+            complete(read.queue, tag, -1);
+        }
+        for(const auto &atomic : atomics) {
+            complete(atomic.queue, atomic.tag, -1);
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> lock(send_mutex);
+    if(!send_all(sock, iov)) {
+        shutdown(sock, SHUT_RDWR);
+    }
+}
+
+/**
+ * @details
+ * Atomic operations apply to any row of the remote table, so the receiver
+ * of an atomic request checks it against the registered table that the
+ * connection's buffer lies in.
+ *
+ * @param addr The start of the table.
+ * @param size The size of the table, in bytes.
+ */
+void tcp_register_memory(void *addr, std::size_t size) {
+    std::lock_guard<std::mutex> lock(tables_mutex);
+    tables[(char *)addr] = size;
+}
+
+void tcp_deregister_memory(void *addr) {
+    std::lock_guard<std::mutex> lock(tables_mutex);
+    tables.erase((char *)addr);
+}
+
+/**
+ * @details
+ * This must be called before creating or using any SST instance that
+ * connects over TCP.
+ */
+void tcp_transport_initialize(const map<uint32_t, string> &ip_addrs,
+                              uint32_t node_rank) {
+    connections_initialize(ip_addrs, node_rank, Transport::TCP);
+    node_addrs = ip_addrs;
+    local_rank = node_rank;
+    cout << "Initialized TCP transport" << endl;
+}
+
+/**
+ * @details
+ * This first sends the operations that every connection has queued, then
+ * blocks until an operation on a connection of `owner` completes, whichever
+ * thread posted it, or a timeout is reached. Notifications tagged with
+ * `owner` are likewise returned to whichever thread polls for them.
+ * @param owner The owner part of the tags of the connections to poll.
+ * @param entries The array to store the completions in.
+ * @param max_entries The maximum number of completions to return.
+ * @param block Whether to wait for a completion; if false, only the
+ * completions that have arrived are returned.
+ * @return The number of completions stored in `entries`, or 0 if none was
+ * found before the timeout.
+ */
+int tcp_poll_completions(uint32_t owner, completion *entries, int max_entries,
+                         bool block) {
+    {
+        std::lock_guard<std::mutex> flush_lock(flush_mutex);
+        std::vector<tcp_resources *> to_flush;
+        {
+            std::lock_guard<std::mutex> lock(dirty_mutex);
+            to_flush.swap(dirty_connections);
+        }
+        for(auto connection : to_flush) {
+            connection->flush();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(notifications.mutex);
+        int num_notifications = take_completions(notifications.entries, owner,
+                                                 entries, max_entries);
+        if(num_notifications > 0) {
+            return num_notifications;
+        }
+    }
+
+    auto queue = owner_completions(make_tag(owner, 0));
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    int num_polled = 0;
+    if(!block) {
+        return take_completions(queue->entries, owner, entries, max_entries);
+    }
+    if(!queue->cv.wait_for(
+           lock, std::chrono::milliseconds(COMPLETION_TIMEOUT_MS), [&]() {
+               num_polled = take_completions(queue->entries, owner, entries,
+                                             max_entries);
+               return num_polled > 0;
+           })) {
+        cerr << "Completion wasn't found after timeout" << endl;
+        return 0;
+    }
+    return num_polled;
+}
+
+}  // namespace sst
@@ -0,0 +1,200 @@
+#ifndef TCP_TRANSPORT_H
+#define TCP_TRANSPORT_H
+
+/**
+ * @file tcp_transport.h
+ * Contains declarations needed for carrying %SST traffic over ordinary TCP
+ * sockets, for nodes that have no RDMA device.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transport.h"
+
+namespace sst {
+
+/** Structure to exchange the data needed to connect the sockets. */
+struct tcp_con_data_t {
+    /** Port the node is listening on for this connection. */
+    uint16_t port;
+} __attribute__((packed));
+
+/** Completions of the operations of a single owner of tags. */
+struct tcp_completion_queue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    /** The completed operations, oldest first. */
+    std::deque<completion> entries;
+};
+
+/**
+ * Represents a connection to a single remote node over a TCP socket. Writes,
+ * read requests and atomic requests are queued when posted and sent per
+ * peer in a single writev() when a thread polls for completions;
+ * overlapping and adjacent writes are coalesced. A receiver thread applies
+ * incoming writes and atomic requests, completes the operations that the
+ * remote node has answered, and queues the answers to incoming messages for
+ * a replier thread, so that it never stops reading while a send blocks.
+ */
+class tcp_resources : public connection {
+private:
+    /** A posted operation that has not been sent yet. */
+    struct pending_op {
+        long long int offset;
+        long long int size;
+        /** Queue of the owner of a read, which waits for the answer
+         * whoever flushes the request; writes keep theirs in
+         * `pending_write_queues`, since they are merged. */
+        std::shared_ptr<tcp_completion_queue> queue;
+    };
+    /** A posted atomic operation that has not been sent yet. */
+    struct pending_atomic {
+        long long int offset;
+        atomic_op op;
+        uint64_t compare_add;
+        uint64_t swap;
+        uint64_t tag;
+        /** Queue of the owner of `tag`, which waits for the answer whoever
+         * flushes the request. */
+        std::shared_ptr<tcp_completion_queue> queue;
+    };
+    /** A sent message that the remote node has yet to answer. */
+    struct outstanding_op {
+        /** Queues of the owners of the operations the answer completes,
+         * one for each completion it releases. */
+        std::vector<std::shared_ptr<tcp_completion_queue>> queues;
+        /** Tag to report the completions with. */
+        uint64_t tag;
+    };
+    /** Connects the socket to the remote node. */
+    void connect_socket();
+    /** Runs in `receiver` to handle messages from the remote node. */
+    void receive();
+    /** Completes the oldest outstanding message. */
+    bool complete_outstanding();
+    /** Marks the connection broken and fails all outstanding messages. */
+    void fail();
+    /** An answer to a message from the remote node, waiting to be sent. */
+    struct reply {
+        uint8_t op;
+        long long int offset;
+        long long int size;
+        /** The value an atomic request replaced. */
+        uint64_t old_value;
+    };
+    /** Queues an answer for `replier`. */
+    void queue_reply(const reply &answer);
+    /** Runs in `replier` to send the answers queued by `receiver`. */
+    void send_replies();
+
+    /** Writes posted since the last flush. */
+    std::vector<pending_op> pending_writes;
+    /** Queues of the owners of `pending_writes`, one for each completion
+     * they produce; the writes of several ranges posted together produce
+     * one. */
+    std::vector<std::shared_ptr<tcp_completion_queue>> pending_write_queues;
+    /** Reads posted since the last flush. */
+    std::vector<pending_op> pending_reads;
+    /** Atomic operations posted since the last flush. */
+    std::vector<pending_atomic> pending_atomics;
+    /** Values of the notifications posted since the last flush, which are
+     * sent after its writes. */
+    std::vector<uint32_t> pending_notifications;
+    /** Tag to report notifications from the remote node with. */
+    uint64_t notify_tag;
+    /** Whether notifications from the remote node are reported. */
+    std::atomic<bool> notifications_enabled;
+    /** Messages awaiting an answer, in the order they were sent. */
+    std::deque<outstanding_op> outstanding;
+    /** Protects `outstanding` and `broken`. */
+    std::mutex outstanding_mutex;
+    /** Serializes sends on `sock` between posting threads and `replier`. */
+    std::mutex send_mutex;
+    /** Set once the socket has failed. */
+    bool broken;
+    /** Thread that handles messages from the remote node. */
+    std::thread receiver;
+    /** Answers waiting to be sent, oldest first. */
+    std::deque<reply> replies;
+    /** Protects `replies` and `stopping`. */
+    std::mutex replies_mutex;
+    /** Wakes `replier` when answers are queued or it must stop. */
+    std::condition_variable replies_cv;
+    /** Set when `replier` must stop. */
+    bool stopping = false;
+    /** Thread that sends the answers to the remote node. */
+    std::thread replier;
+    /** Size of `write_buf`, which bounds incoming writes and reads. */
+    std::size_t write_size;
+    /** Size of `read_buf`, which bounds the answers to local reads. */
+    std::size_t read_size;
+    /** The memory that incoming atomic requests may target: the table
+     * passed to tcp_register_memory() that `write_buf` lies in, or else
+     * `write_buf` itself. */
+    char *atomic_base;
+    /** Size of `atomic_base`. */
+    std::size_t atomic_size;
+
+public:
+    /** Process-unique id of this connection. */
+    uint32_t id;
+    /** Socket connected to the remote node. */
+    int sock;
+    /** Pointer to the memory buffer the remote node writes into and reads
+     * from. */
+    char *write_buf;
+    /** Pointer to the memory buffer used for the results of remote reads. */
+    char *read_buf;
+
+    /** Constructor; connects a socket to the remote node. */
+    tcp_resources(int r_index, char *write_addr, char *read_addr, int size_w,
+                  int size_r);
+    /** Closes the socket and stops the receiver thread. */
+    virtual ~tcp_resources();
+    uint32_t get_id() const { return id; }
+    /** Queues a read at an offset into remote memory. */
+    void post_remote_read(long long int offset, long long int size);
+    /** Queues a write at an offset into remote memory. */
+    void post_remote_write(long long int offset, long long int size);
+    /** Queues a write at an offset into remote memory, followed by a
+     * notification. */
+    void post_remote_write_with_imm(long long int offset, long long int size,
+                                    uint32_t imm);
+    /** Queues writes of several ranges, followed by a notification if
+     * `imm` is given. */
+    void post_remote_write_ranges(const byte_range *ranges,
+                                  std::size_t num_ranges,
+                                  const uint32_t *imm);
+    /** Starts reporting notifications from the remote node. */
+    bool enable_notifications(uint64_t _notify_tag);
+    /** Queues an atomic operation at an offset into remote memory. */
+    bool post_remote_atomic(long long int offset, atomic_op op,
+                            uint64_t compare_add, uint64_t swap,
+                            uint64_t atomic_tag);
+    /** Sends all queued operations in a single batch. */
+    void flush();
+};
+
+/** Initializes the TCP transport. */
+void tcp_transport_initialize(const std::map<uint32_t, std::string> &ip_addrs,
+                              uint32_t node_rank);
+/** Records a table whose rows atomic requests from remote nodes may
+ * target. */
+void tcp_register_memory(void *addr, std::size_t size);
+/** Forgets memory passed to tcp_register_memory(). */
+void tcp_deregister_memory(void *addr);
+/** Flushes queued operations and polls for the completions of an owner. */
+int tcp_poll_completions(uint32_t owner, completion *entries,
+                         int max_entries, bool block = true);
+
+}  // namespace sst
+
+#endif  // TCP_TRANSPORT_H
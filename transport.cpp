@@ -0,0 +1,650 @@
+/**
+ * @file transport.cpp
+ * Contains the dispatch from the transport-independent interface of %SST to
+ * the backend chosen at initialization.
+ */
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "transport.h"
+#include "verbs.h"
+#include "shm.h"
+#include "tcp_transport.h"
+#include "../connection_manager.h"
+
+using std::map;
+using std::string;
+
+namespace sst {
+
+static const int port = 22549;
+tcp::tcp_connections *sst_connections;
+
+/** The transport chosen at initialization. */
+static Transport active_transport = Transport::RDMA;
+/** Used to give each tag owner a unique id; 0 is for untagged connections. */
+static std::atomic<uint32_t> tag_owner_counter{1};
+/** Size of the huge pages that tables are rounded up to. */
+static const std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+/** Sizes of the mappings made by allocate_local_memory(), keyed by address;
+ * memory that is not in here came from the heap. */
+static map<void *, std::size_t> local_mappings;
+/** Protects `local_mappings`. */
+static std::mutex local_mappings_mutex;
+
+bool add_node(uint32_t new_id, const string new_ip_addr) {
+    return sst_connections->add_node(new_id, new_ip_addr);
+}
+
+/**
+*@param r_index The node rank of the node to exchange data with.
+*/
+bool sync(uint32_t r_index) {
+    int s = 0, t = 0;
+    return sst_connections->exchange(r_index, s, t);
+}
+
+/**
+ * @param ip_addrs The IP addresses of all the nodes, keyed by node rank.
+ * @param node_rank The node rank of the local node.
+ * @param type The transport backend to carry %SST traffic.
+ */
+void connections_initialize(const map<uint32_t, string> &ip_addrs,
+                            uint32_t node_rank, Transport type) {
+    sst_connections = new tcp::tcp_connections(node_rank, ip_addrs, port);
+    active_transport = type;
+}
+
+/**
+ * @details
+ * This lets the same binary run over any transport: SST_TRANSPORT may be set
+ * to "rdma", "shm" or "tcp".
+ *
+ * @return The transport named by SST_TRANSPORT, or RDMA if it is not set.
+ */
+Transport default_transport() {
+    const char *name = getenv("SST_TRANSPORT");
+    if(!name || !strcmp(name, "rdma")) {
+        return Transport::RDMA;
+    } else if(!strcmp(name, "shm")) {
+        return Transport::SharedMemory;
+    } else if(!strcmp(name, "tcp")) {
+        return Transport::TCP;
+    }
+    std::cerr << "Unknown SST_TRANSPORT " << name << ", using rdma"
+              << std::endl;
+    return Transport::RDMA;
+}
+
+/**
+ * @details
+ * This must be called before creating or using any SST instance, in place of
+ * verbs_initialize() when a transport other than RDMA is wanted.
+ */
+void transport_initialize(const map<uint32_t, string> &ip_addrs,
+                          uint32_t node_rank, Transport type) {
+    switch(type) {
+        case Transport::RDMA:
+            verbs_initialize(ip_addrs, node_rank);
+            break;
+        case Transport::SharedMemory:
+            shm_initialize(ip_addrs, node_rank);
+            break;
+        case Transport::TCP:
+            tcp_transport_initialize(ip_addrs, node_rank);
+            break;
+    }
+}
+
+Transport get_transport() { return active_transport; }
+
+/**
+ * @param r_index The node rank of the remote node to connect to.
+ * @param write_addr A pointer to the memory that the remote node writes into
+ * and reads from.
+ * @param read_addr A pointer to the memory that local writes are sent from
+ * and remote reads arrive in.
+ * @param size_w The size of the write buffer (in bytes).
+ * @param size_r The size of the read buffer (in bytes).
+ * @param cq The completion queue to report completions to, as returned by
+ * make_completion_queue(), or null for a queue shared by every connection
+ * created without one.
+ * @return The connection, once it is ready for use.
+ */
+std::unique_ptr<connection> make_connection(int r_index, char *write_addr,
+                                            char *read_addr, int size_w,
+                                            int size_r, completion_queue *cq) {
+    switch(active_transport) {
+        case Transport::SharedMemory:
+            return std::make_unique<shm_resources>(r_index, write_addr,
+                                                   read_addr, size_w, size_r);
+        case Transport::TCP:
+            return std::make_unique<tcp_resources>(r_index, write_addr,
+                                                   read_addr, size_w, size_r);
+        default:
+            break;
+    }
+    return std::make_unique<resources>(
+        r_index, write_addr, read_addr, size_w, size_r,
+        static_cast<verbs_completion_queue *>(cq));
+}
+
+/**
+ * @details
+ * Over RDMA the connections are set up concurrently, which takes far fewer
+ * round trips than making them one by one; the other transports make them
+ * in order. Every remote node must make its connections to this node in the
+ * same order as this node makes its connections to it.
+ *
+ * @param requests The connections to make.
+ * @param cq The completion queue to report completions to, as returned by
+ * make_completion_queue(), or null for a queue shared by every connection
+ * created without one.
+ * @param shared Whether, over RDMA, the connections may share queue pairs
+ * with other connections to the same nodes. Their completions are then
+ * reported to shared_completion_queue() instead of `cq`. The other
+ * transports have no per-connection state worth sharing.
+ * @return The connections, in the order of `requests`, once they are all
+ * ready for use.
+ */
+std::vector<std::unique_ptr<connection>> make_connections(
+    const std::vector<connection_request> &requests, completion_queue *cq,
+    bool shared) {
+    if(active_transport == Transport::RDMA) {
+        return verbs_make_connections(
+            requests, static_cast<verbs_completion_queue *>(cq), shared);
+    }
+    std::vector<std::unique_ptr<connection>> connections;
+    for(const auto &request : requests) {
+        connections.push_back(make_connection(
+            request.r_index, request.write_addr, request.read_addr,
+            request.size_w, request.size_r, cq));
+    }
+    return connections;
+}
+
+/**
+ * @param num_connections The number of connections that will report to the
+ * queue, which sizes it.
+ * @param policy How threads polling the queue wait; a queue that will be
+ * slept on gets an event channel over RDMA.
+ * @param with_receives Whether the connections will take notifications,
+ * which also complete into the queue.
+ * @return The completion queue.
+ */
+std::unique_ptr<completion_queue> make_completion_queue(
+    std::size_t num_connections, const wait_policy &policy,
+    bool with_receives) {
+    if(active_transport == Transport::RDMA) {
+        return verbs_make_completion_queue(
+            num_connections, policy.spin_us >= 0, with_receives);
+    }
+    return std::make_unique<completion_queue>();
+}
+
+/**
+ * @details
+ * Over RDMA this is the queue of the pooled queue pairs, which stays alive
+ * while anyone holds it. The other transports return a new queue, since
+ * their queues keep no state.
+ */
+std::shared_ptr<completion_queue> shared_completion_queue() {
+    if(active_transport == Transport::RDMA) {
+        return verbs_shared_completion_queue();
+    }
+    return std::make_shared<completion_queue>();
+}
+
+/**
+ * @details
+ * Transports without completion events can only sleep for the whole
+ * timeout.
+ *
+ * @param timeout_us The longest time to sleep, in microseconds.
+ */
+void completion_queue::wait(int timeout_us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(timeout_us));
+}
+
+/**
+ * @details
+ * Over RDMA, the work requests for all the targets are built in one pass
+ * before any is posted, and only the writes chosen by `policy` produce a
+ * completion; other transports post the writes one by one, and every write
+ * produces a completion.
+ *
+ * @param targets The connections to write to.
+ * @param count The number of connections in `targets`.
+ * @param offset The offset, in bytes, of the remote buffer at which to start
+ * writing.
+ * @param size The number of bytes to write.
+ * @param policy Which of the writes should produce a completion.
+ * @param signaled If not null, resized to `count` and set to whether the
+ * write to each target produces a completion.
+ * @param imm If not null, each write also notifies its target with this
+ * value; the targets must have enabled notifications.
+ * @return The number of completions to poll for.
+ */
+std::size_t post_remote_writes(connection *const *targets, std::size_t count,
+                               long long int offset, long long int size,
+                               const signal_policy &policy,
+                               std::vector<bool> *signaled,
+                               const uint32_t *imm) {
+    if(active_transport == Transport::RDMA) {
+        return verbs_post_remote_writes(targets, count, offset, size, policy,
+                                        signaled, imm);
+    }
+    for(std::size_t i = 0; i < count; ++i) {
+        if(imm) {
+            targets[i]->post_remote_write_with_imm(offset, size, *imm);
+        } else {
+            targets[i]->post_remote_write(offset, size);
+        }
+    }
+    if(signaled) {
+        signaled->assign(count, true);
+    }
+    return count;
+}
+
+/**
+ * @details
+ * The ranges should not overlap. Over RDMA, the writes to each target are
+ * posted as one chain of work requests, of which at most the last is
+ * signaled; other transports post them as one operation on each target, and
+ * every target produces a completion.
+ *
+ * @param targets The connections to write to.
+ * @param count The number of connections in `targets`.
+ * @param ranges The ranges of the remote buffer to write, in the order they
+ * should land.
+ * @param num_ranges The number of ranges in `ranges`.
+ * @param policy Which of the targets should produce a completion.
+ * @param signaled If not null, resized to `count` and set to whether the
+ * writes to each target produce a completion.
+ * @param imm If not null, the last write to each target also notifies it
+ * with this value; the targets must have enabled notifications.
+ * @return The number of completions to poll for.
+ */
+std::size_t post_remote_writes(connection *const *targets, std::size_t count,
+                               const byte_range *ranges,
+                               std::size_t num_ranges,
+                               const signal_policy &policy,
+                               std::vector<bool> *signaled,
+                               const uint32_t *imm) {
+    if(num_ranges == 1) {
+        return post_remote_writes(targets, count, ranges[0].offset,
+                                  ranges[0].size, policy, signaled, imm);
+    }
+    if(active_transport == Transport::RDMA) {
+        return verbs_post_remote_writes(targets, count, ranges, num_ranges,
+                                        policy, signaled, imm);
+    }
+    for(std::size_t i = 0; i < count; ++i) {
+        targets[i]->post_remote_write_ranges(ranges, num_ranges, imm);
+    }
+    if(signaled) {
+        signaled->assign(count, true);
+    }
+    return count;
+}
+
+uint32_t new_tag_owner() { return tag_owner_counter++; }
+
+/**
+ * @details
+ * This blocks until at least one operation posted on a connection tagged
+ * with `owner` has completed, or a timeout is reached. Completions are
+ * reported in the order each connection produced them, and several can be
+ * returned at once, so the caller should ask for as many as it expects.
+ *
+ * @param owner The owner part of the tags of the connections to poll.
+ * @param entries The array to store the completions in.
+ * @param max_entries The maximum number of completions to return.
+ * @param cq The completion queue the connections were created with.
+ * @param block Whether to wait for a completion; if false, only the
+ * completions that are ready are returned.
+ * @return The number of completions stored in `entries`, or 0 if none was
+ * found before the timeout.
+ */
+int poll_completions(uint32_t owner, completion *entries, int max_entries,
+                     completion_queue *cq, bool block) {
+    switch(active_transport) {
+        case Transport::SharedMemory:
+            return shm_poll_completions(owner, entries, max_entries, block);
+        case Transport::TCP:
+            return tcp_poll_completions(owner, entries, max_entries, block);
+        default:
+            break;
+    }
+    return verbs_poll_completions(owner, entries, max_entries,
+                                  static_cast<verbs_completion_queue *>(cq),
+                                  block);
+}
+
+/**
+ * @details
+ * Over RDMA this is bounded by the send queue of each queue pair. The other
+ * transports queue operations without limit.
+ */
+unsigned int max_outstanding_writes() {
+    if(active_transport == Transport::RDMA) {
+        return verbs_max_outstanding_writes();
+    }
+    return UINT_MAX;
+}
+
+/**
+ * @return pair(index,result) The index part of the tag of the connection
+ * associated with the completed operation and the result (1 for successful,
+ * -1 for unsuccessful, 0 if no completion found)
+ */
+std::pair<int, int> poll_completion() {
+    completion entry;
+    if(poll_completions(0, &entry, 1) == 0) {
+        return {-1, 0};
+    }
+    return {tag_index(entry.tag), entry.result};
+}
+
+/**
+ * @param queue The completions to search, oldest first.
+ * @param owner The owner part of the tags of the completions to take.
+ * @param entries The array to move the completions to.
+ * @param max_entries The maximum number of completions to take.
+ * @return The number of completions moved to `entries`.
+ */
+int take_completions(std::deque<completion> &queue, uint32_t owner,
+                     completion *entries, int max_entries) {
+    int num_taken = 0;
+    for(auto it = queue.begin();
+        it != queue.end() && num_taken < max_entries;) {
+        if(tag_owner(it->tag) == owner) {
+            entries[num_taken++] = *it;
+            it = queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return num_taken;
+}
+
+/**
+ * Applies the NUMA binding of a policy to memory that has not been touched
+ * yet, and asks for transparent huge pages if the policy wants huge pages.
+ * Failures only cost performance, so they are reported and ignored.
+ *
+ * @param addr The start of the memory, aligned to a page.
+ * @param size The size of the memory (in bytes).
+ * @param policy The placement to apply.
+ */
+static void place_memory(void *addr, std::size_t size,
+                         const memory_policy &policy) {
+    if(policy.huge_pages && madvise(addr, size, MADV_HUGEPAGE) != 0) {
+        std::cerr << "Could not ask for transparent huge pages, error code is "
+                  << errno << std::endl;
+    }
+    int node = policy.numa_node;
+    if(node == NIC_NUMA_NODE) {
+        node = active_transport == Transport::RDMA ? verbs_numa_node()
+                                                   : ANY_NUMA_NODE;
+    }
+    if(node < 0) {
+        return;
+    }
+    const unsigned long bits_per_word = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> node_mask(node / bits_per_word + 1);
+    node_mask[node / bits_per_word] = 1UL << (node % bits_per_word);
+    if(syscall(SYS_mbind, addr, size, MPOL_BIND, node_mask.data(),
+               node_mask.size() * bits_per_word, 0) != 0) {
+        std::cerr << "Could not bind memory to NUMA node " << node
+                  << ", error code is " << errno << std::endl;
+    }
+}
+
+/**
+ * @details
+ * With the default policy, the memory is cache-line aligned heap memory.
+ * Otherwise it is mapped separately, so that it can be placed without
+ * affecting the rest of the heap; huge pages round its size up to a whole
+ * huge page.
+ *
+ * @param size The number of bytes to allocate.
+ * @param policy Where to place the memory.
+ * @return A pointer to the zeroed memory, or NULL if it could not be
+ * allocated.
+ */
+void *allocate_local_memory(std::size_t size, const memory_policy &policy) {
+    if(!policy.huge_pages && policy.numa_node == ANY_NUMA_NODE) {
+        void *addr = NULL;
+        if(posix_memalign(&addr, 64, size) != 0) {
+            return NULL;
+        }
+        memset(addr, 0, size);
+        return addr;
+    }
+    void *addr = MAP_FAILED;
+    if(policy.huge_pages) {
+        size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if(addr == MAP_FAILED) {
+        // no reserved huge pages, so fall back to transparent ones
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(addr == MAP_FAILED) {
+            return NULL;
+        }
+        place_memory(addr, size, policy);
+    } else {
+        place_memory(addr, size, {false, policy.numa_node});
+    }
+    // fault the pages in now, where the policy puts them
+    memset(addr, 0, size);
+    std::lock_guard<std::mutex> lock(local_mappings_mutex);
+    local_mappings[addr] = size;
+    return addr;
+}
+
+void free_local_memory(void *addr) {
+    {
+        std::lock_guard<std::mutex> lock(local_mappings_mutex);
+        auto it = local_mappings.find(addr);
+        if(it != local_mappings.end()) {
+            munmap(it->first, it->second);
+            local_mappings.erase(it);
+            return;
+        }
+    }
+    free(addr);
+}
+
+/**
+ * @details
+ * Tables are cache-line aligned, and placed according to `policy`. Over
+ * shared memory, they are placed in a segment that remote nodes on the same
+ * host can map, which only takes transparent huge pages. Over RDMA, each
+ * table is registered once, and the connections into it share the
+ * registration. Over TCP, each table is recorded, so that atomic requests
+ * from remote nodes can be checked against it.
+ *
+ * @param size The number of bytes to allocate.
+ * @param policy Where to place the memory.
+ * @return A pointer to the zeroed memory.
+ */
+void *allocate_table_memory(std::size_t size, const memory_policy &policy) {
+    if(active_transport == Transport::SharedMemory) {
+        void *addr = shm_allocate(size);
+        if(addr) {
+            place_memory(addr, size, policy);
+        }
+        return addr;
+    }
+    void *addr = allocate_local_memory(size, policy);
+    if(addr && active_transport == Transport::RDMA) {
+        verbs_register_memory(addr, size);
+    } else if(addr && active_transport == Transport::TCP) {
+        tcp_register_memory(addr, size);
+    }
+    return addr;
+}
+
+void free_table_memory(void *addr) {
+    if(active_transport == Transport::SharedMemory) {
+        shm_free(addr);
+        return;
+    }
+    if(active_transport == Transport::RDMA) {
+        verbs_deregister_memory(addr);
+    } else if(active_transport == Transport::TCP) {
+        tcp_deregister_memory(addr);
+    }
+    free_local_memory(addr);
+}
+
+/**
+ * @param node A NUMA node.
+ * @return The CPUs of the node, as listed in sysfs, or an empty set if the
+ * node is unknown.
+ */
+static std::set<int> numa_node_cpus(int node) {
+    std::ifstream cpulist_file("/sys/devices/system/node/node" +
+                               std::to_string(node) + "/cpulist");
+    std::set<int> cpus;
+    string range;
+    // the list looks like "0-3,8-11"
+    while(std::getline(cpulist_file, range, ',')) {
+        int first, last;
+        char dash;
+        std::istringstream range_stream(range);
+        if(!(range_stream >> first)) {
+            continue;
+        }
+        last = (range_stream >> dash >> last) ? last : first;
+        for(int cpu = first; cpu <= last; ++cpu) {
+            cpus.insert(cpu);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @details
+ * Each part of the placement is applied separately, so a failure to get a
+ * realtime policy, which needs privileges, still leaves the thread pinned.
+ *
+ * @param thread The thread to place.
+ * @param placement Where the thread should run and how it is scheduled.
+ * @return Whether the whole placement was applied.
+ */
+bool place_thread(pthread_t thread, const thread_placement &placement) {
+    bool success = true;
+    std::set<int> cpus(placement.cpus.begin(), placement.cpus.end());
+    int node = placement.numa_node;
+    if(node == NIC_NUMA_NODE) {
+        node = active_transport == Transport::RDMA ? verbs_numa_node()
+                                                   : ANY_NUMA_NODE;
+    }
+    if(node >= 0) {
+        std::set<int> node_cpus = numa_node_cpus(node);
+        if(cpus.empty()) {
+            cpus = node_cpus;
+        } else {
+            for(auto it = cpus.begin(); it != cpus.end();) {
+                it = node_cpus.count(*it) ? std::next(it) : cpus.erase(it);
+            }
+        }
+        if(cpus.empty()) {
+            std::cerr << "No CPUs to run on in NUMA node " << node
+                      << std::endl;
+            success = false;
+        }
+    }
+    if(!cpus.empty()) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for(int cpu : cpus) {
+            CPU_SET(cpu, &cpu_set);
+        }
+        int rc = pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set);
+        if(rc != 0) {
+            std::cerr << "Could not set thread affinity, error code is " << rc
+                      << std::endl;
+            success = false;
+        }
+    }
+    if(placement.sched_policy != SCHED_OTHER ||
+       placement.sched_priority != 0) {
+        struct sched_param param;
+        param.sched_priority = placement.sched_priority;
+        int rc =
+            pthread_setschedparam(thread, placement.sched_policy, &param);
+        if(rc != 0) {
+            std::cerr << "Could not set thread scheduling policy, error code "
+                      << "is " << rc << std::endl;
+            success = false;
+        }
+    }
+    return success;
+}
+
+/**
+ * @details
+ * This reports what the operating system has in effect, which may differ
+ * from what was asked for if placing the thread failed. The NUMA node is
+ * not tracked per thread, so it is always ANY_NUMA_NODE; the CPUs it led to
+ * are in the set.
+ *
+ * @param thread The thread to query.
+ * @return The placement of the thread.
+ */
+thread_placement get_thread_placement(pthread_t thread) {
+    thread_placement placement;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if(pthread_getaffinity_np(thread, sizeof(cpu_set), &cpu_set) == 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if(CPU_ISSET(cpu, &cpu_set)) {
+                placement.cpus.push_back(cpu);
+            }
+        }
+    }
+    struct sched_param param;
+    if(pthread_getschedparam(thread, &placement.sched_policy, &param) == 0) {
+        placement.sched_priority = param.sched_priority;
+    }
+    return placement;
+}
+
+/**
+ * @details
+ * This should only be called once all SST instances have been destroyed.
+ */
+void transport_destroy() {
+    switch(active_transport) {
+        case Transport::SharedMemory:
+            shm_destroy();
+            break;
+        case Transport::TCP:
+            break;
+        default:
+            verbs_destroy();
+            break;
+    }
+}
+
+}  // namespace sst
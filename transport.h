@@ -0,0 +1,341 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+/**
+ * @file transport.h
+ * Contains the transport-independent interface that %SST uses to move row
+ * data between nodes, along with the global setup functions that select and
+ * initialize a transport backend.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace tcp {
+class tcp_connections;
+}
+
+namespace sst {
+
+/**
+ * Selects the backend that carries %SST traffic between nodes.
+ */
+enum class Transport {
+    /** One-sided reads and writes over InfiniBand Verbs. */
+    RDMA,
+    /** Plain loads and stores into POSIX shared memory, for members that run
+     * on the same host. */
+    SharedMemory,
+    /** Messages over ordinary TCP sockets, for nodes without RDMA. */
+    TCP
+};
+
+/** Milliseconds to wait for an operation to complete before presuming that
+ * its remote node has failed. */
+const int COMPLETION_TIMEOUT_MS = 2000;
+
+/** The outcome of an operation posted on a connection. */
+struct completion {
+    /** The tag of the connection the operation was posted on. */
+    uint64_t tag;
+    /** 1 if the operation succeeded, -1 if it failed. */
+    int result;
+    /** For a notification, the value its sender attached; see
+     * connection::post_remote_write_with_imm(). */
+    uint32_t imm = 0;
+};
+
+/**
+ * Builds a connection tag. The owner, usually one SST instance, says who
+ * polls for the completions; the index, usually a row, says which
+ * connection they came from.
+ */
+inline uint64_t make_tag(uint32_t owner, uint32_t index) {
+    return ((uint64_t)owner << 32) | index;
+}
+/** Returns the owner part of a connection tag. */
+inline uint32_t tag_owner(uint64_t tag) { return tag >> 32; }
+/** Returns the index part of a connection tag. */
+inline uint32_t tag_index(uint64_t tag) { return (uint32_t)tag; }
+
+/** A contiguous range of bytes within a buffer. */
+struct byte_range {
+    /** The offset of the first byte. */
+    long long int offset;
+    /** The number of bytes. */
+    long long int size;
+};
+
+/** The atomic operations that a connection can perform on remote memory. */
+enum class atomic_op {
+    /** Adds a value to the target. */
+    fetch_add,
+    /** Replaces the target with a value if it equals another. */
+    compare_swap
+};
+
+/**
+ * Represents a two-way connection to a single remote node over some
+ * transport. Completions of the operations posted on a connection are
+ * reported by poll_completions(), tagged with the connection's tag.
+ */
+class connection {
+public:
+    /** Index of the remote node. */
+    int remote_index;
+    /** Tag reported with the completions of this connection; see
+     * make_tag(). Connections that nobody tags belong to owner 0. */
+    uint64_t tag = 0;
+    /** The value that the last atomic operation found at its target,
+     * available once the operation completes. */
+    volatile uint64_t atomic_result = 0;
+
+    virtual ~connection() {}
+    /** Returns an id that identifies this connection in log messages. */
+    virtual uint32_t get_id() const = 0;
+    /** Returns the largest write, in bytes, that is sent inline with its
+     * request; 0 if the transport has no such notion. */
+    virtual uint32_t get_max_inline_data() const { return 0; }
+    /** Post a read at an offset into remote memory. */
+    virtual void post_remote_read(long long int offset,
+                                  long long int size) = 0;
+    /** Post a write at an offset into remote memory. */
+    virtual void post_remote_write(long long int offset,
+                                   long long int size) = 0;
+    /** Post an atomic operation on the 8 bytes at an offset into remote
+     * memory, reported with `atomic_tag` instead of the connection's tag.
+     * Returns false, without posting, if the transport cannot do it. */
+    virtual bool post_remote_atomic(long long int offset, atomic_op op,
+                                    uint64_t compare_add, uint64_t swap,
+                                    uint64_t atomic_tag) {
+        return false;
+    }
+    /** Post a write at an offset into remote memory that also notifies the
+     * remote node, once the data has landed, with a 32-bit value. Without
+     * notifications this is a plain write. */
+    virtual void post_remote_write_with_imm(long long int offset,
+                                            long long int size,
+                                            uint32_t imm) {
+        post_remote_write(offset, size);
+    }
+    /** Post writes of several ranges into remote memory, which land in
+     * order and are reported as one operation, with one completion. With
+     * `imm`, the last write notifies the remote node as in
+     * post_remote_write_with_imm(). */
+    virtual void post_remote_write_ranges(const byte_range *ranges,
+                                          std::size_t num_ranges,
+                                          const uint32_t *imm) = 0;
+    /** Reports the notifications sent by the remote node as completions
+     * tagged with `notify_tag`. Returns false if the transport cannot, in
+     * which case the remote node must not send any. */
+    virtual bool enable_notifications(uint64_t notify_tag) { return false; }
+    /** Makes room for another notification once one has been reported. */
+    virtual void notification_consumed() {}
+    /** Moves the connection off a path on which an operation failed, if it
+     * has another one, setting `moved` to whether it moved now. Returns
+     * false if the connection has no working path left. */
+    virtual bool fail_over(bool &moved) {
+        moved = false;
+        return false;
+    }
+};
+
+/** The buffers of a connection to be made by make_connections(). */
+struct connection_request {
+    /** The node rank of the remote node to connect to. */
+    int r_index;
+    /** The memory that the remote node writes into and reads from. */
+    char *write_addr;
+    /** The memory that local writes are sent from and remote reads arrive
+     * in. */
+    char *read_addr;
+    /** The size of the write buffer (in bytes). */
+    int size_w;
+    /** The size of the read buffer (in bytes). */
+    int size_r;
+};
+
+/**
+ * Chooses which of the writes in a fan-out generate completions. Writes that
+ * are not signaled are never polled for individually; a later signaled write
+ * on the same connection confirms them, since a connection completes its
+ * operations in order. Transports other than RDMA signal every write.
+ */
+struct signal_policy {
+    /** Each connection signals one in this many writes; 1 signals every
+     * write. Over RDMA this is capped at half the send queue depth. */
+    unsigned int interval = 1;
+    /** Whether the last write of each fan-out is always signaled. */
+    bool signal_last = false;
+};
+
+/**
+ * How a thread that has run out of work waits for more. By default threads
+ * spin, which gives the lowest latency but keeps a core busy even when
+ * nothing happens.
+ */
+struct wait_policy {
+    /** Microseconds to keep spinning after the last work was found before
+     * sleeping; negative spins forever. */
+    int spin_us = -1;
+    /** Longest single sleep, in microseconds. Completions wake a sleeping
+     * thread early over RDMA, but row updates written by remote nodes raise
+     * no event unless they come with notifications, so this bounds how late
+     * they are noticed. */
+    int max_sleep_us = 1000;
+};
+
+/** Leaves the NUMA placement of memory to the operating system. */
+const int ANY_NUMA_NODE = -1;
+/** Places memory on the NUMA node of the RDMA device, or of the first rail
+ * when there are several; see verbs_set_rails(). */
+const int NIC_NUMA_NODE = -2;
+
+/**
+ * Where the memory of an SST table, and of its snapshots, is placed. By
+ * default it comes from the heap like any other allocation.
+ */
+struct memory_policy {
+    /** Whether to back the memory with huge pages: reserved ones
+     * (MAP_HUGETLB) if the system has enough, transparent ones otherwise.
+     * This cuts TLB misses when scanning wide rows. */
+    bool huge_pages = false;
+    /** The NUMA node to bind the memory to, ANY_NUMA_NODE, or
+     * NIC_NUMA_NODE. */
+    int numa_node = ANY_NUMA_NODE;
+};
+
+/**
+ * Where a background thread runs and how it is scheduled. By default the
+ * thread is left to the scheduler, which may migrate it across cores and
+ * sockets.
+ */
+struct thread_placement {
+    /** The CPUs the thread may run on; empty allows every CPU. */
+    std::vector<int> cpus;
+    /** Restricts the thread to the CPUs of a NUMA node, intersected with
+     * `cpus` if both are given; ANY_NUMA_NODE or NIC_NUMA_NODE. */
+    int numa_node = ANY_NUMA_NODE;
+    /** The scheduling policy, such as SCHED_FIFO or SCHED_RR for realtime
+     * threads. These need the privilege to raise priorities. */
+    int sched_policy = SCHED_OTHER;
+    /** The priority within `sched_policy`; must be 0 for SCHED_OTHER. */
+    int sched_priority = 0;
+};
+
+/**
+ * The queue that a group of connections, usually those of one SST, report
+ * their completions to. Groups with separate queues can post and poll
+ * concurrently without contending for, or draining, each other's
+ * completions. Only RDMA keeps per-queue state; the other transports
+ * already report completions to the posting thread.
+ */
+class completion_queue {
+public:
+    virtual ~completion_queue() {}
+    /** Sleeps until a completion may have arrived, or for at most
+     * `timeout_us` microseconds. */
+    virtual void wait(int timeout_us);
+};
+
+/** The TCP connections used to exchange connection data and sync. */
+extern tcp::tcp_connections *sst_connections;
+
+bool add_node(uint32_t new_id, const std::string new_ip_addr);
+bool sync(uint32_t r_index);
+
+/** Returns the transport named by the SST_TRANSPORT environment variable. */
+Transport default_transport();
+/** Initializes the global resources of the chosen transport. */
+void transport_initialize(const std::map<uint32_t, std::string> &ip_addrs,
+                          uint32_t node_rank,
+                          Transport type = default_transport());
+/** Creates the TCP connections and records the transport in use. */
+void connections_initialize(const std::map<uint32_t, std::string> &ip_addrs,
+                            uint32_t node_rank, Transport type);
+/** Returns the transport chosen at initialization. */
+Transport get_transport();
+/** Connects to a remote node over the transport in use. */
+std::unique_ptr<connection> make_connection(int r_index, char *write_addr,
+                                            char *read_addr, int size_w,
+                                            int size_r,
+                                            completion_queue *cq = nullptr);
+/** Connects to several remote nodes at once over the transport in use. */
+std::vector<std::unique_ptr<connection>> make_connections(
+    const std::vector<connection_request> &requests,
+    completion_queue *cq = nullptr, bool shared = false);
+/** Posts the same write to several remote nodes. */
+std::size_t post_remote_writes(connection *const *targets, std::size_t count,
+                               long long int offset, long long int size,
+                               const signal_policy &policy = signal_policy(),
+                               std::vector<bool> *signaled = nullptr,
+                               const uint32_t *imm = nullptr);
+/** Posts the same writes of several ranges to several remote nodes. */
+std::size_t post_remote_writes(connection *const *targets, std::size_t count,
+                               const byte_range *ranges,
+                               std::size_t num_ranges,
+                               const signal_policy &policy = signal_policy(),
+                               std::vector<bool> *signaled = nullptr,
+                               const uint32_t *imm = nullptr);
+/** Creates a completion queue for a group of connections. */
+std::unique_ptr<completion_queue> make_completion_queue(
+    std::size_t num_connections, const wait_policy &policy = wait_policy(),
+    bool with_receives = false);
+/** Returns the completion queue of connections made with `shared`. */
+std::shared_ptr<completion_queue> shared_completion_queue();
+/** Returns a process-unique owner for connection tags. */
+uint32_t new_tag_owner();
+/** Waits for the completions of operations posted on an owner's
+ * connections. */
+int poll_completions(uint32_t owner, completion *entries, int max_entries,
+                     completion_queue *cq = nullptr, bool block = true);
+/** Returns how many writes may be outstanding on a connection at once. */
+unsigned int max_outstanding_writes();
+/** Polls for completion of a single operation on an untagged connection. */
+std::pair<int, int> poll_completion();
+/** Moves an owner's completions out of a queue. */
+int take_completions(std::deque<completion> &queue, uint32_t owner,
+                     completion *entries, int max_entries);
+/** Allocates zeroed memory for an SST table. */
+void *allocate_table_memory(std::size_t size,
+                            const memory_policy &policy = memory_policy());
+/** Frees memory returned by allocate_table_memory(). */
+void free_table_memory(void *addr);
+/** Allocates zeroed memory that only the local node uses. */
+void *allocate_local_memory(std::size_t size,
+                            const memory_policy &policy = memory_policy());
+/** Frees memory returned by allocate_local_memory(). */
+void free_local_memory(void *addr);
+/** Pins a thread and sets its scheduling policy. */
+bool place_thread(pthread_t thread, const thread_placement &placement);
+/** Returns the CPUs and scheduling policy a thread currently has. */
+thread_placement get_thread_placement(pthread_t thread);
+/** Destroys the global resources of the transport in use. */
+void transport_destroy();
+
+/** Deleter that returns an SST table to the transport it came from. */
+struct table_deleter {
+    void operator()(volatile void *addr) const {
+        free_table_memory(const_cast<void *>(addr));
+    }
+};
+
+/** Deleter for memory returned by allocate_local_memory(). */
+struct local_memory_deleter {
+    void operator()(const void *addr) const {
+        free_local_memory(const_cast<void *>(addr));
+    }
+};
+
+}  // namespace sst
+
+#endif  // TRANSPORT_H
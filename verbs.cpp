@@ -2,7 +2,16 @@
  * @file verbs.cpp
  * Contains the implementation of the IB Verbs adapter layer of %SST.
  */
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -20,6 +29,10 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 #include "verbs.h"
 #include "../connection_manager.h"
@@ -55,37 +68,348 @@ void check_for_error(T var, string msg) {
 namespace sst {
 /** Completion Queue poll timeout in millisec */
 const int MAX_POLL_CQ_TIMEOUT = 2000;
-/** IB device name. */
+/** Depth of the send queue of each queue pair. Unsignaled writes hold their
+ * slot until a later signaled one completes, so half of the queue caps the
+ * interval between signaled writes, and the other half caps the writes of
+ * asynchronous puts that may be outstanding. */
+const unsigned int MAX_SEND_WR = 64;
+/** Depth of the receive queue of each queue pair, which holds the receives
+ * that notifications from the remote node consume. */
+const unsigned int MAX_RECV_WR = 64;
+/** Largest write, in bytes, that each queue pair asks to send inline. The
+ * device may grant less. */
+const uint32_t MAX_INLINE_DATA = 256;
+/** Most RDMA reads and atomic operations that each queue pair asks to have
+ * outstanding, as initiator and as target. The device may allow fewer. */
+const int MAX_RD_ATOMIC = 16;
+/** Number of connections whose data is exchanged with a remote node in a
+ * single round trip by verbs_make_connections(). */
+const unsigned int CON_DATA_BATCH_SIZE = 16;
+/** Most threads that verbs_make_connections() sets connections up with. */
+const unsigned int MAX_SETUP_THREADS = 16;
+/** Most rails that are opened, so that a set of them fits in the masks of
+ * a cm_rail_offer_t. */
+const unsigned int MAX_RAILS = 32;
+/** Most connections that share one pooled queue pair. Its send queue is this
+ * many times deeper than that of an unshared one. */
+const unsigned int MAX_QP_SHARERS = 8;
+/** Number of entries in the completion queue of the pooled queue pairs. */
+const int POOL_CQ_SIZE = 16384;
+/** Number of work completions drained from the completion queue at once. */
+const int POLL_BATCH_SIZE = 16;
+/** Number of empty polls of the completion queue between checks of the
+ * timeout. */
+const unsigned int POLLS_PER_TIMEOUT_CHECK = 64;
+/** IB device name, used when no rails are configured. */
 const char *dev_name = NULL;
-/** Local IB port to work with. */
+/** Local IB port to work with, used when no rails are configured. */
 int ib_port = 1;
 /** GID index to use. */
 int gid_idx = 0;
 
-static const int port = 22549;
-tcp::tcp_connections *sst_connections;
-
 //  unsigned int max_time_to_completion = 0;
 
-/** Structure containing global system resources. */
-struct global_resources {
+/** An opened RDMA device, shared by the rails on its ports. */
+struct rdma_device {
+    /** The position of the device in global_resources::devices, which is
+     * also the position of its queue in each verbs_completion_queue. */
+    std::size_t index;
     /** RDMA device attributes. */
     struct ibv_device_attr device_attr;
-    /** IB port attributes. */
-    struct ibv_port_attr port_attr;
     /** Device handle. */
     struct ibv_context *ib_ctx;
     /** PD handle. */
     struct ibv_pd *pd;
-    /** Completion Queue handle. */
-    struct ibv_cq *cq;
+    /** The NUMA node the device is attached to, or ANY_NUMA_NODE. */
+    int numa_node;
+};
+
+/** A port of an opened device, along with the traffic posted on it. */
+struct rdma_rail {
+    /** The device the port belongs to. */
+    rdma_device *device;
+    /** The port number on the device. */
+    int port;
+    /** The position of the rail among the rails asked for, which names it
+     * to other nodes; see cm_rail_offer_t. */
+    unsigned int id;
+    /** The turns the rail gets under rail_policy::weighted. */
+    unsigned int weight;
+    /** IB port attributes, as of when the rail was opened. */
+    struct ibv_port_attr port_attr;
+    /** The counters reported by verbs_rail_counters(), which posting threads
+     * update without ordering, since they are only ever sampled. */
+    std::atomic<uint64_t> num_queue_pairs{0};
+    std::atomic<uint64_t> num_writes{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> num_reads{0};
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> num_atomics{0};
+};
+
+/** Structure containing global system resources. */
+struct global_resources {
+    /** The opened devices. */
+    std::vector<std::unique_ptr<rdma_device>> devices;
+    /** The opened rails; the first one is the default. */
+    std::vector<std::unique_ptr<rdma_rail>> rails;
+    /** Completion queue of the queue pairs created without one. */
+    verbs_completion_queue *cq;
 };
 /** The single instance of global_resources for the %SST system */
 struct global_resources *g_res;
 
+/** The rails asked for by verbs_set_rails(), or empty to read them from the
+ * SST_RDMA_RAILS environment variable. */
+static std::vector<rail_spec> rail_specs;
+/** How connections are spread over the rails. */
+static rail_policy rails_policy = rail_policy::round_robin;
+/** The rank of the local node. */
+static uint32_t local_rank;
+
+/** A memory region along with the number of users sharing it. */
+struct memory_registration {
+    struct ibv_mr *mr;
+    int num_users;
+};
+/** The memory regions registered so far. Registrations are looked up by the
+ * address range they cover, so connections into the same table share one. */
+static std::vector<memory_registration> registrations;
+/** Protects `registrations`. */
+static std::mutex registrations_mutex;
+
+static struct ibv_qp *create_qp(verbs_completion_queue *cq, rdma_rail *rail,
+                                unsigned int max_send_wr,
+                                uint32_t &max_inline_data);
+
+/**
+ * Reuses a memory region that already covers the buffer on the same
+ * device, or registers a new one.
+ *
+ * @param pd The protection domain of the device to register with.
+ * @param addr The start of the buffer.
+ * @param size The size of the buffer (in bytes).
+ * @return The memory region, or null if it could not be registered.
+ */
+static struct ibv_mr *acquire_memory(struct ibv_pd *pd, char *addr,
+                                     std::size_t size) {
+    std::lock_guard<std::mutex> lock(registrations_mutex);
+    for(auto &registration : registrations) {
+        char *start = (char *)registration.mr->addr;
+        if(registration.mr->pd == pd && start <= addr &&
+           addr + size <= start + registration.mr->length) {
+            ++registration.num_users;
+            return registration.mr;
+        }
+    }
+    // allow access for local writes and remote reads, writes and atomics
+    int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+                   IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
+    struct ibv_mr *mr = ibv_reg_mr(pd, addr, size, mr_flags);
+    if(mr) {
+        registrations.push_back({mr, 1});
+    }
+    return mr;
+}
+
+/**
+ * Deregisters a memory region once its last user has released it.
+ *
+ * @param mr A memory region returned by acquire_memory().
+ * @return 0, or the error code of ibv_dereg_mr.
+ */
+static int release_memory(struct ibv_mr *mr) {
+    std::lock_guard<std::mutex> lock(registrations_mutex);
+    auto it = std::find_if(registrations.begin(), registrations.end(),
+                           [mr](const memory_registration &registration) {
+                               return registration.mr == mr;
+                           });
+    if(it == registrations.end() || --it->num_users > 0) {
+        return 0;
+    }
+    registrations.erase(it);
+    return ibv_dereg_mr(mr);
+}
+
+/**
+ * @param rail A rail.
+ * @return Whether the port of the rail is up right now.
+ */
+static bool rail_active(const rdma_rail *rail) {
+    struct ibv_port_attr port_attr;
+    return ibv_query_port(rail->device->ib_ctx, rail->port, &port_attr) == 0 &&
+           port_attr.state == IBV_PORT_ACTIVE;
+}
+
+/**
+ * @param qp A queue pair.
+ * @return Whether the queue pair can still send, which it cannot once an
+ * operation on it has failed.
+ */
+static bool qp_ready(struct ibv_qp *qp) {
+    struct ibv_qp_attr attr;
+    struct ibv_qp_init_attr init_attr;
+    return ibv_query_qp(qp, &attr, IBV_QP_STATE, &init_attr) == 0 &&
+           attr.qp_state == IBV_QPS_RTS;
+}
+
+/**
+ * @param addr An address in memory that has been touched.
+ * @return The NUMA node the memory is on, or ANY_NUMA_NODE if it is unknown.
+ */
+static int memory_numa_node(const void *addr) {
+    int node = ANY_NUMA_NODE;
+    if(syscall(SYS_get_mempolicy, &node, NULL, 0, addr,
+               MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+        return ANY_NUMA_NODE;
+    }
+    return node;
+}
+
+/** What a node tells another about its rails before they connect, so that
+ * both choose the same rails; bit i of each mask stands for the rail with
+ * id i, and the masks are in network byte order. */
+struct cm_rail_offer_t {
+    /** The rails whose port is up. */
+    uint32_t active;
+    /** The rails whose device is on the NUMA node of the connection's
+     * buffers. */
+    uint32_t local;
+} __attribute__((packed));
+
+/** The rails that both ends of a connection agreed on. */
+struct rail_choice {
+    /** The rail to create the connection's queue pair on. */
+    rdma_rail *primary;
+    /** The rail of the queue pair the connection fails over to, or null if
+     * there is no other rail. */
+    rdma_rail *standby;
+};
+
+/**
+ * @param rails Some rails.
+ * @param mask A set of rail ids.
+ * @return The rails whose id is in the set.
+ */
+static std::vector<rdma_rail *> rails_in(const std::vector<rdma_rail *> &rails,
+                                         uint32_t mask) {
+    std::vector<rdma_rail *> selected;
+    for(rdma_rail *rail : rails) {
+        if(mask & (1u << rail->id)) {
+            selected.push_back(rail);
+        }
+    }
+    return selected;
+}
+
+/**
+ * @param candidates The rails to pick from.
+ * @param turn The turn of the connection, which both ends compute alike.
+ * @return The rail whose turn it is.
+ */
+static rdma_rail *pick_rail(const std::vector<rdma_rail *> &candidates,
+                            unsigned long turn) {
+    if(rails_policy != rail_policy::weighted) {
+        return candidates[turn % candidates.size()];
+    }
+    unsigned long total_weight = 0;
+    for(rdma_rail *rail : candidates) {
+        total_weight += rail->weight;
+    }
+    if(total_weight == 0) {
+        return candidates[turn % candidates.size()];
+    }
+    turn %= total_weight;
+    for(rdma_rail *rail : candidates) {
+        if(turn < rail->weight) {
+            return rail;
+        }
+        turn -= rail->weight;
+    }
+    return candidates.back();
+}
+
+/**
+ * @details
+ * The two nodes exchange which of their rails are up and, for
+ * rail_policy::numa_local, which are near the connection's buffers, and
+ * then make the same choice from the same inputs: only rails that are up at
+ * both ends are chosen from, so connections made after a port fails go on
+ * the surviving rails; numa_local prefers rails near the buffers at both
+ * ends, then those near the buffers of the lower-ranked node; and the turn
+ * of the connection comes from the two node ranks. This needs every node
+ * to open the same rails, in the same order and with the same weights. The
+ * standby rail is the next rail up at both ends after the primary one.
+ *
+ * @param r_index The node rank of the remote node.
+ * @param buffer The local buffer of the connection, for
+ * rail_policy::numa_local.
+ * @return The rails to create the connection's queue pairs on.
+ */
+static rail_choice agree_on_rails(int r_index, const char *buffer) {
+    uint32_t active = 0, local = 0;
+    const int node = rails_policy == rail_policy::numa_local
+                         ? memory_numa_node(buffer)
+                         : ANY_NUMA_NODE;
+    for(const auto &rail : g_res->rails) {
+        if(rail_active(rail.get())) {
+            active |= 1u << rail->id;
+        }
+        if(node != ANY_NUMA_NODE && rail->device->numa_node == node) {
+            local |= 1u << rail->id;
+        }
+    }
+    cm_rail_offer_t local_offer, remote_offer;
+    local_offer.active = htonl(active);
+    local_offer.local = htonl(local);
+    bool success =
+        sst_connections->exchange(r_index, local_offer, remote_offer);
+    check_for_error(success, "Could not exchange rail offers with node " +
+                                 std::to_string(r_index));
+    const uint32_t remote_active = success ? ntohl(remote_offer.active) : 0;
+    const uint32_t remote_local = success ? ntohl(remote_offer.local) : 0;
+
+    std::vector<rdma_rail *> rails;
+    for(const auto &rail : g_res->rails) {
+        rails.push_back(rail.get());
+    }
+    std::vector<rdma_rail *> candidates =
+        rails_in(rails, active & remote_active);
+    if(candidates.empty()) {
+        check_for_error(false, "No RDMA rail is up at both ends of the "
+                               "connection with node " +
+                                   std::to_string(r_index) +
+                                   "; using the first rail");
+        return {rails.front(), nullptr};
+    }
+    std::vector<rdma_rail *> preferred = candidates;
+    if(rails_policy == rail_policy::numa_local) {
+        const uint32_t lower_local =
+            (int)local_rank < r_index ? local : remote_local;
+        for(uint32_t mask : {local & remote_local, lower_local}) {
+            std::vector<rdma_rail *> near = rails_in(candidates, mask);
+            if(!near.empty()) {
+                preferred.swap(near);
+                break;
+            }
+        }
+    }
+    rail_choice choice{
+        pick_rail(preferred, (unsigned long)local_rank + r_index), nullptr};
+    if(candidates.size() > 1) {
+        auto primary =
+            std::find(candidates.begin(), candidates.end(), choice.primary);
+        choice.standby = ++primary == candidates.end() ? candidates.front()
+                                                        : *primary;
+    }
+    return choice;
+}
+
 /**
  * Initializes the resources. Registers write_addr and read_addr as the read
  * and write buffers and connects a queue pair with the specified remote node.
+ * Buffers inside memory passed to verbs_register_memory() reuse its memory
+ * region instead of registering their own.
  *
  * @param r_index The node rank of the remote node to connect to.
  * @param write_addr A pointer to the memory to use as the write buffer. This
@@ -95,11 +419,77 @@ struct global_resources *g_res;
  * where the results of RDMA reads from the remote node will arrive.
  * @param size_w The size of the write buffer (in bytes).
  * @param size_r The size of the read buffer (in bytes).
+ * @param cq The completion queue to report completions to, or null for the
+ * queue shared by connections created without one.
+ * @param connect Whether to connect the queue pair now, along with a
+ * standby one on a second rail if there is one; if not, the caller connects
+ * it, as verbs_make_connections() does for many at once.
+ * @param _rail The rail to create the queue pair on if `connect` is false,
+ * or null for the first rail; otherwise the rails are agreed on with the
+ * remote node.
+ */
+resources::resources(int r_index, char *write_addr, char *read_addr, int size_w,
+                     int size_r, verbs_completion_queue *cq, bool connect,
+                     rdma_rail *_rail) {
+    rail_choice rails{_rail ? _rail : g_res->rails.front().get(), nullptr};
+    if(connect) {
+        rails = agree_on_rails(r_index, write_addr);
+    }
+    rail = rails.primary;
+    init_buffers(r_index, write_addr, read_addr, size_w, size_r);
+
+    // same completion queue for both send and receive operations
+    if(!cq) {
+        cq = g_res->cq;
+    }
+    qp = create_qp(cq, rail, MAX_SEND_WR, max_inline_data);
+    if(qp) {
+        ++rail->num_queue_pairs;
+    }
+
+    // connect the QPs
+    if(connect) {
+        if(rails.standby) {
+            standby = std::make_unique<resources>(r_index, write_addr,
+                                                  read_addr, size_w, size_r,
+                                                  cq, false, rails.standby);
+        }
+        connect_qp();
+        cout << "Established RDMA connection with node " << r_index << endl;
+    }
+}
+
+/**
+ * Initializes the resources on a queue pair shared with other connections to
+ * the same node. Registers write_addr and read_addr as the read and write
+ * buffers, but leaves `remote_props` for the caller to fill in.
+ *
+ * @param r_index The node rank of the remote node the queue pair connects
+ * to.
+ * @param write_addr A pointer to the memory to use as the write buffer.
+ * @param read_addr A pointer to the memory to use as the read buffer.
+ * @param size_w The size of the write buffer (in bytes).
+ * @param size_r The size of the read buffer (in bytes).
+ * @param _shared_qp The queue pair to post on.
  */
 resources::resources(int r_index, char *write_addr, char *read_addr, int size_w,
-                     int size_r) {
+                     int size_r, std::shared_ptr<shared_queue_pair> _shared_qp)
+    : rail(_shared_qp->rail), shared_qp(_shared_qp) {
+    init_buffers(r_index, write_addr, read_addr, size_w, size_r);
+    qp = shared_qp->qp;
+    max_inline_data = shared_qp->max_inline_data;
+}
+
+/**
+ * Registers the buffers of this connection, unless they lie in a registered
+ * table.
+ */
+void resources::init_buffers(int r_index, char *write_addr, char *read_addr,
+                             int size_w, int size_r) {
     // set the remote index
     remote_index = r_index;
+    unsignaled_writes = 0;
+    atomic_mr = NULL;
 
     write_buf = write_addr;
     check_for_error(write_buf, "Write address is NULL");
@@ -107,14 +497,9 @@ resources::resources(int r_index, char *write_addr, char *read_addr, int size_w,
     read_buf = read_addr;
     check_for_error(read_buf, "Read address is NULL");
 
-    // register the memory buffer
-    int mr_flags = 0;
-    // allow access for only local writes and remote reads
-    mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
-               IBV_ACCESS_REMOTE_WRITE;
-    // register memory with the protection domain and the buffer
-    write_mr = ibv_reg_mr(g_res->pd, write_buf, size_w, mr_flags);
-    read_mr = ibv_reg_mr(g_res->pd, read_buf, size_r, mr_flags);
+    // register the memory buffers, unless they lie in a registered table
+    write_mr = acquire_memory(rail->device->pd, write_buf, size_w);
+    read_mr = acquire_memory(rail->device->pd, read_buf, size_r);
     check_for_error(
         write_mr,
         "Could not register memory region : write_mr, error code is : " +
@@ -123,29 +508,47 @@ resources::resources(int r_index, char *write_addr, char *read_addr, int size_w,
         read_mr,
         "Could not register memory region : read_mr, error code is : " +
             std::to_string(errno));
+}
 
+/**
+ * @param cq The completion queue for both send and receive operations.
+ * @param rail The rail to create the queue pair on.
+ * @param max_send_wr The depth of the send queue.
+ * @param max_inline_data Set to the largest write the device agreed to send
+ * inline.
+ * @return The queue pair, in the reset state.
+ */
+static struct ibv_qp *create_qp(verbs_completion_queue *cq, rdma_rail *rail,
+                                unsigned int max_send_wr,
+                                uint32_t &max_inline_data) {
     // set the queue pair up for creation
     struct ibv_qp_init_attr qp_init_attr;
     memset(&qp_init_attr, 0, sizeof(qp_init_attr));
     qp_init_attr.qp_type = IBV_QPT_RC;
-    qp_init_attr.sq_sig_all = 1;
-    // same completion queue for both send and receive operations
-    qp_init_attr.send_cq = g_res->cq;
-    qp_init_attr.recv_cq = g_res->cq;
+    // only operations posted with IBV_SEND_SIGNALED generate completions
+    qp_init_attr.sq_sig_all = 0;
+    qp_init_attr.send_cq = cq->cqs[rail->device->index];
+    qp_init_attr.recv_cq = cq->cqs[rail->device->index];
     // allow a lot of requests at a time
-    qp_init_attr.cap.max_send_wr = 10;
-    qp_init_attr.cap.max_recv_wr = 10;
+    qp_init_attr.cap.max_send_wr = max_send_wr;
+    qp_init_attr.cap.max_recv_wr = MAX_RECV_WR;
     qp_init_attr.cap.max_send_sge = 1;
     qp_init_attr.cap.max_recv_sge = 1;
+    // ask for inline sends, settling for less if the device refuses
+    qp_init_attr.cap.max_inline_data = MAX_INLINE_DATA;
     // create the queue pair
-    qp = ibv_create_qp(g_res->pd, &qp_init_attr);
+    struct ibv_pd *pd = rail->device->pd;
+    struct ibv_qp *qp = ibv_create_qp(pd, &qp_init_attr);
+    while(!qp && qp_init_attr.cap.max_inline_data > 0) {
+        qp_init_attr.cap.max_inline_data /= 2;
+        qp = ibv_create_qp(pd, &qp_init_attr);
+    }
+    // the device reports the inline size it actually granted
+    max_inline_data = qp ? qp_init_attr.cap.max_inline_data : 0;
 
     check_for_error(qp, "Could not create queue pair, error code is : " +
                             std::to_string(errno));
-
-    // connect the QPs
-    connect_qp();
-    cout << "Established RDMA connection with node " << r_index << endl;
+    return qp;
 }
 
 /**
@@ -153,26 +556,35 @@ resources::resources(int r_index, char *write_addr, char *read_addr, int size_w,
  */
 resources::~resources() {
     int rc = 0;
-    if(qp) {
+    // a shared queue pair is destroyed with its last user
+    if(qp && !shared_qp) {
         rc = ibv_destroy_qp(qp);
         check_for_error(qp, "Could not destroy queue pair, error code is " +
                                 std::to_string(rc));
+        --rail->num_queue_pairs;
     }
 
     if(write_mr) {
-        rc = ibv_dereg_mr(write_mr);
+        rc = release_memory(write_mr);
         check_for_error(
             !rc,
             "Could not de-register memory region : write_mr, error code is " +
                 std::to_string(rc));
     }
     if(read_mr) {
-        rc = ibv_dereg_mr(read_mr);
+        rc = release_memory(read_mr);
         check_for_error(
             !rc,
             "Could not de-register memory region : read_mr, error code is " +
                 std::to_string(rc));
     }
+    if(atomic_mr) {
+        rc = release_memory(atomic_mr);
+        check_for_error(
+            !rc,
+            "Could not de-register memory region : atomic_mr, error code is " +
+                std::to_string(rc));
+    }
 }
 
 /**
@@ -185,11 +597,11 @@ void resources::set_qp_initialized() {
     memset(&attr, 0, sizeof(attr));
     // the init state
     attr.qp_state = IBV_QPS_INIT;
-    attr.port_num = ib_port;
+    attr.port_num = rail->port;
     attr.pkey_index = 0;
-    // give access to local writes and remote reads
+    // give access to local writes and remote reads, writes and atomics
     attr.qp_access_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
-                           IBV_ACCESS_REMOTE_WRITE;
+                           IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
     flags =
         IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS;
     // modify the queue pair to init state
@@ -209,7 +621,9 @@ void resources::set_qp_ready_to_receive() {
     // set the queue pair number of the remote side
     attr.dest_qp_num = remote_props.qp_num;
     attr.rq_psn = 0;
-    attr.max_dest_rd_atomic = 1;
+    // reads and atomics the remote side may have outstanding against us
+    attr.max_dest_rd_atomic = std::max(
+        1, std::min(MAX_RD_ATOMIC, rail->device->device_attr.max_qp_rd_atom));
     attr.min_rnr_timer = 0x12;
     attr.ah_attr.is_global = 0;
     // set the local id of the remote side
@@ -217,10 +631,9 @@ void resources::set_qp_ready_to_receive() {
     attr.ah_attr.sl = 0;
     attr.ah_attr.src_path_bits = 0;
     // the infiniband port to associate with
-    attr.ah_attr.port_num = ib_port;
+    attr.ah_attr.port_num = rail->port;
     if(gid_idx >= 0) {
         attr.ah_attr.is_global = 1;
-        attr.ah_attr.port_num = 1;
         memcpy(&attr.ah_attr.grh.dgid, remote_props.gid, 16);
         attr.ah_attr.grh.flow_label = 0;
         attr.ah_attr.grh.hop_limit = 1;
@@ -244,9 +657,15 @@ void resources::set_qp_ready_to_send() {
     attr.qp_state = IBV_QPS_RTS;
     attr.timeout = 4;  // The timeout is 4.096x2^(timeout) microseconds
     attr.retry_cnt = 6;
-    attr.rnr_retry = 0;
+    // a notification that finds no receive posted waits for the receiver to
+    // post one, instead of failing the queue pair
+    attr.rnr_retry = 7;
     attr.sq_psn = 0;
-    attr.max_rd_atomic = 1;
+    // reads and atomics we may have outstanding; the remote side grants as
+    // many, since it uses the same device limits
+    attr.max_rd_atomic = std::max(
+        1, std::min(MAX_RD_ATOMIC,
+                    rail->device->device_attr.max_qp_init_rd_atom));
     flags = IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
             IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC;
     rc = ibv_modify_qp(qp, &attr, flags);
@@ -257,36 +676,34 @@ void resources::set_qp_ready_to_send() {
 }
 
 /**
- * This method implements the entire setup of the queue pairs, calling all the
- * `modify_qp_*` methods in the process.
+ * @return The data the remote side needs to connect to this queue pair, in
+ * network byte order.
  */
-void resources::connect_qp() {
-    // local connection data
+cm_con_data_t resources::get_local_con_data() const {
     struct cm_con_data_t local_con_data;
-    // remote connection data. Obtained via TCP
-    struct cm_con_data_t remote_con_data;
-    // this is used to ensure that host byte order is correct at each node
-    struct cm_con_data_t tmp_con_data;
-
     union ibv_gid my_gid;
     if(gid_idx >= 0) {
-        int rc = ibv_query_gid(g_res->ib_ctx, ib_port, gid_idx, &my_gid);
+        int rc = ibv_query_gid(rail->device->ib_ctx, rail->port, gid_idx,
+                               &my_gid);
         check_for_error(!rc, "ibv_query_gid failed, error code is " +
                                  std::to_string(errno));
     } else {
         memset(&my_gid, 0, sizeof my_gid);
     }
-
-    // exchange using TCP sockets info required to connect QPs
     local_con_data.addr = htonll((uintptr_t)(char *)write_buf);
     local_con_data.rkey = htonl(write_mr->rkey);
     local_con_data.qp_num = htonl(qp->qp_num);
-    local_con_data.lid = htons(g_res->port_attr.lid);
+    local_con_data.lid = htons(rail->port_attr.lid);
     memcpy(local_con_data.gid, &my_gid, 16);
-    bool success =
-        sst_connections->exchange(remote_index, local_con_data, tmp_con_data);
-    check_for_error(success,
-                    "Could not exchange qp data in connect_qp");
+    return local_con_data;
+}
+
+/**
+ * @param tmp_con_data The data of the remote side, in network byte order.
+ */
+void resources::set_remote_con_data(const cm_con_data_t &tmp_con_data) {
+    // this is used to ensure that host byte order is correct at each node
+    struct cm_con_data_t remote_con_data;
     remote_con_data.addr = ntohll(tmp_con_data.addr);
     remote_con_data.rkey = ntohl(tmp_con_data.rkey);
     remote_con_data.qp_num = ntohl(tmp_con_data.qp_num);
@@ -294,7 +711,13 @@ void resources::connect_qp() {
     memcpy(remote_con_data.gid, tmp_con_data.gid, 16);
     // save the remote side attributes, we will need it for the post SR
     remote_props = remote_con_data;
+    init_send_templates();
+}
 
+/**
+ * This needs `remote_props` to be filled in.
+ */
+void resources::set_qp_ready() {
     // modify the QP to init
     set_qp_initialized();
 
@@ -303,6 +726,30 @@ void resources::connect_qp() {
 
     // modify it to RTS
     set_qp_ready_to_send();
+}
+
+/**
+ * This method implements the entire setup of the queue pairs, calling all the
+ * `modify_qp_*` methods in the process.
+ */
+void resources::connect_qp() {
+    // exchange using TCP sockets info required to connect QPs
+    struct cm_con_data_t tmp_con_data;
+    bool success = sst_connections->exchange(
+        remote_index, get_local_con_data(), tmp_con_data);
+    check_for_error(success,
+                    "Could not exchange qp data in connect_qp");
+    set_remote_con_data(tmp_con_data);
+    if(standby) {
+        success = sst_connections->exchange(
+            remote_index, standby->get_local_con_data(), tmp_con_data);
+        check_for_error(success,
+                        "Could not exchange standby qp data in connect_qp");
+        standby->set_remote_con_data(tmp_con_data);
+        standby->set_qp_ready();
+    }
+
+    set_qp_ready();
 
     // sync to make sure that both sides are in states that they can connect to
     // prevent packet loss
@@ -313,6 +760,38 @@ void resources::connect_qp() {
         "Could not sync in connect_qp after qp transition to RTS state");
 }
 
+/**
+ * Everything in a work request except the offset and size is the same for
+ * every operation on this connection, so it is built once here and copied by
+ * prepare_remote_send().
+ */
+void resources::init_send_templates() {
+    // prepare the scatter/gather entry
+    memset(&sge_template, 0, sizeof(sge_template));
+    // don't care where the read buffer is saved
+    sge_template.addr = (uintptr_t)read_buf;
+    sge_template.lkey = read_mr->lkey;
+    // prepare the send work requests
+    for(int op = 0; op < 2; ++op) {
+        struct ibv_send_wr &sr = send_templates[op];
+        memset(&sr, 0, sizeof(sr));
+        sr.next = NULL;
+        // the tag is filled in by prepare_remote_send()
+        sr.wr_id = 0;
+        sr.num_sge = 1;
+        // set opcode depending on op parameter
+        if(op == 0) {
+            sr.opcode = IBV_WR_RDMA_READ;
+        } else {
+            sr.opcode = IBV_WR_RDMA_WRITE;
+        }
+        sr.send_flags = IBV_SEND_SIGNALED;
+        // set the remote rkey and virtual address
+        sr.wr.rdma.remote_addr = remote_props.addr;
+        sr.wr.rdma.rkey = remote_props.rkey;
+    }
+}
+
 /**
  * This is used for both reads and writes.
  *
@@ -326,30 +805,16 @@ int resources::post_remote_send(long long int offset, long long int size,
     struct ibv_send_wr sr;
     struct ibv_sge sge;
     struct ibv_send_wr *bad_wr = NULL;
-
-    // prepare the scatter/gather entry
-    memset(&sge, 0, sizeof(sge));
-    // don't care where the read buffer is saved
-    sge.addr = (uintptr_t)(read_buf + offset);
-    sge.length = size;
-    sge.lkey = read_mr->lkey;
-    // prepare the send work request
-    memset(&sr, 0, sizeof(sr));
-    sr.next = NULL;
-    sr.wr_id = 0;
-    sr.sg_list = &sge;
-    sr.num_sge = 1;
-    // set opcode depending on op parameter
-    if(op == 0) {
-        sr.opcode = IBV_WR_RDMA_READ;
+    prepare_remote_send(offset, size, op, sr, sge);
+    if(op == 1) {
+        // this write is signaled, so it confirms the unsignaled ones
+        unsignaled_writes = 0;
+        rail->num_writes.fetch_add(1, std::memory_order_relaxed);
+        rail->bytes_written.fetch_add(size, std::memory_order_relaxed);
     } else {
-        sr.opcode = IBV_WR_RDMA_WRITE;
+        rail->num_reads.fetch_add(1, std::memory_order_relaxed);
+        rail->bytes_read.fetch_add(size, std::memory_order_relaxed);
     }
-    sr.send_flags = IBV_SEND_SIGNALED;
-
-    // set the remote rkey and virtual address
-    sr.wr.rdma.remote_addr = remote_props.addr + offset;
-    sr.wr.rdma.rkey = remote_props.rkey;
 
     // there is a receive request in the responder side, so we won't get any
     // into
@@ -397,79 +862,994 @@ void resources::post_remote_write(long long int offset, long long int size) {
         !rc, "Could not post RDMA write, error code is " + std::to_string(rc));
 }
 
+/**
+ * @param offset The offset, in bytes, of the remote memory buffer at which to
+ * start writing.
+ * @param size The number of bytes to write from the local buffer into remote
+ * memory.
+ * @param imm The value the remote node is notified with.
+ */
+void resources::post_remote_write_with_imm(long long int offset,
+                                           long long int size, uint32_t imm) {
+    struct ibv_send_wr sr;
+    struct ibv_sge sge;
+    struct ibv_send_wr *bad_wr = NULL;
+    prepare_remote_send(offset, size, 1, sr, sge);
+    sr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    sr.imm_data = htonl(imm);
+    unsignaled_writes = 0;
+    rail->num_writes.fetch_add(1, std::memory_order_relaxed);
+    rail->bytes_written.fetch_add(size, std::memory_order_relaxed);
+    int rc = ibv_post_send(qp, &sr, &bad_wr);
+    check_for_error(!rc, "Could not post RDMA write with immediate, error "
+                         "code is " +
+                             std::to_string(rc));
+}
+
+/**
+ * @param ranges The ranges of the remote memory buffer to write, in order.
+ * @param num_ranges The number of ranges in `ranges`.
+ * @param imm If not null, the value the remote node is notified with.
+ */
+void resources::post_remote_write_ranges(const byte_range *ranges,
+                                         std::size_t num_ranges,
+                                         const uint32_t *imm) {
+    connection *target = this;
+    verbs_post_remote_writes(&target, 1, ranges, num_ranges, signal_policy(),
+                             nullptr, imm);
+}
+
+/**
+ * Each notification consumes a receive, so the receive queue is filled here
+ * and refilled by notification_consumed(). A queue pair shared with other
+ * connections cannot take notifications, since the receives of all its
+ * users would be consumed in one order.
+ *
+ * @param _notify_tag The tag to report notifications with.
+ * @return False if the queue pair is shared.
+ */
+bool resources::enable_notifications(uint64_t _notify_tag) {
+    if(shared_qp) {
+        return false;
+    }
+    notify_tag = _notify_tag;
+    for(unsigned int i = 0; i < MAX_RECV_WR; ++i) {
+        notification_consumed();
+    }
+    if(standby) {
+        standby->enable_notifications(_notify_tag);
+    }
+    return true;
+}
+
 /**
  * @details
- * This blocks until either a single entry in the completion queue has
- * completed, or a timeout is reached. The timeout is set by the constant
- * MAX_POLL_CQ_TIMEOUT.
- * @return pair(qp_num,result) The queue pair number associated with the
- * completed request and the result (1 for successful, -1 for unsuccessful, 0 if
- * no completion found)
+ * Any failed operation puts a reliable queue pair in the error state, so a
+ * connection whose queue pair can still send has not failed: the failure
+ * came from a queue pair it already moved away from. Otherwise it moves,
+ * once, to its standby queue pair, if that one can still send and its rail
+ * is up. The caller must keep operations from being posted on the
+ * connection meanwhile.
+ *
+ * @param moved Set to whether the connection moved to its standby queue
+ * pair.
+ * @return False if the connection has no working queue pair left.
  */
-std::pair<int, int> verbs_poll_completion() {
-    struct ibv_wc wc;
-    unsigned long start_time_msec;
-    unsigned long cur_time_msec;
-    struct timeval cur_time;
-    int poll_result;
-
-    // poll the completion for a while before giving up of doing it ..
-    gettimeofday(&cur_time, NULL);
-    start_time_msec = (cur_time.tv_sec * 1000) + (cur_time.tv_usec / 1000);
-    do {
-        poll_result = ibv_poll_cq(g_res->cq, 1, &wc);
-        gettimeofday(&cur_time, NULL);
-        cur_time_msec = (cur_time.tv_sec * 1000) + (cur_time.tv_usec / 1000);
-    } while((poll_result == 0) &&
-            ((cur_time_msec - start_time_msec) < MAX_POLL_CQ_TIMEOUT));
-    //
-    //     gettimeofday(&cur_time, NULL);
-    //     cur_time_msec = (cur_time.tv_sec * 1000) + (cur_time.tv_usec / 1000);
-    //     unsigned long time_to_completion = cur_time_msec - start_time_msec;
-    //     if(time_to_completion > 1)
-    //         cout << "Poll completion time: " << time_to_completion << endl;
-    //     if (time_to_completion > max_time_to_completion) {
-    //         max_time_to_completion = time_to_completion;
-    //         cout << "New maximum completion time: " << max_time_to_completion
-    //         << endl;
-    //     }
-
-    // not sure what to do when we cannot read entries off the CQ
-    // this means that something is wrong with the local node
-    if(poll_result < 0) {
-        check_for_error(false, "Poll completion failed");
-        return {-1, 0};
+bool resources::fail_over(bool &moved) {
+    moved = false;
+    if(qp_ready(qp)) {
+        return true;
     }
-    if(poll_result == 0) {
-        check_for_error(false,
-                        "Completion wasn't found in the CQ after timeout");
-        return {-1, 0};
+    if(!standby || failed_over || !qp_ready(standby->qp) ||
+       !rail_active(standby->rail)) {
+        return false;
+    }
+    cout << "Moving the RDMA connection with node " << remote_index
+         << " from rail " << rail->id << " to rail " << standby->rail->id
+         << endl;
+    // the standby keeps the failed queue pair and releases it with itself
+    std::swap(qp, standby->qp);
+    std::swap(rail, standby->rail);
+    std::swap(write_mr, standby->write_mr);
+    std::swap(read_mr, standby->read_mr);
+    std::swap(remote_props, standby->remote_props);
+    std::swap(send_templates, standby->send_templates);
+    std::swap(sge_template, standby->sge_template);
+    std::swap(max_inline_data, standby->max_inline_data);
+    std::swap(atomic_mr, standby->atomic_mr);
+    unsignaled_writes = 0;
+    failed_over = moved = true;
+    return true;
+}
+
+/**
+ * The receive carries no buffer, since the data of a write with immediate
+ * lands in the remote buffer and only the immediate value is reported.
+ */
+void resources::notification_consumed() {
+    struct ibv_recv_wr rr;
+    struct ibv_recv_wr *bad_wr = NULL;
+    memset(&rr, 0, sizeof(rr));
+    rr.wr_id = notify_tag;
+    rr.sg_list = NULL;
+    rr.num_sge = 0;
+    int rc = ibv_post_recv(qp, &rr, &bad_wr);
+    check_for_error(!rc, "Could not post receive for notification, error "
+                         "code is " +
+                             std::to_string(rc));
+}
+
+/**
+ * The result buffer is registered the first time an atomic operation is
+ * posted, so connections that never use atomics do not pay for it.
+ *
+ * @param offset The offset, in bytes, of the remote buffer at which the
+ * 8-byte target lies; it may be negative, since the remote table is
+ * registered as a whole.
+ * @param op The operation to perform.
+ * @param compare_add The value to add, or the value to compare with.
+ * @param swap The value to store if the comparison succeeds.
+ * @param atomic_tag The tag to report the completion with.
+ * @return False if the device does not support atomic operations or the
+ * target is not 8-byte aligned.
+ */
+bool resources::post_remote_atomic(long long int offset, atomic_op op,
+                                   uint64_t compare_add, uint64_t swap,
+                                   uint64_t atomic_tag) {
+    uint64_t remote_addr = remote_props.addr + offset;
+    if(rail->device->device_attr.atomic_cap == IBV_ATOMIC_NONE ||
+       remote_addr % sizeof(uint64_t) != 0) {
+        return false;
     }
+    if(!atomic_mr) {
+        atomic_mr = acquire_memory(rail->device->pd, (char *)&atomic_result,
+                                   sizeof(atomic_result));
+        check_for_error(atomic_mr,
+                        "Could not register memory region : atomic_mr, error "
+                        "code is : " +
+                            std::to_string(errno));
+    }
+    struct ibv_sge sge;
+    memset(&sge, 0, sizeof(sge));
+    sge.addr = (uintptr_t)&atomic_result;
+    sge.length = sizeof(atomic_result);
+    sge.lkey = atomic_mr->lkey;
+    struct ibv_send_wr sr;
+    struct ibv_send_wr *bad_wr = NULL;
+    memset(&sr, 0, sizeof(sr));
+    sr.wr_id = atomic_tag;
+    sr.sg_list = &sge;
+    sr.num_sge = 1;
+    sr.opcode = op == atomic_op::fetch_add ? IBV_WR_ATOMIC_FETCH_AND_ADD
+                                           : IBV_WR_ATOMIC_CMP_AND_SWP;
+    sr.send_flags = IBV_SEND_SIGNALED;
+    sr.wr.atomic.remote_addr = remote_addr;
+    sr.wr.atomic.rkey = remote_props.rkey;
+    sr.wr.atomic.compare_add = compare_add;
+    sr.wr.atomic.swap = swap;
+    // this operation is signaled, so it confirms the unsignaled writes
+    unsignaled_writes = 0;
+    rail->num_atomics.fetch_add(1, std::memory_order_relaxed);
+    int rc = ibv_post_send(qp, &sr, &bad_wr);
+    check_for_error(!rc, "Could not post RDMA atomic operation, error code is " +
+                             std::to_string(rc));
+    return true;
+}
+
+/**
+ * @details
+ * This is the fan-out path of SST::put(); it is the ranges version below
+ * with a single range.
+ *
+ * @param targets The connections to write to; all must be resources.
+ * @param count The number of connections in `targets`.
+ * @param offset The offset, in bytes, of the remote memory buffer at which to
+ * start writing.
+ * @param size The number of bytes to write from the local buffer into remote
+ * memory.
+ * @param policy Which of the writes should produce a completion.
+ * @param signaled If not null, resized to `count` and set to whether the
+ * write to each target produces a completion.
+ * @param imm If not null, the writes are writes with immediate that notify
+ * their targets with this value.
+ * @return The number of completions to poll for.
+ */
+std::size_t verbs_post_remote_writes(connection *const *targets,
+                                     std::size_t count, long long int offset,
+                                     long long int size,
+                                     const signal_policy &policy,
+                                     std::vector<bool> *signaled,
+                                     const uint32_t *imm) {
+    const byte_range range{offset, size};
+    return verbs_post_remote_writes(targets, count, &range, 1, policy,
+                                    signaled, imm);
+}
+
+/**
+ * @details
+ * The work requests for a batch of targets are all built from their
+ * templates before any of them is posted, so the posting loop does nothing
+ * but ring one doorbell per queue pair. The writes to each target form one
+ * chain, one work request per range, since each range lands at a different
+ * remote address; a queue pair executes the chain in order, so only its last
+ * work request is ever signaled or carries the immediate.
+ *
+ * A chain is signaled once every `policy.interval` writes on its queue pair,
+ * and also if it is the last chain of the fan-out and `policy.signal_last`
+ * is set. The send queue slots of unsignaled writes are reclaimed in bulk
+ * when the next signaled write on the same queue pair completes; a failed
+ * write still produces an error completion whether it was signaled or not.
+ *
+ * @param targets The connections to write to; all must be resources.
+ * @param count The number of connections in `targets`.
+ * @param ranges The ranges of the remote buffer to write, in order.
+ * @param num_ranges The number of ranges in `ranges`.
+ * @param policy Which of the writes should produce a completion.
+ * @param signaled If not null, resized to `count` and set to whether the
+ * writes to each target produce a completion.
+ * @param imm If not null, the last write to each target is a write with
+ * immediate that notifies it with this value.
+ * @return The number of completions to poll for.
+ */
+std::size_t verbs_post_remote_writes(connection *const *targets,
+                                     std::size_t count,
+                                     const byte_range *ranges,
+                                     std::size_t num_ranges,
+                                     const signal_policy &policy,
+                                     std::vector<bool> *signaled,
+                                     const uint32_t *imm) {
+    const std::size_t batch_size = 16;
+    const unsigned int interval =
+        std::min(std::max(policy.interval, 1u), MAX_SEND_WR / 2);
+    static thread_local std::vector<struct ibv_send_wr> wrs;
+    static thread_local std::vector<struct ibv_sge> sges;
+    wrs.resize(batch_size * num_ranges);
+    sges.resize(batch_size * num_ranges);
+    struct ibv_send_wr *bad_wr = NULL;
+    std::size_t num_signaled = 0;
+    if(signaled) {
+        signaled->assign(count, false);
+    }
+    long long int total_size = 0;
+    for(std::size_t j = 0; j < num_ranges; ++j) {
+        total_size += ranges[j].size;
+    }
+    for(std::size_t first = 0; first < count; first += batch_size) {
+        std::size_t num_chains = std::min(batch_size, count - first);
+        for(std::size_t i = 0; i < num_chains; ++i) {
+            resources *res = static_cast<resources *>(targets[first + i]);
+            struct ibv_send_wr *chain = &wrs[i * num_ranges];
+            for(std::size_t j = 0; j < num_ranges; ++j) {
+                res->prepare_remote_send(ranges[j].offset, ranges[j].size, 1,
+                                         chain[j], sges[i * num_ranges + j]);
+                if(j + 1 < num_ranges) {
+                    chain[j].send_flags &= ~IBV_SEND_SIGNALED;
+                    chain[j].next = &chain[j + 1];
+                }
+            }
+            struct ibv_send_wr &last = chain[num_ranges - 1];
+            if(imm) {
+                last.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+                last.imm_data = htonl(*imm);
+            }
+            res->unsignaled_writes += num_ranges;
+            bool signal = res->unsignaled_writes >= interval ||
+                          (policy.signal_last && first + i + 1 == count);
+            if(signal) {
+                res->unsignaled_writes = 0;
+                ++num_signaled;
+                if(signaled) {
+                    (*signaled)[first + i] = true;
+                }
+            } else {
+                last.send_flags &= ~IBV_SEND_SIGNALED;
+            }
+        }
+        for(std::size_t i = 0; i < num_chains; ++i) {
+            resources *res = static_cast<resources *>(targets[first + i]);
+            int rc = ibv_post_send(res->qp, &wrs[i * num_ranges], &bad_wr);
+            check_for_error(!rc, "Could not post RDMA write, error code is " +
+                                     std::to_string(rc));
+            res->rail->num_writes.fetch_add(num_ranges,
+                                            std::memory_order_relaxed);
+            res->rail->bytes_written.fetch_add(total_size,
+                                               std::memory_order_relaxed);
+        }
+    }
+    return num_signaled;
+}
+
+/** Converts a work completion to the completion reported to pollers. */
+static completion to_completion(const struct ibv_wc &wc) {
     // check the completion status (here we don't care about the completion
     // opcode)
+    completion entry{wc.wr_id, 1};
     if(wc.status != IBV_WC_SUCCESS) {
-        cout << "got bad completion with status: 0x%x, vendor syndrome: "
-             << wc.status << ", " << wc.vendor_err;
-        return {wc.qp_num, -1};
+        cout << "got bad completion with status: " << wc.status
+             << ", vendor syndrome: " << wc.vendor_err << endl;
+        entry.result = -1;
+    } else if(wc.wc_flags & IBV_WC_WITH_IMM) {
+        // the receive of a notification
+        entry.imm = ntohl(wc.imm_data);
+    }
+    return entry;
+}
+
+/**
+ * @details
+ * A queue pair can only report to a completion queue of its own device, so
+ * there is one per opened device, each capped at the limit of its device.
+ *
+ * @param size The minimum number of entries of the completion queue.
+ * @param with_channel Whether to create event channels, so that pollers
+ * can sleep in wait() instead of spinning.
+ */
+verbs_completion_queue::verbs_completion_queue(int size, bool with_channel)
+    : num_stashed(0) {
+    for(const auto &device : g_res->devices) {
+        struct ibv_comp_channel *channel = NULL;
+        if(with_channel) {
+            channel = ibv_create_comp_channel(device->ib_ctx);
+            check_for_error(
+                channel, "Could not create completion channel, error code is " +
+                             std::to_string(errno));
+            if(channel) {
+                // several threads may wait on the channel, and only one of
+                // them gets each event
+                int flags = fcntl(channel->fd, F_GETFL);
+                fcntl(channel->fd, F_SETFL, flags | O_NONBLOCK);
+                channels.push_back(channel);
+            }
+        }
+        int device_size = size;
+        if(device->device_attr.max_cqe > 0) {
+            device_size = std::min(device_size, device->device_attr.max_cqe);
+        }
+        struct ibv_cq *cq =
+            ibv_create_cq(device->ib_ctx, device_size, NULL, channel, 0);
+        check_for_error(cq,
+                        "Could not create completion queue, error code is " +
+                            std::to_string(errno));
+        cqs.push_back(cq);
+    }
+}
+
+/**
+ * All the queue pairs that complete into this queue must be destroyed first.
+ */
+verbs_completion_queue::~verbs_completion_queue() {
+    for(struct ibv_cq *cq : cqs) {
+        if(cq) {
+            int rc = ibv_destroy_cq(cq);
+            check_for_error(!rc, "Could not destroy completion queue");
+        }
+    }
+    for(struct ibv_comp_channel *channel : channels) {
+        int rc = ibv_destroy_comp_channel(channel);
+        check_for_error(!rc, "Could not destroy completion channel");
+    }
+}
+
+void verbs_completion_queue::stash(const completion &entry) {
+    std::lock_guard<std::mutex> lock(stash_mutex);
+    stashed[tag_owner(entry.tag)].push_back(entry);
+    ++num_stashed;
+}
+
+/**
+ * @details
+ * The queues are armed before they are checked one last time, since
+ * completions that arrived before they were armed raise no event; any found
+ * are stashed for their owners. Without event channels, this just sleeps.
+ *
+ * @param timeout_us The longest time to sleep, in microseconds.
+ */
+void verbs_completion_queue::wait(int timeout_us) {
+    if(channels.empty()) {
+        completion_queue::wait(timeout_us);
+        return;
+    }
+    for(struct ibv_cq *cq : cqs) {
+        int rc = ibv_req_notify_cq(cq, 0);
+        check_for_error(!rc, "Could not arm completion queue, error code is " +
+                                 std::to_string(rc));
+    }
+    struct ibv_wc wcs[POLL_BATCH_SIZE];
+    bool found = false;
+    for(struct ibv_cq *cq : cqs) {
+        int poll_result = ibv_poll_cq(cq, POLL_BATCH_SIZE, wcs);
+        for(int i = 0; i < poll_result; ++i) {
+            stash(to_completion(wcs[i]));
+            found = true;
+        }
+    }
+    if(found) {
+        return;
+    }
+    std::vector<struct pollfd> fds(channels.size());
+    for(std::size_t i = 0; i < channels.size(); ++i) {
+        fds[i].fd = channels[i]->fd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    struct timespec timeout;
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000L;
+    if(ppoll(fds.data(), fds.size(), &timeout, NULL) > 0) {
+        for(std::size_t i = 0; i < channels.size(); ++i) {
+            if(!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            struct ibv_cq *event_cq;
+            void *event_context;
+            if(ibv_get_cq_event(channels[i], &event_cq, &event_context) ==
+               0) {
+                ibv_ack_cq_events(event_cq, 1);
+            }
+        }
+    }
+}
+
+/**
+ * @param owner The owner part of the tags of the completions to take.
+ * @param entries The array to move the completions to.
+ * @param max_entries The maximum number of completions to take.
+ * @return The number of completions moved to `entries`.
+ */
+int verbs_completion_queue::take_stashed(uint32_t owner, completion *entries,
+                                         int max_entries) {
+    if(num_stashed.load(std::memory_order_acquire) == 0) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(stash_mutex);
+    auto it = stashed.find(owner);
+    if(it == stashed.end()) {
+        return 0;
+    }
+    int num_taken = take_completions(it->second, owner, entries, max_entries);
+    num_stashed -= num_taken;
+    return num_taken;
+}
+
+/**
+ * @details
+ * The completion queue is drained POLL_BATCH_SIZE entries at a time, and the
+ * work request id of each entry, which is the tag of its connection, says
+ * who the completion is for. Completions for other owners, and any beyond
+ * `max_entries`, are stashed for their owners' next poll. The clock is only
+ * read once every POLLS_PER_TIMEOUT_CHECK empty polls, and the timeout is set
+ * by the constant MAX_POLL_CQ_TIMEOUT.
+ *
+ * @param owner The owner part of the tags of the connections to poll.
+ * @param entries The array to store the completions in.
+ * @param max_entries The maximum number of completions to return.
+ * @param block Whether to wait for a completion; if false, the queue is
+ * drained once and only the completions that were ready are returned.
+ * @return The number of completions stored in `entries`, or 0 if none was
+ * found before the timeout.
+ */
+int verbs_completion_queue::poll(uint32_t owner, completion *entries,
+                                 int max_entries, bool block) {
+    int num_polled = take_stashed(owner, entries, max_entries);
+    if(num_polled > 0) {
+        return num_polled;
+    }
+    struct ibv_wc wcs[POLL_BATCH_SIZE];
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(MAX_POLL_CQ_TIMEOUT);
+    for(unsigned int num_empty_polls = 1;; ++num_empty_polls) {
+        for(struct ibv_cq *cq : cqs) {
+            int poll_result = ibv_poll_cq(cq, POLL_BATCH_SIZE, wcs);
+            // not sure what to do when we cannot read entries off the CQ
+            // this means that something is wrong with the local node
+            if(poll_result < 0) {
+                check_for_error(false, "Poll completion failed");
+                return 0;
+            }
+            for(int i = 0; i < poll_result; ++i) {
+                completion entry = to_completion(wcs[i]);
+                if(tag_owner(entry.tag) == owner &&
+                   num_polled < max_entries) {
+                    entries[num_polled++] = entry;
+                } else {
+                    stash(entry);
+                }
+            }
+        }
+        if(num_polled > 0) {
+            return num_polled;
+        }
+        // another poller may have drained our completions
+        num_polled = take_stashed(owner, entries, max_entries);
+        if(num_polled > 0 || !block) {
+            return num_polled;
+        }
+        if(num_empty_polls % POLLS_PER_TIMEOUT_CHECK == 0 &&
+           std::chrono::steady_clock::now() >= deadline) {
+            check_for_error(false,
+                            "Completion wasn't found in the CQ after timeout");
+            return 0;
+        }
+    }
+}
+
+/**
+ * @details
+ * Each queue pair can have up to MAX_SEND_WR operations outstanding, and
+ * MAX_RECV_WR receives if it takes notifications, so the queue has room for
+ * all of them, up to the limit of each device. With more than one rail,
+ * each connection also has a standby queue pair, whose receives are all
+ * flushed into the queue when the connection fails over, so the queue has
+ * room for those too; overrunning it would break every queue pair on it.
+ *
+ * @param num_connections The number of connections that will complete into
+ * the queue.
+ * @param with_channel Whether pollers may sleep on the queue.
+ * @param with_receives Whether the connections will take notifications.
+ * @return The completion queue.
+ */
+std::unique_ptr<verbs_completion_queue> verbs_make_completion_queue(
+    std::size_t num_connections, bool with_channel, bool with_receives) {
+    std::size_t depth = MAX_SEND_WR + (with_receives ? MAX_RECV_WR : 0);
+    if(g_res->rails.size() > 1) {
+        depth *= 2;
+    }
+    int size = std::max<std::size_t>(num_connections, 1) * depth;
+    return std::make_unique<verbs_completion_queue>(size, with_channel);
+}
+
+/** The data two nodes exchange to decide whether a new connection can
+ * share a pooled queue pair; fields are in network byte order. */
+struct cm_pool_offer_t {
+    /** Buffer address */
+    uint64_t addr;
+    /** Remote key */
+    uint32_t rkey;
+    /** Number of the pooled queue pair offered, or 0 if none. */
+    uint32_t qp_num;
+    /** Number of the remote queue pair it is connected to. */
+    uint32_t remote_qp_num;
+} __attribute__((packed));
+
+/** The pooled queue pairs to each remote node, keyed by node rank. The pool
+ * keeps them alive until verbs_destroy(), so that the next SST can reuse
+ * them. */
+static std::map<int, std::vector<std::shared_ptr<shared_queue_pair>>> qp_pool;
+/** Protects `qp_pool` and `pool_cq`. */
+static std::mutex qp_pool_mutex;
+/** The completion queue of all the pooled queue pairs. */
+static std::shared_ptr<verbs_completion_queue> pool_cq;
+
+shared_queue_pair::~shared_queue_pair() {
+    int rc = ibv_destroy_qp(qp);
+    check_for_error(!rc, "Could not destroy queue pair, error code is " +
+                             std::to_string(rc));
+    --rail->num_queue_pairs;
+}
+
+/**
+ * @details
+ * The queue is created with an event channel the first time it is asked
+ * for, so that SSTs with any idle_wait policy can share it.
+ *
+ * @return The completion queue of the pooled queue pairs.
+ */
+std::shared_ptr<verbs_completion_queue> verbs_shared_completion_queue() {
+    std::lock_guard<std::mutex> lock(qp_pool_mutex);
+    if(!pool_cq) {
+        pool_cq = std::make_shared<verbs_completion_queue>(POOL_CQ_SIZE, true);
+    }
+    return pool_cq;
+}
+
+/**
+ * @param r_index The node rank of a remote node.
+ * @return The first pooled queue pair to the node that is still usable, on
+ * a rail that is up, and has room for another user, or null if there is
+ * none.
+ */
+static std::shared_ptr<shared_queue_pair> pool_candidate(int r_index) {
+    std::lock_guard<std::mutex> lock(qp_pool_mutex);
+    for(const auto &pooled : qp_pool[r_index]) {
+        // the pool holds one reference itself
+        if(pooled.use_count() - 1 >= (long)MAX_QP_SHARERS ||
+           !rail_active(pooled->rail)) {
+            continue;
+        }
+        if(qp_ready(pooled->qp)) {
+            return pooled;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Makes a connection on a pooled queue pair. Both nodes offer the pooled
+ * queue pair they would use; if the offers name the two ends of the same
+ * connected pair, it is shared, which costs one round trip. Otherwise, for
+ * instance because one node has seen the pair fail, both connect a new
+ * pooled queue pair.
+ *
+ * @param request The connection to make.
+ * @return The connection.
+ */
+static resources *connect_shared(const connection_request &request) {
+    const int r_index = request.r_index;
+    std::shared_ptr<shared_queue_pair> candidate = pool_candidate(r_index);
+    std::unique_ptr<resources> res;
+    cm_pool_offer_t local_offer, remote_offer;
+    memset(&local_offer, 0, sizeof(local_offer));
+    if(candidate) {
+        res = std::make_unique<resources>(r_index, request.write_addr,
+                                          request.read_addr, request.size_w,
+                                          request.size_r, candidate);
+        local_offer.addr = htonll((uintptr_t)request.write_addr);
+        local_offer.rkey = htonl(res->write_mr->rkey);
+        local_offer.qp_num = htonl(candidate->qp->qp_num);
+        local_offer.remote_qp_num = htonl(candidate->remote_props.qp_num);
+    }
+    bool success =
+        sst_connections->exchange(r_index, local_offer, remote_offer);
+    check_for_error(success, "Could not exchange pool offers with node " +
+                                 std::to_string(r_index));
+    if(candidate &&
+       ntohl(remote_offer.qp_num) == candidate->remote_props.qp_num &&
+       ntohl(remote_offer.remote_qp_num) == candidate->qp->qp_num) {
+        // the remote node uses the same pair, so only the buffer is new
+        cm_con_data_t tmp_con_data;
+        tmp_con_data.addr = remote_offer.addr;
+        tmp_con_data.rkey = remote_offer.rkey;
+        tmp_con_data.qp_num = htonl(candidate->remote_props.qp_num);
+        tmp_con_data.lid = htons(candidate->remote_props.lid);
+        memcpy(tmp_con_data.gid, candidate->remote_props.gid, 16);
+        res->set_remote_con_data(tmp_con_data);
+        return res.release();
+    }
+
+    auto fresh = std::make_shared<shared_queue_pair>();
+    fresh->rail = agree_on_rails(r_index, request.write_addr).primary;
+    fresh->qp = create_qp(
+        verbs_shared_completion_queue().get(), fresh->rail,
+        std::min<unsigned int>(
+            MAX_SEND_WR * MAX_QP_SHARERS,
+            std::max(fresh->rail->device->device_attr.max_qp_wr,
+                     (int)MAX_SEND_WR)),
+        fresh->max_inline_data);
+    ++fresh->rail->num_queue_pairs;
+    res = std::make_unique<resources>(r_index, request.write_addr,
+                                      request.read_addr, request.size_w,
+                                      request.size_r, fresh);
+    cm_con_data_t tmp_con_data;
+    success = sst_connections->exchange(r_index, res->get_local_con_data(),
+                                        tmp_con_data);
+    check_for_error(success, "Could not exchange qp data with node " +
+                                 std::to_string(r_index));
+    res->set_remote_con_data(tmp_con_data);
+    res->set_qp_ready();
+    success = sync(r_index);
+    check_for_error(success,
+                    "Could not sync with node " + std::to_string(r_index) +
+                        " after qp transition to RTS state");
+    fresh->remote_props = res->remote_props;
+    std::lock_guard<std::mutex> lock(qp_pool_mutex);
+    qp_pool[r_index].push_back(fresh);
+    return res.release();
+}
+
+/** The connection data of a batch of queue pairs to the same node. */
+struct cm_con_data_batch_t {
+    cm_con_data_t data[CON_DATA_BATCH_SIZE];
+} __attribute__((packed));
+
+/**
+ * Calls a function on each index below a count, from several threads.
+ *
+ * @param count The number of indices.
+ * @param f The function to call.
+ */
+static void parallel_for(std::size_t count,
+                         const std::function<void(std::size_t)> &f) {
+    std::atomic<std::size_t> next_index{0};
+    auto worker = [&]() {
+        for(std::size_t i = next_index++; i < count; i = next_index++) {
+            f(i);
+        }
+    };
+    std::vector<std::thread> workers;
+    for(std::size_t i = 1; i < std::min<std::size_t>(count, MAX_SETUP_THREADS);
+        ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for(auto &t : workers) {
+        t.join();
+    }
+}
+
+/**
+ * @details
+ * Setting connections up one at a time costs two round trips each, one to
+ * exchange the connection data and one to sync once the queue pair is
+ * ready. Here the rails of the connections to each node are agreed on
+ * once, all the queue pairs are created first, standby ones included, the
+ * data of up to CON_DATA_BATCH_SIZE queue pairs to a node is exchanged in
+ * one round trip, the queue pairs are moved to the ready-to-send state in
+ * parallel, and each node is synced with once. The remote node must make
+ * the same connections to this node, in the same order.
+ *
+ * The exchanges and syncs go over the TCP connections of sst_connections,
+ * which are not known to allow blocking exchanges with different nodes at
+ * once. They are therefore made one node at a time, in increasing order of
+ * rank on every node, so that no cycle of nodes can wait on one another.
+ *
+ * With `shared`, each connection instead goes on a queue pair from a
+ * process-wide pool, so that SSTs between the same nodes share one queue
+ * pair per node rather than each having its own; see connect_shared(). The
+ * connections to each node are then made one after another, so that later
+ * ones can share the queue pair of earlier ones.
+ *
+ * @param requests The connections to make.
+ * @param cq The completion queue to report completions to, or null for the
+ * queue shared by connections created without one. Pooled queue pairs
+ * always report to verbs_shared_completion_queue().
+ * @param shared Whether to use pooled queue pairs.
+ * @return The connections, in the order of `requests`.
+ */
+std::vector<std::unique_ptr<connection>> verbs_make_connections(
+    const std::vector<connection_request> &requests,
+    verbs_completion_queue *cq, bool shared) {
+    std::vector<resources *> connections(requests.size());
+    if(shared) {
+        std::map<int, std::vector<std::size_t>> requests_by_node;
+        for(std::size_t i = 0; i < requests.size(); ++i) {
+            requests_by_node[requests[i].r_index].push_back(i);
+        }
+        // the map orders the nodes by rank
+        for(auto &node_requests : requests_by_node) {
+            for(std::size_t i : node_requests.second) {
+                connections[i] = connect_shared(requests[i]);
+            }
+            cout << "Established " << node_requests.second.size()
+                 << " shared RDMA connections with node "
+                 << node_requests.first << endl;
+        }
+        return std::vector<std::unique_ptr<connection>>(connections.begin(),
+                                                        connections.end());
+    }
+    std::map<int, std::vector<std::size_t>> requests_by_node;
+    for(std::size_t i = 0; i < requests.size(); ++i) {
+        requests_by_node[requests[i].r_index].push_back(i);
     }
-    return {wc.qp_num, 1};
+    // the queue pairs to connect, standby ones included, by node
+    std::map<int, std::vector<resources *>> connections_by_node;
+    std::vector<resources *> queue_pairs;
+    for(auto &node_requests : requests_by_node) {
+        const int r_index = node_requests.first;
+        const rail_choice rails = agree_on_rails(
+            r_index, requests[node_requests.second.front()].write_addr);
+        for(std::size_t i : node_requests.second) {
+            const connection_request &request = requests[i];
+            connections[i] = new resources(r_index, request.write_addr,
+                                           request.read_addr, request.size_w,
+                                           request.size_r, cq, false,
+                                           rails.primary);
+            connections_by_node[r_index].push_back(connections[i]);
+            if(rails.standby) {
+                connections[i]->standby = std::make_unique<resources>(
+                    r_index, request.write_addr, request.read_addr,
+                    request.size_w, request.size_r, cq, false, rails.standby);
+                connections_by_node[r_index].push_back(
+                    connections[i]->standby.get());
+            }
+        }
+        queue_pairs.insert(queue_pairs.end(),
+                           connections_by_node[r_index].begin(),
+                           connections_by_node[r_index].end());
+    }
+
+    // exchange the connection data with every node, a batch at a time, in
+    // the order of their ranks, which the map keeps
+    for(auto &node : connections_by_node) {
+        int r_index = node.first;
+        std::vector<resources *> &node_connections = node.second;
+        for(std::size_t first = 0; first < node_connections.size();
+            first += CON_DATA_BATCH_SIZE) {
+            std::size_t batch_size = std::min<std::size_t>(
+                CON_DATA_BATCH_SIZE, node_connections.size() - first);
+            cm_con_data_batch_t local_batch, remote_batch;
+            memset(&local_batch, 0, sizeof(local_batch));
+            for(std::size_t i = 0; i < batch_size; ++i) {
+                local_batch.data[i] =
+                    node_connections[first + i]->get_local_con_data();
+            }
+            bool success = sst_connections->exchange(r_index, local_batch,
+                                                     remote_batch);
+            check_for_error(success, "Could not exchange qp data with node " +
+                                         std::to_string(r_index));
+            for(std::size_t i = 0; i < batch_size; ++i) {
+                node_connections[first + i]->set_remote_con_data(
+                    remote_batch.data[i]);
+            }
+        }
+    }
+
+    parallel_for(queue_pairs.size(),
+                 [&](std::size_t i) { queue_pairs[i]->set_qp_ready(); });
+
+    // sync to make sure that both sides are ready before either sends
+    for(auto &node : connections_by_node) {
+        bool success = sync(node.first);
+        check_for_error(success, "Could not sync with node " +
+                                     std::to_string(node.first) +
+                                     " after qp transition to RTS state");
+        cout << "Established " << requests_by_node[node.first].size()
+             << " RDMA connections with node " << node.first << endl;
+    }
+
+    return std::vector<std::unique_ptr<connection>>(connections.begin(),
+                                                    connections.end());
+}
+
+/**
+ * @param owner The owner part of the tags of the connections to poll.
+ * @param entries The array to store the completions in.
+ * @param max_entries The maximum number of completions to return.
+ * @param cq The completion queue of the connections, or null for the queue
+ * shared by connections created without one.
+ * @param block Whether to wait for a completion.
+ * @return The number of completions stored in `entries`, or 0 if none was
+ * found before the timeout.
+ */
+int verbs_poll_completions(uint32_t owner, completion *entries,
+                           int max_entries, verbs_completion_queue *cq,
+                           bool block) {
+    if(!cq) {
+        cq = g_res->cq;
+    }
+    return cq->poll(owner, entries, max_entries, block);
+}
+
+unsigned int verbs_max_outstanding_writes() { return MAX_SEND_WR / 2; }
+
+/**
+ * @return pair(index,result) The index part of the tag of the connection
+ * associated with the completed request and the result (1 for successful, -1
+ * for unsuccessful, 0 if no completion found)
+ */
+std::pair<int, int> verbs_poll_completion() {
+    completion entry;
+    if(verbs_poll_completions(0, &entry, 1) == 0) {
+        return {-1, 0};
+    }
+    return {tag_index(entry.tag), entry.result};
 }
 
 /** Allocates memory for global RDMA resources. */
 void resources_init() {
     // initialize the global resources
-    g_res = (global_resources *)malloc(sizeof(global_resources));
-    memset(g_res, 0, sizeof *g_res);
+    g_res = new global_resources();
+}
+
+/**
+ * @details
+ * The node is read from sysfs, which reports -1 on machines without NUMA.
+ *
+ * @param ib_ctx An opened device.
+ * @return The NUMA node of the device, or ANY_NUMA_NODE if it is unknown.
+ */
+static int device_numa_node(struct ibv_context *ib_ctx) {
+    std::ifstream numa_file(std::string("/sys/class/infiniband/") +
+                            ibv_get_device_name(ib_ctx->device) +
+                            "/device/numa_node");
+    int node = ANY_NUMA_NODE;
+    if(!(numa_file >> node) || node < 0) {
+        return ANY_NUMA_NODE;
+    }
+    return node;
 }
 
-/** Creates global RDMA resources. */
+/**
+ * @param ib_dev A device in the system.
+ * @return The device, opened along with its protection domain, or the one
+ * opened before if the device is already open; null if it cannot be opened.
+ */
+static rdma_device *open_device(struct ibv_device *ib_dev) {
+    for(const auto &device : g_res->devices) {
+        if(device->ib_ctx->device == ib_dev) {
+            return device.get();
+        }
+    }
+    auto device = std::make_unique<rdma_device>();
+    device->index = g_res->devices.size();
+    // get device handle
+    device->ib_ctx = ibv_open_device(ib_dev);
+    check_for_error(device->ib_ctx, "Could not open RDMA device " +
+                                        string(ibv_get_device_name(ib_dev)));
+    if(!device->ib_ctx) {
+        return NULL;
+    }
+    // allocate Protection Domain
+    device->pd = ibv_alloc_pd(device->ib_ctx);
+    check_for_error(device->pd, "Could not allocate protection domain");
+    // get the device attributes for the device
+    ibv_query_device(device->ib_ctx, &device->device_attr);
+    device->numa_node = device_numa_node(device->ib_ctx);
+    g_res->devices.push_back(std::move(device));
+    return g_res->devices.back().get();
+}
+
+/**
+ * @param device An opened device.
+ * @param port A port number on the device.
+ * @param weight The turns the rail gets under rail_policy::weighted.
+ * @param id The position of the rail among the rails asked for.
+ */
+static void open_rail(rdma_device *device, int port, unsigned int weight,
+                      unsigned int id) {
+    if(id >= MAX_RAILS) {
+        cerr << "Only " << MAX_RAILS << " RDMA rails can be opened" << endl;
+        return;
+    }
+    auto rail = std::make_unique<rdma_rail>();
+    rail->device = device;
+    rail->port = port;
+    rail->id = id;
+    rail->weight = weight;
+    // query port properties
+    int rc = ibv_query_port(device->ib_ctx, port, &rail->port_attr);
+    check_for_error(!rc, "Could not query port properties, error code is " +
+                             std::to_string(rc));
+    if(rc) {
+        return;
+    }
+    g_res->rails.push_back(std::move(rail));
+}
+
+/**
+ * @param list A comma-separated list of rails, each of the form
+ * device:port[:weight].
+ * @return The rails in the list.
+ */
+static std::vector<rail_spec> parse_rails(const string &list) {
+    std::vector<rail_spec> specs;
+    std::size_t begin = 0;
+    while(begin < list.size()) {
+        std::size_t end = list.find(',', begin);
+        if(end == string::npos) {
+            end = list.size();
+        }
+        string item = list.substr(begin, end - begin);
+        begin = end + 1;
+        rail_spec spec;
+        std::size_t colon = item.find(':');
+        spec.device = item.substr(0, colon);
+        if(colon != string::npos) {
+            spec.port = atoi(item.c_str() + colon + 1);
+            std::size_t weight_colon = item.find(':', colon + 1);
+            if(weight_colon != string::npos) {
+                spec.weight = atoi(item.c_str() + weight_colon + 1);
+            }
+        }
+        if(!spec.device.empty()) {
+            specs.push_back(spec);
+        }
+    }
+    return specs;
+}
+
+/**
+ * @details
+ * The rails are those given to verbs_set_rails(), or else those named by
+ * the SST_RDMA_RAILS environment variable, as a list parsed by
+ * parse_rails() or "all" for every port of every device; SST_RAIL_POLICY
+ * may then be "round_robin", "numa_local" or "weighted". Without either,
+ * the only rail is port `ib_port` of device `dev_name`, or of the first
+ * device.
+ */
 void resources_create() {
     struct ibv_device **dev_list = NULL;
-    struct ibv_device *ib_dev = NULL;
-    int i;
     int cq_size = 0;
     int num_devices;
-    int rc = 0;
 
     // get device names in the system
     dev_list = ibv_get_device_list(&num_devices);
@@ -478,55 +1858,87 @@ void resources_create() {
 
     // if there isn't any IB device in host
     check_for_error(num_devices, "NO RDMA device present");
-    // search for the specific device we want to work with
-    for(i = 0; i < num_devices; i++) {
-        if(!dev_name) {
-            dev_name = strdup(ibv_get_device_name(dev_list[i]));
+
+    std::vector<rail_spec> specs = rail_specs;
+    bool all_ports = false;
+    if(specs.empty()) {
+        const char *list = getenv("SST_RDMA_RAILS");
+        const char *policy = getenv("SST_RAIL_POLICY");
+        if(list) {
+            all_ports = !strcmp(list, "all");
+            specs = parse_rails(list);
         }
-        if(!strcmp(ibv_get_device_name(dev_list[i]), dev_name)) {
-            ib_dev = dev_list[i];
-            break;
+        if(policy && !strcmp(policy, "numa_local")) {
+            rails_policy = rail_policy::numa_local;
+        } else if(policy && !strcmp(policy, "weighted")) {
+            rails_policy = rail_policy::weighted;
+        }
+    }
+    if(all_ports) {
+        unsigned int id = 0;
+        for(int i = 0; i < num_devices; i++) {
+            rdma_device *device = open_device(dev_list[i]);
+            for(int port = 1;
+                device && port <= device->device_attr.phys_port_cnt; ++port) {
+                open_rail(device, port, 1, id++);
+            }
+        }
+    } else {
+        if(specs.empty() && num_devices > 0) {
+            specs.push_back({dev_name ? dev_name
+                                      : ibv_get_device_name(dev_list[0]),
+                             ib_port, 1});
+        }
+        // search for the devices we want to work with
+        for(std::size_t id = 0; id < specs.size(); ++id) {
+            const rail_spec &spec = specs[id];
+            struct ibv_device *ib_dev = NULL;
+            for(int i = 0; i < num_devices; i++) {
+                if(spec.device == ibv_get_device_name(dev_list[i])) {
+                    ib_dev = dev_list[i];
+                    break;
+                }
+            }
+            // if the device wasn't found in host
+            check_for_error(ib_dev, "RDMA device " + spec.device +
+                                        " not found in the host");
+            rdma_device *device = ib_dev ? open_device(ib_dev) : NULL;
+            if(device) {
+                open_rail(device, spec.port, spec.weight, id);
+            }
         }
     }
-    // if the device wasn't found in host
-    check_for_error(ib_dev, "No RDMA devices found in the host");
-    // get device handle
-    g_res->ib_ctx = ibv_open_device(ib_dev);
-    check_for_error(g_res->ib_ctx, "Could not open RDMA device");
     // we are now done with device list, free it
-    ibv_free_device_list(dev_list);
-    dev_list = NULL;
-    ib_dev = NULL;
-    // query port properties
-    rc = ibv_query_port(g_res->ib_ctx, ib_port, &g_res->port_attr);
-    check_for_error(!rc, "Could not query port properties, error code is " +
-                             std::to_string(rc));
-
-    // allocate Protection Domain
-    g_res->pd = ibv_alloc_pd(g_res->ib_ctx);
-    check_for_error(g_res->pd, "Could not allocate protection domain");
-
-    // get the device attributes for the device
-    ibv_query_device(g_res->ib_ctx, &g_res->device_attr);
+    if(dev_list) {
+        ibv_free_device_list(dev_list);
+    }
+    check_for_error(!g_res->rails.empty(), "No RDMA rail could be opened");
+    if(g_res->rails.size() > 1) {
+        for(const auto &rail : g_res->rails) {
+            cout << "Opened RDMA rail "
+                 << ibv_get_device_name(rail->device->ib_ctx->device) << ":"
+                 << rail->port << endl;
+        }
+    }
 
     // set to 1000 entries, we actually don't need more than the number of nodes
     cq_size = 1000;
-    g_res->cq = ibv_create_cq(g_res->ib_ctx, cq_size, NULL, NULL, 0);
-    check_for_error(g_res->cq,
-                    "Could not create completion queue, error code is " +
-                        std::to_string(errno));
-}
-
-bool add_node(uint32_t new_id, const string new_ip_addr) {
-    return sst_connections->add_node(new_id, new_ip_addr);
+    g_res->cq = new verbs_completion_queue(cq_size);
 }
 
 /**
-*@param r_index The node rank of the node to exchange data with.
-*/
-bool sync(uint32_t r_index) {
-    int s = 0, t = 0;
-    return sst_connections->exchange(r_index, s, t);
+ * @details
+ * Without this, the rails are read from the environment; see
+ * resources_create().
+ *
+ * @param rails The rails to open, in order; the first is the one used when
+ * no other is up. Every node must open the same rails in the same order,
+ * since nodes name rails to each other by their position.
+ * @param policy How to spread connections over the rails.
+ */
+void verbs_set_rails(const std::vector<rail_spec> &rails, rail_policy policy) {
+    rail_specs = rails;
+    rails_policy = policy;
 }
 
 /**
@@ -534,7 +1946,8 @@ bool sync(uint32_t r_index) {
  * This must be called before creating or using any SST instance.
  */
   void verbs_initialize(const map<uint32_t, string> &ip_addrs, uint32_t node_rank) {
-    sst_connections = new tcp::tcp_connections(node_rank, ip_addrs, port);
+    connections_initialize(ip_addrs, node_rank, Transport::RDMA);
+    local_rank = node_rank;
 
     // init all of the resources, so cleanup will be easy
     resources_init();
@@ -544,6 +1957,94 @@ bool sync(uint32_t r_index) {
     cout << "Initialized global RDMA resources" << endl;
 }
 
+/**
+ * @details
+ * Connections whose buffers lie inside the memory share its memory region,
+ * so a whole SST table costs one registration per device however many
+ * members it has.
+ *
+ * @param addr The start of the memory.
+ * @param size The size of the memory (in bytes).
+ */
+void verbs_register_memory(void *addr, std::size_t size) {
+    for(const auto &device : g_res->devices) {
+        struct ibv_mr *mr = acquire_memory(device->pd, (char *)addr, size);
+        check_for_error(mr,
+                        "Could not register memory region, error code is : " +
+                            std::to_string(errno));
+    }
+}
+
+/**
+ * @details
+ * The memory region stays registered until the connections that share it
+ * are destroyed as well.
+ *
+ * @param addr The start of memory passed to verbs_register_memory().
+ */
+void verbs_deregister_memory(void *addr) {
+    for(const auto &device : g_res->devices) {
+        struct ibv_mr *mr = NULL;
+        {
+            std::lock_guard<std::mutex> lock(registrations_mutex);
+            for(const auto &registration : registrations) {
+                if(registration.mr->addr == addr &&
+                   registration.mr->pd == device->pd) {
+                    mr = registration.mr;
+                    break;
+                }
+            }
+        }
+        if(mr) {
+            int rc = release_memory(mr);
+            check_for_error(
+                !rc, "Could not de-register memory region, error code is " +
+                         std::to_string(rc));
+        }
+    }
+}
+
+/**
+ * @return The NUMA node of the device of the first rail, or ANY_NUMA_NODE
+ * if it is unknown.
+ */
+int verbs_numa_node() {
+    if(g_res->rails.empty()) {
+        return ANY_NUMA_NODE;
+    }
+    return g_res->rails.front()->device->numa_node;
+}
+
+/**
+ * @details
+ * The counters are read without stopping the threads that post, so each is
+ * up to date but they may be slightly out of step with each other.
+ *
+ * @return The counters of each rail, in the order the rails were opened.
+ */
+std::vector<rail_counters> verbs_rail_counters() {
+    std::vector<rail_counters> counters;
+    for(const auto &rail : g_res->rails) {
+        rail_counters entry;
+        entry.device = ibv_get_device_name(rail->device->ib_ctx->device);
+        entry.port = rail->port;
+        entry.active = rail_active(rail.get());
+        entry.num_queue_pairs = rail->num_queue_pairs;
+        entry.num_writes = rail->num_writes;
+        entry.bytes_written = rail->bytes_written;
+        entry.num_reads = rail->num_reads;
+        entry.bytes_read = rail->bytes_read;
+        entry.num_atomics = rail->num_atomics;
+        counters.push_back(entry);
+    }
+    return counters;
+}
+
+std::size_t verbs_num_memory_regions() {
+    std::lock_guard<std::mutex> lock(registrations_mutex);
+    return registrations.size();
+}
+
 /**
  * @details
  * This cleans up all the global resources used by the SST system, so it should
@@ -551,18 +2052,23 @@ bool sync(uint32_t r_index) {
  */
 void verbs_destroy() {
     int rc;
-    if(g_res->cq) {
-        rc = ibv_destroy_cq(g_res->cq);
-        check_for_error(!rc, "Could not destroy completion queue");
-    }
-    if(g_res->pd) {
-        rc = ibv_dealloc_pd(g_res->pd);
-        check_for_error(!rc, "Could not deallocate protection domain");
+    {
+        std::lock_guard<std::mutex> lock(qp_pool_mutex);
+        qp_pool.clear();
+        pool_cq.reset();
     }
-    if(g_res->ib_ctx) {
-        rc = ibv_close_device(g_res->ib_ctx);
+    delete g_res->cq;
+    g_res->cq = NULL;
+    g_res->rails.clear();
+    for(const auto &device : g_res->devices) {
+        if(device->pd) {
+            rc = ibv_dealloc_pd(device->pd);
+            check_for_error(!rc, "Could not deallocate protection domain");
+        }
+        rc = ibv_close_device(device->ib_ctx);
         check_for_error(!rc, "Could not close RDMA device");
     }
+    g_res->devices.clear();
 }
 
 }  // namespace sst
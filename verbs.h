@@ -7,10 +7,19 @@
  * including the Resources class and global setup functions.
  */
 
+#include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <infiniband/verbs.h>
 
+#include "transport.h"
+
 namespace sst {
 
 /** Structure to exchange the data needed to connect the Queue Pairs */
@@ -27,11 +36,125 @@ struct cm_con_data_t {
     uint8_t gid[16];
 } __attribute__((packed));
 
+/** How connections are spread over the rails, when there are several. */
+enum class rail_policy {
+    /** The connections to a remote node go on rail number (local rank +
+     * remote rank) modulo the number of rails up at both ends, so that both
+     * ends pick the same rail and remote nodes are spread evenly over the
+     * rails. */
+    round_robin,
+    /** As round_robin, but among the rails whose device is on the NUMA node
+     * of the connection's buffers at both ends, or else at the lower-ranked
+     * end, if there are any. */
+    numa_local,
+    /** As round_robin, but each rail gets as many turns as its weight, to
+     * suit ports of different speeds. */
+    weighted
+};
+
+/** A port of an RDMA device that connections may use, called a rail. */
+struct rail_spec {
+    /** The name of the RDMA device. */
+    std::string device;
+    /** The port number on the device, starting from 1. */
+    int port = 1;
+    /** The turns the rail gets under rail_policy::weighted. */
+    unsigned int weight = 1;
+};
+
+/** The traffic posted on a rail so far; the difference between two samples
+ * gives its throughput. */
+struct rail_counters {
+    /** The name of the RDMA device. */
+    std::string device;
+    /** The port number on the device. */
+    int port;
+    /** Whether the port is up, so that new connections may use it. */
+    bool active;
+    /** Number of queue pairs on the rail. */
+    uint64_t num_queue_pairs;
+    /** Number of RDMA writes posted, with or without immediate. */
+    uint64_t num_writes;
+    /** Number of bytes written. */
+    uint64_t bytes_written;
+    /** Number of RDMA reads posted. */
+    uint64_t num_reads;
+    /** Number of bytes read. */
+    uint64_t bytes_read;
+    /** Number of atomic operations posted. */
+    uint64_t num_atomics;
+};
+
+struct rdma_rail;
+
+/**
+ * A completion queue shared by a group of queue pairs, usually those of one
+ * SST, along with the completions drained from it that are waiting for
+ * another poller.
+ */
+class verbs_completion_queue : public completion_queue {
+private:
+    /** Moves stashed completions of an owner out of the stash. */
+    int take_stashed(uint32_t owner, completion *entries, int max_entries);
+    /** Stashes a completion for its owner's next poll. */
+    void stash(const completion &entry);
+
+    /** Completions drained by one poller that belong to another owner, or
+     * that did not fit in its array, keyed by owner. */
+    std::unordered_map<uint32_t, std::deque<completion>> stashed;
+    /** Protects `stashed`. */
+    std::mutex stash_mutex;
+    /** Number of completions in `stashed`, so that pollers can skip the lock
+     * when it is empty. */
+    std::atomic<int> num_stashed;
+
+public:
+    /** Handles for the IB Verbs Completion Queue objects, one per device, in
+     * the order the devices were opened; a queue pair reports to the one of
+     * its device. */
+    std::vector<struct ibv_cq *> cqs;
+    /** Channels that report new completions, one per device, or empty if
+     * the queue is only ever polled. */
+    std::vector<struct ibv_comp_channel *> channels;
+
+    /** Constructor; creates a completion queue with room for `size`
+     * entries on each device, and optionally event channels for them. */
+    verbs_completion_queue(int size, bool with_channel = false);
+    /** Destroys the completion queue. */
+    virtual ~verbs_completion_queue();
+    /** Sleeps on the event channels until a completion arrives. */
+    void wait(int timeout_us);
+    /** Waits for completions of operations posted on an owner's queue
+     * pairs. */
+    int poll(uint32_t owner, completion *entries, int max_entries,
+             bool block = true);
+};
+
+/**
+ * A queue pair that several connections to the same remote node post on,
+ * usually those of different SSTs. Their completions are told apart by the
+ * connection tags in their work request ids.
+ */
+struct shared_queue_pair {
+    /** Handle for the IB Verbs Queue Pair object. */
+    struct ibv_qp *qp;
+    /** Largest write, in bytes, that is sent inline. */
+    uint32_t max_inline_data;
+    /** The rail the queue pair was created on. */
+    rdma_rail *rail;
+    /** Connection data of the remote queue pair; the buffer fields are
+     * those of the connection that created the pair. */
+    struct cm_con_data_t remote_props;
+
+    /** Destroys the queue pair. */
+    ~shared_queue_pair();
+};
+
 /**
  * Represents the set of RDMA resources needed to maintain a two-way connection
  * to a single remote node.
  */
-class resources {
+class resources : public connection {
 private:
     /** Initializes the queue pair. */
     void set_qp_initialized();
@@ -43,15 +166,22 @@ private:
     void connect_qp();
     /** Post a remote RDMA operation. */
     int post_remote_send(long long int offset, long long int size, int op);
+    /** Builds the work request templates once the remote side is known. */
+    void init_send_templates();
+    /** Registers the buffers and records the remote node. */
+    void init_buffers(int r_index, char *write_addr, char *read_addr,
+                      int size_w, int size_r);
 
 public:
-    /** Index of the remote node. */
-    int remote_index;
     /** Handle for the IB Verbs Queue Pair object. */
     struct ibv_qp *qp;
-    /** Memory Region handle for the write buffer. */
+    /** The rail that `qp` is on, which decides the device and port used. */
+    rdma_rail *rail;
+    /** Memory Region handle for the write buffer, possibly shared with
+     * other connections. */
     struct ibv_mr *write_mr;
-    /** Memory Region handle for the read buffer. */
+    /** Memory Region handle for the read buffer, possibly shared with other
+     * connections. */
     struct ibv_mr *read_mr;
     /** Connection data values needed to connect to remote side. */
     struct cm_con_data_t remote_props;
@@ -60,13 +190,49 @@ public:
     /** Pointer to the memory buffer used for the results of RDMA remote reads.
      */
     char *read_buf;
+    /** Prebuilt work requests for reads (index 0) and writes (index 1). */
+    struct ibv_send_wr send_templates[2];
+    /** Prebuilt scatter/gather entry for the local buffer. */
+    struct ibv_sge sge_template;
+    /** Largest write, in bytes, that is copied into the work request
+     * instead of being read by the device from `read_buf`. */
+    uint32_t max_inline_data;
+    /** Writes posted without a completion since the last signaled one. */
+    std::atomic<unsigned int> unsignaled_writes;
+    /** Memory Region handle for `atomic_result`, or null until the first
+     * atomic operation. */
+    struct ibv_mr *atomic_mr;
+    /** The pooled queue pair that `qp` belongs to, or null if this
+     * connection has a queue pair of its own. */
+    std::shared_ptr<shared_queue_pair> shared_qp;
+    /** The work request id of the receives posted for notifications. */
+    uint64_t notify_tag = 0;
+    /** A queue pair to the same node on a second rail, which fail_over()
+     * moves the connection to, or null if there is no other rail or the
+     * queue pair is pooled. */
+    std::unique_ptr<resources> standby;
+    /** Whether the connection has moved to its standby queue pair. */
+    bool failed_over = false;
 
     /** Constructor; initializes Queue Pair, Memory Regions, and `remote_props`.
      */
     resources(int r_index, char *write_addr, char *read_addr, int size_w,
-              int size_r);
+              int size_r, verbs_completion_queue *cq = nullptr,
+              bool connect = true, rdma_rail *_rail = nullptr);
+    /** Constructor; initializes Memory Regions on a shared Queue Pair. */
+    resources(int r_index, char *write_addr, char *read_addr, int size_w,
+              int size_r, std::shared_ptr<shared_queue_pair> _shared_qp);
     /** Destroys the resources. */
     virtual ~resources();
+    /** Completions on this connection are reported by queue pair number. */
+    uint32_t get_id() const { return qp->qp_num; }
+    uint32_t get_max_inline_data() const { return max_inline_data; }
+    /** Gets the data the remote side needs to connect to this queue pair. */
+    cm_con_data_t get_local_con_data() const;
+    /** Fills in `remote_props` from the data sent by the remote side. */
+    void set_remote_con_data(const cm_con_data_t &tmp_con_data);
+    /** Moves the queue pair to the ready-to-send state. */
+    void set_qp_ready();
     /*
       wrapper functions that make up the user interface
       all call post_remote_send with different parameters
@@ -79,14 +245,87 @@ public:
     void post_remote_write(long long int size);
     /** Post an RDMA write at an offset into remote memory. */
     void post_remote_write(long long int offset, long long int size);
+    /** Post an RDMA write with immediate at an offset into remote memory. */
+    void post_remote_write_with_imm(long long int offset, long long int size,
+                                    uint32_t imm);
+    /** Post a chain of RDMA writes of several ranges into remote memory. */
+    void post_remote_write_ranges(const byte_range *ranges,
+                                  std::size_t num_ranges,
+                                  const uint32_t *imm);
+    /** Posts the receives that notifications consume. */
+    bool enable_notifications(uint64_t _notify_tag);
+    /** Posts a receive in place of one a notification consumed. */
+    void notification_consumed();
+    /** Moves the connection to its standby queue pair if its own failed. */
+    bool fail_over(bool &moved);
+    /** Post an RDMA atomic operation at an offset into remote memory. */
+    bool post_remote_atomic(long long int offset, atomic_op op,
+                            uint64_t compare_add, uint64_t swap,
+                            uint64_t atomic_tag);
+    /** Fills in a work request for an operation from the templates; writes
+     * that fit in `max_inline_data` are sent inline. */
+    void prepare_remote_send(long long int offset, long long int size, int op,
+                             struct ibv_send_wr &sr,
+                             struct ibv_sge &sge) const {
+        sge = sge_template;
+        sge.addr += offset;
+        sge.length = size;
+        sr = send_templates[op];
+        sr.wr_id = tag;
+        sr.sg_list = &sge;
+        sr.wr.rdma.remote_addr += offset;
+        if(op == 1 && size <= max_inline_data) {
+            sr.send_flags |= IBV_SEND_INLINE;
+        }
+    }
 };
 
-bool add_node(uint32_t new_id, const std::string new_ip_addr);
-bool sync(uint32_t r_index);
+/** Chooses the rails to open and how to spread connections over them. */
+void verbs_set_rails(const std::vector<rail_spec> &rails,
+                     rail_policy policy = rail_policy::round_robin);
 /** Initializes the global verbs resources. */
 void verbs_initialize(const std::map<uint32_t, std::string> &ip_addrs,
                       uint32_t node_rank);
-/** Polls for completion of a single posted remote read. */
+/** Posts the same RDMA write to several remote nodes. */
+std::size_t verbs_post_remote_writes(
+    connection *const *targets, std::size_t count, long long int offset,
+    long long int size, const signal_policy &policy = signal_policy(),
+    std::vector<bool> *signaled = nullptr, const uint32_t *imm = nullptr);
+/** Posts the same chain of RDMA writes of several ranges to several remote
+ * nodes. */
+std::size_t verbs_post_remote_writes(
+    connection *const *targets, std::size_t count, const byte_range *ranges,
+    std::size_t num_ranges, const signal_policy &policy = signal_policy(),
+    std::vector<bool> *signaled = nullptr, const uint32_t *imm = nullptr);
+/** Connects to several remote nodes at once. */
+std::vector<std::unique_ptr<connection>> verbs_make_connections(
+    const std::vector<connection_request> &requests,
+    verbs_completion_queue *cq = nullptr, bool shared = false);
+/** Returns the completion queue of the pooled queue pairs. */
+std::shared_ptr<verbs_completion_queue> verbs_shared_completion_queue();
+/** Creates a completion queue sized for a number of queue pairs. */
+std::unique_ptr<verbs_completion_queue> verbs_make_completion_queue(
+    std::size_t num_connections, bool with_channel = false,
+    bool with_receives = false);
+/** Waits for the completions of operations posted on an owner's queue
+ * pairs. */
+int verbs_poll_completions(uint32_t owner, completion *entries,
+                           int max_entries,
+                           verbs_completion_queue *cq = nullptr,
+                           bool block = true);
+/** Returns how many writes may be outstanding on a queue pair at once. */
+unsigned int verbs_max_outstanding_writes();
+/** Registers memory that connections created later will share. */
+void verbs_register_memory(void *addr, std::size_t size);
+/** Releases memory passed to verbs_register_memory(). */
+void verbs_deregister_memory(void *addr);
+/** Returns the number of memory regions currently registered. */
+std::size_t verbs_num_memory_regions();
+/** Returns the NUMA node the device of the first rail is attached to. */
+int verbs_numa_node();
+/** Returns the traffic posted on each rail so far. */
+std::vector<rail_counters> verbs_rail_counters();
+/** Polls for completion of a single operation on an untagged queue pair. */
 std::pair<int, int> verbs_poll_completion();
 /** Destroys the global verbs resources. */
 void verbs_destroy();